@@ -21,6 +21,26 @@ enum {
     SYS_munmap  = 9,  // int munmap(void *addr, size_t len)
 };
 
+// mmap 的 prot 参数，总是可读
+enum {
+    PROT_NONE   = 0,
+    PROT_READ   = 1,
+    PROT_WRITE  = 2,
+    PROT_EXEC   = 4,
+};
+
+// mmap 的 flags 参数，映射都是私有的
+// 不带 MAP_FIXED 时，addr 只是提示，由内核选择地址
+// 文件映射的长度不能超过 off 之后的文件内容（按页取整）
+enum {
+    MAP_PRIVATE   = 0x02,
+    MAP_FIXED     = 0x10,
+    MAP_ANONYMOUS = 0x20,   // 匿名映射按需分配清零的页，忽略 fd、off
+};
+
+// mmap 失败的返回值
+#define MAP_FAILED  ((void*)-1)
+
 //==============================================================================
 // 用户态系统调用包装函数（inline assembly）
 //==============================================================================
@@ -15,6 +15,12 @@ typedef struct acpi_tbl {
     uint32_t    creator_revision;
 } PACKED acpi_tbl_t;
 
+// MADT、SRAT 等表的子表头
+typedef struct acpi_subtbl {
+    uint8_t     type;
+    uint8_t     length;
+} PACKED acpi_subtbl_t;
+
 INIT_TEXT size_t acpi_rsdp_probe();
 INIT_TEXT void acpi_rsdp_parse(size_t rsdp);
 
@@ -29,11 +29,6 @@ typedef struct madt {
 #define MADT_TYPE_GENERIC_TRANSLATOR        15
 #define MADT_TYPE_RESERVED                  16
 
-typedef struct acpi_subtbl {
-    uint8_t     type;
-    uint8_t     length;
-} PACKED acpi_subtbl_t;
-
 // type = 0, Processor Local APIC
 typedef struct madt_loapic {
     acpi_subtbl_t header;
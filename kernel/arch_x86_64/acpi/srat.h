@@ -0,0 +1,64 @@
+#ifndef ARCH_X86_64_ACPI_SRAT_H
+#define ARCH_X86_64_ACPI_SRAT_H
+
+#include "acpi.h"
+
+// System Resource Affinity Table
+typedef struct srat {
+    acpi_tbl_t  header;
+    uint32_t    reserved1;  // 必须为 1
+    uint64_t    reserved2;
+} PACKED srat_t;
+
+#define SRAT_TYPE_CPU_AFFINITY      0
+#define SRAT_TYPE_MEMORY_AFFINITY   1
+#define SRAT_TYPE_X2APIC_AFFINITY   2
+
+#define SRAT_CPU_ENABLED            1
+#define SRAT_MEM_ENABLED            1
+#define SRAT_MEM_HOT_PLUGGABLE      2
+#define SRAT_MEM_NON_VOLATILE       4
+
+// type = 0, Processor Local APIC/SAPIC Affinity
+typedef struct srat_cpu_affinity {
+    acpi_subtbl_t header;
+    uint8_t       domain_lo;    // proximity domain 的 0~7 位
+    uint8_t       apic_id;
+    uint32_t      flags;
+    uint8_t       sapic_eid;
+    uint8_t       domain_hi[3]; // proximity domain 的 8~31 位
+    uint32_t      clock_domain;
+} PACKED srat_cpu_affinity_t;
+
+// type = 1, Memory Affinity
+typedef struct srat_mem_affinity {
+    acpi_subtbl_t header;
+    uint32_t      domain;
+    uint16_t      reserved1;
+    uint64_t      base;
+    uint64_t      length;
+    uint32_t      reserved2;
+    uint32_t      flags;
+    uint64_t      reserved3;
+} PACKED srat_mem_affinity_t;
+
+// type = 2, Processor Local x2APIC Affinity
+typedef struct srat_x2apic_affinity {
+    acpi_subtbl_t header;
+    uint16_t      reserved1;
+    uint32_t      domain;
+    uint32_t      apic_id;
+    uint32_t      flags;
+    uint32_t      clock_domain;
+    uint32_t      reserved2;
+} PACKED srat_x2apic_affinity_t;
+
+// System Locality Information Table，记录节点之间的相对距离
+// entries 是 count*count 矩阵，本地距离为 10
+typedef struct slit {
+    acpi_tbl_t  header;
+    uint64_t    count;
+    uint8_t     entries[0];
+} PACKED slit_t;
+
+#endif // ARCH_X86_64_ACPI_SRAT_H
@@ -8,6 +8,11 @@
 #define PAGE_SHIFT  12
 #define PAGE_SIZE   0x1000UL
 
+// 大页（2M），不小于这个尺寸的 vmspace 范围按大页对齐，映射时可以使用大页
+// 1G 页超出了伙伴系统的最大块（128M），无法由物理页分配器直接提供
+#define LARGE_PAGE_SHIFT    21
+#define LARGE_PAGE_SIZE     0x200000UL
+
 //------------------------------------------------------------------------------
 // 内核地址空间
 //------------------------------------------------------------------------------
@@ -41,7 +46,7 @@
 #define EARLY_RW_SIZE       0x800000    // 需要容纳 framebuf
 #define INIT_STACK_SIZE     0x1000      // 启动使用的临时栈
 #define INT_STACK_SIZE      0x1000      // 中断栈
-#define KERNEL_HEAP_SIZE    0x8000      // 内核堆
+#define KERNEL_HEAP_SIZE    0x8000      // 内核堆初始大小，不够用会自动扩容
 #define KSTACK_SIZE         0x2000      // 内核栈
 #define USTACK_SIZE         0x2000      // 用户栈
 
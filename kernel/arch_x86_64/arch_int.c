@@ -3,6 +3,7 @@
 #include "cpu/gdt_idt_tss.h"
 #include "mem/mem.h"
 #include <task.h>
+#include <proc.h>
 #include <debug.h>
 
 
@@ -65,9 +66,77 @@ static void handle_irq(int vec, regs_t *f) {
 
 // void handle_nm(int vec UNUSED, regs_t *f UNUSED); // arch_fpu.c
 
+// 写时复制换了物理块，需要通知其他 CPU 清除旧映射
+// 异常处理期间中断关闭，而且位于 #PF 专用的 IST 栈，不能在这里 shootdown
+// 先把旧块记在任务上，返回任务上下文之后再完成：
+// - 开中断的代码出错，改为返回到 pf_cow_return，在任务栈上完成，再回到出错的位置
+// - 关中断的内核代码出错，只能等系统调用返回用户态之前完成，每次最多一个
+
+extern void pf_cow_return();    // arch_entries.S
+
+// 在出错位置的栈上伪造中断返回帧，让异常先返回到 pf_cow_return
+// 来自用户态则使用任务的内核栈，此时内核栈是空的
+static void pf_cow_redirect(task_t *self, regs_t *f) {
+    size_t top = (f->cs & 3) ? self->stack0 : f->rsp;
+    uint64_t *frame = (uint64_t*)((top - 5 * sizeof(uint64_t)) & ~15UL);
+    frame[0] = f->rip;
+    frame[1] = f->cs;
+    frame[2] = f->rflags;
+    frame[3] = f->rsp;
+    frame[4] = f->ss;
+
+    f->rip = (uint64_t)pf_cow_return;
+    f->cs = 0x08;
+    f->ss = 0x10;
+    f->rflags = 0x202;  // 只开中断，不沿用用户态的 DF、TF 等标志
+    f->rsp = (uint64_t)frame;
+}
+
+// pf_cow_return 和系统调用返回时调用，开中断，位于任务上下文
+void pf_cow_flush() {
+    task_t *self = current_task();
+    if (self->cow.old) {
+        vmspace_cow_finish(&self->cow);
+    }
+}
+
 // #PF 页错误处理函数
 static void handle_pf(int vec UNUSED, regs_t *f) {
     uint64_t va = read_cr2();
+
+    // 写入正在迁移的页，返回之后重试
+    if ((3 == (f->errcode & 3)) && vmspace_migrating(va)) {
+        return;
+    }
+
+    // 访问按需分配范围中尚未映射的页，或者写入写时复制的页，处理之后重试
+    // 用户地址属于当前进程（内核代码也可能访问用户缓冲区），其余属于内核
+    // 用户态访问内核地址必须报错，不能替它分配内核的按需页
+    if ((0 == (f->errcode & 1)) || (f->errcode & 2)) {
+        int write = 0 != (f->errcode & 2);
+        task_t *self = current_task();
+        int intr = 0 != (f->rflags & 0x200);
+        vm_cow_t cow;
+
+        // 还有没完成的旧块，不能再写时复制，开中断则先完成它，再重新执行
+        if (self->process && self->cow.old && (f->errcode & 1)) {
+            if (intr) {
+                pf_cow_redirect(self, f);
+                return;
+            }
+        } else if (self->process && vmspace_fault(&self->process->vm, va, write, &cow)) {
+            if (cow.old) {
+                self->cow = cow;
+                if (intr) {
+                    pf_cow_redirect(self, f);
+                }
+            }
+            return;
+        }
+        if ((0 == (f->errcode & 4)) && vmspace_fault(&g_kernel_vm, va, write, &cow)) {
+            return;
+        }
+    }
     const char *p  = (f->errcode & 1) ? "" : "non-";
     const char *wr = (f->errcode & 2) ? "write to" : "read from";
     const char *us = (f->errcode & 4) ? "user mode" : "kernel";
@@ -21,6 +21,7 @@ void load_tr() {}
 uint64_t isr_entries[1];
 void syscall_entry() {}
 void arch_task_switch() {}
+void pf_cow_return() {}
 void arch_enter_ring3(size_t entry, size_t stack_top) {
     (void)entry;
     (void)stack_top;
@@ -64,6 +64,7 @@ INIT_TEXT void mem_init() {
 
     // 1M 以下属于 low-mem，不可分配
     page_init(0x100000, pa_end);
+    numa_mem_init(); // 标记物理页所属节点，必须在 pages_add 之前
 
     // 不再使用 early-alloc
     size_t ro_end = (size_t)early_alloc_ro(0);
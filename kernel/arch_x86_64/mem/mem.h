@@ -2,6 +2,7 @@
 #define ARCH_X86_64_MEM_MEM_H
 
 #include <vmspace.h>
+#include <acpi/srat.h>
 
 INIT_TEXT void kspace_add(vmrange_t *rng, size_t va, size_t end, const char *desc, mmu_attr_t attrs);
 
@@ -17,6 +18,11 @@ INIT_TEXT size_t thiscpu_int_stack();
 INIT_TEXT void mem_init();
 void reclaim_init();
 
+// numa.c
+INIT_TEXT void parse_srat(srat_t *srat, slit_t *slit);
+INIT_TEXT void numa_mem_init();
+INIT_TEXT void numa_cpu_init();
+
 void on_ipi_invlpg(); // mmu.c
 
 #endif // ARCH_X86_64_MEM_MEM_H
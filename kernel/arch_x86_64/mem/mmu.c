@@ -49,15 +49,14 @@
 #define INVLPG(va)  ASMV("invlpg (%0)" :: "r"(va) : "memory")
 
 
-// 分配一张页表
+// 分配一张页表，内容全为零
 static uint64_t alloc_table() {
-    uint64_t pa = page_alloc(0, PT_PGTBL);
+    uint64_t pa = page_alloc_zeroed(0, PT_PGTBL);
     if (0 == pa) {
         panic("cannot alloc for mmu");
         return 0;
     }
     g_pages[pa >> PAGE_SHIFT].ent_num = 0;
-    kmemset(idmap_at(pa), 0, PAGE_SIZE);
     return pa;
 }
 
@@ -687,9 +686,20 @@ static _Atomic int g_shootdown_cnt = 0;
 static size_t g_shootdown_vstart;
 static size_t g_shootdown_vend;
 
+// 范围超过这么多页，逐页 invlpg 不如清空整个 TLB
+// 例如批量释放 slab，这些 slab 分散在 GUARDED_IDMAP 各处
+#define SHOOTDOWN_FULL_PAGES 64
+
 void on_ipi_invlpg() {
-    for (uint64_t va = g_shootdown_vstart; va < g_shootdown_vend; va += PAGE_SIZE) {
-        ASMV("invlpg (%0)" :: "r"(va) : "memory");
+    if (g_shootdown_vend - g_shootdown_vstart > SHOOTDOWN_FULL_PAGES * PAGE_SIZE) {
+        // 切换 PGE 会清除全部 TLB 条目，包括 global 页
+        uint64_t cr4 = read_cr4();
+        write_cr4(cr4 & ~(1UL << 7));
+        write_cr4(cr4);
+    } else {
+        for (uint64_t va = g_shootdown_vstart; va < g_shootdown_vend; va += PAGE_SIZE) {
+            ASMV("invlpg (%0)" :: "r"(va) : "memory");
+        }
     }
     atomic_fetch_sub(&g_shootdown_cnt, 1);
 }
@@ -724,6 +734,16 @@ void tlb_shootdown(size_t vstart, size_t vend) {
     cpu_preempt_restore();
 }
 
+// 能否执行 tlb-shootdown，要求在任务上下文、中断开启（没有持有自旋锁）
+int tlb_may_shootdown() {
+    if (cpu_int_depth()) {
+        return 0;
+    }
+    int key = cpu_int_disable();
+    cpu_int_restore(key);
+    return key;
+}
+
 //------------------------------------------------------------------------------
 // 调试命令，计算某个地址映射的物理地址
 //------------------------------------------------------------------------------
@@ -0,0 +1,152 @@
+#include "mem.h"
+#include "apic/apic.h"
+#include <acpi/srat.h>
+#include <arch_api.h>
+#include <early_alloc.h>
+#include <page.h>
+#include <kstring.h>
+#include <debug.h>
+
+
+// 解析 SRAT、SLIT，得到 NUMA 拓扑
+// ACPI 用 proximity domain 编号，这里映射为从 0 开始的连续节点编号
+// 没有 SRAT，或者只有一个节点，就不启用 NUMA
+
+typedef struct numa_range {
+    size_t   start;
+    size_t   end;
+    int      node;
+} numa_range_t;
+
+static CONST int           g_numa_num = 0;
+static CONST uint32_t      g_numa_domains[PAGE_NODE_NUM];
+static CONST int           g_numa_range_num = 0;
+static CONST numa_range_t *g_numa_ranges = NULL;
+static CONST uint8_t      *g_numa_distance = NULL; // 节点距离矩阵，没有 SLIT 则为 NULL
+static CONST uint8_t      *g_cpu_nodes = NULL;     // 每个 CPU 所在节点
+
+
+static INIT_TEXT int domain_to_node(uint32_t domain) {
+    for (int i = 0; i < g_numa_num; ++i) {
+        if (g_numa_domains[i] == domain) {
+            return i;
+        }
+    }
+    if (g_numa_num < PAGE_NODE_NUM) {
+        g_numa_domains[g_numa_num] = domain;
+        return g_numa_num++;
+    }
+    logk("warning: proximity domain %u merged into node 0\n", domain);
+    return 0;
+}
+
+static INIT_TEXT void set_cpu_node(uint32_t apic_id, int node) {
+    for (int i = 0; i < g_loapic_num; ++i) {
+        if (g_loapics[i].apic_id == apic_id) {
+            g_cpu_nodes[i] = (uint8_t)node;
+            return;
+        }
+    }
+}
+
+static INIT_TEXT void parse_slit(slit_t *slit) {
+    g_numa_distance = early_alloc_ro(g_numa_num * g_numa_num);
+    for (int i = 0; i < g_numa_num; ++i) {
+        for (int j = 0; j < g_numa_num; ++j) {
+            uint64_t from = g_numa_domains[i];
+            uint64_t to = g_numa_domains[j];
+            uint8_t dist = (i == j) ? 10 : 20;
+            if ((from < slit->count) && (to < slit->count)) {
+                dist = slit->entries[from * slit->count + to];
+            }
+            g_numa_distance[i * g_numa_num + j] = dist;
+        }
+    }
+}
+
+// 需要在 parse_madt 之后、mem_init 之前调用，此时 ACPI 表仍可访问
+// slit 可以为 NULL
+INIT_TEXT void parse_srat(srat_t *srat, slit_t *slit) {
+    g_numa_num = 0;
+    g_numa_range_num = 0;
+
+    // 第一次遍历，统计内存范围数量
+    for (size_t i = sizeof(srat_t); i < srat->header.length;) {
+        acpi_subtbl_t *sub = (acpi_subtbl_t*)((size_t)srat + i);
+        i += sub->length;
+
+        if (SRAT_TYPE_MEMORY_AFFINITY == sub->type) {
+            g_numa_range_num += ((srat_mem_affinity_t*)sub)->flags & SRAT_MEM_ENABLED;
+        }
+    }
+
+    g_numa_ranges = early_alloc_ro(g_numa_range_num * sizeof(numa_range_t));
+    g_cpu_nodes = early_alloc_ro(g_loapic_num * sizeof(uint8_t));
+    kmemset(g_cpu_nodes, 0, g_loapic_num * sizeof(uint8_t));
+
+    // 第二次遍历，记录内存范围和 CPU 所在节点
+    int idx = 0;
+    for (size_t i = sizeof(srat_t); i < srat->header.length;) {
+        acpi_subtbl_t *sub = (acpi_subtbl_t*)((size_t)srat + i);
+        i += sub->length;
+
+        switch (sub->type) {
+        case SRAT_TYPE_CPU_AFFINITY: {
+            srat_cpu_affinity_t *cpu = (srat_cpu_affinity_t*)sub;
+            if (cpu->flags & SRAT_CPU_ENABLED) {
+                uint32_t domain = cpu->domain_lo
+                    | ((uint32_t)cpu->domain_hi[0] << 8)
+                    | ((uint32_t)cpu->domain_hi[1] << 16)
+                    | ((uint32_t)cpu->domain_hi[2] << 24);
+                set_cpu_node(cpu->apic_id, domain_to_node(domain));
+            }
+            break;
+        }
+        case SRAT_TYPE_X2APIC_AFFINITY: {
+            srat_x2apic_affinity_t *cpu = (srat_x2apic_affinity_t*)sub;
+            if (cpu->flags & SRAT_CPU_ENABLED) {
+                set_cpu_node(cpu->apic_id, domain_to_node(cpu->domain));
+            }
+            break;
+        }
+        case SRAT_TYPE_MEMORY_AFFINITY: {
+            srat_mem_affinity_t *mem = (srat_mem_affinity_t*)sub;
+            if (mem->flags & SRAT_MEM_ENABLED) {
+                g_numa_ranges[idx].start = mem->base;
+                g_numa_ranges[idx].end = mem->base + mem->length;
+                g_numa_ranges[idx].node = domain_to_node(mem->domain);
+                ++idx;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    ASSERT(idx == g_numa_range_num);
+
+    if (slit) {
+        parse_slit(slit);
+    }
+    logk("SRAT: %d numa nodes, %d memory ranges\n", g_numa_num, g_numa_range_num);
+}
+
+// 在 page_init 之后、pages_add 之前调用，标记每个物理页所属的节点
+INIT_TEXT void numa_mem_init() {
+    if (g_numa_num < 2) {
+        return;
+    }
+
+    page_node_init(g_numa_num, g_numa_distance);
+    for (int i = 0; i < g_numa_range_num; ++i) {
+        page_set_node(g_numa_ranges[i].start, g_numa_ranges[i].end, g_numa_ranges[i].node);
+    }
+}
+
+// 在 thiscpu_init 之后调用，此后分配优先使用当前 CPU 所在节点的内存
+INIT_TEXT void numa_cpu_init() {
+    if (g_numa_num < 2) {
+        return;
+    }
+    page_numa_enable(g_cpu_nodes);
+}
@@ -28,6 +28,11 @@
 #include <sema.h>
 #include <mutex.h>
 #include <msgq.h>
+#include <kreclaim.h>
+#include <heap.h>
+#include <kmalloc.h>
+#include <pool_slub.h>
+#include <kstack.h>
 
 #include <kstring.h>
 #include <debug.h>
@@ -217,6 +222,12 @@ INIT_TEXT NORETURN void sys_init(uint32_t eax, uint32_t ebx) {
     }
     parse_madt(madt);
 
+    // 解析 NUMA 拓扑（可选，依赖 MADT 记录的 APIC ID）
+    srat_t *srat = (srat_t*)acpi_table_find("SRAT", 0);
+    if (srat) {
+        parse_srat(srat, (slit_t*)acpi_table_find("SLIT", 0));
+    }
+
     // 选择输出设备，用于 console
     if (g_fbcolor) {
         // framebuf 需要用到 PCI（仅虚拟机），但此时 PCI 尚未初始化
@@ -242,9 +253,33 @@ INIT_TEXT NORETURN void sys_init(uint32_t eax, uint32_t ebx) {
     thiscpu_init(0);
     ASSERT(cpu_index() == 0);
 
+    // 分配内存时优先使用本地节点（依赖 thiscpu）
+    numa_cpu_init();
+
     // 开启死锁检查（依赖 thiscpu）
     enable_lockdep();
 
+    // 开启 per-CPU 页缓存（依赖 thiscpu）
+    page_cache_enable();
+
+    // 开启内核堆的 per-CPU magazine（依赖 thiscpu）
+    kernel_heap_cache_enable();
+
+    // 开启内存池的 per-CPU slab（依赖 thiscpu）
+    pool_percpu_enable();
+
+    // 通用的对象分配
+    kmalloc_init();
+
+    // 任务退出时缓存内核栈（依赖 thiscpu）
+    kstack_cache_enable();
+
+    // 高阶分配失败时，迁移进程页腾出连续内存
+    page_compact_enable(vmspace_migrate);
+
+    // 空闲内存低于水位线时回收缓存（回收任务稍后创建）
+    page_reclaim_enable(kreclaim_wakeup, kreclaim_direct);
+
     thistss_init_load(0); // 依赖 thiscpu，需要放在 thiscpu_init 之后
     int_init(); // 初始化中断管理机制
     int_init_local();
@@ -326,6 +361,7 @@ static void root_proc() {
     ata_init();
 
     // 启动内核服务（这也是 init-text）
+    kreclaim_start();
     kshell_start();
 
     // 回收 init section
@@ -17,7 +17,10 @@ static mmu_attr_t elf_to_mmu_attr(Elf64_Word p_flags) {
 }
 
 
-// 如果返回 0，表示加载失败，pid->vm 可能残留一些 segment
+// 最多支持的 PT_LOAD 段数量
+#define ELF_SEG_MAX 16
+
+// 如果返回 0，表示加载失败，pid->vm 不会残留 segment
 size_t elf_load(proc_t *pid, const void *data, size_t len) {
     // 验证文件大小至少能容纳 ELF header
     if (len < sizeof(Elf64_Ehdr)) {
@@ -68,8 +71,12 @@ size_t elf_load(proc_t *pid, const void *data, size_t len) {
     }
 
     const char *file_base = (const char*)data;
+    const Elf64_Phdr *segs[ELF_SEG_MAX];
+    size_t seg_addrs[ELF_SEG_MAX];
+    size_t seg_sizes[ELF_SEG_MAX];
     int seg_count = 0;
 
+    // 先检查所有段，再一次性申请地址范围
     for (int i = 0; i < ehdr->e_phnum; i++) {
         const Elf64_Phdr *p = (const Elf64_Phdr*)(file_base + ehdr->e_phoff + i * ehdr->e_phentsize);
 
@@ -90,39 +97,45 @@ size_t elf_load(proc_t *pid, const void *data, size_t len) {
             return 0;
         }
 
-        // 映射段到目标虚拟地址，初始以可写权限映射（拷贝数据用）
-        // vmspace_alloc_at 内部会向上取整到页边界
-        vmrange_t *rng = proc_valloc(pid, (size_t)p->p_vaddr, (size_t)p->p_memsz, MMU_WRITE);
-        if (NULL == rng) {
-            logk("elf_load: failed to allocate segment at 0x%zx, size 0x%zx\n",
-                (size_t)p->p_vaddr, (size_t)p->p_memsz);
+        if (ELF_SEG_MAX == seg_count) {
+            logk("elf_load: more than %d segments\n", ELF_SEG_MAX);
             return 0;
         }
+        segs[seg_count] = p;
+        seg_addrs[seg_count] = (size_t)p->p_vaddr;
+        seg_sizes[seg_count] = (size_t)p->p_memsz;
+        seg_count++;
+    }
+
+    if (0 == seg_count) {
+        logk("elf_load: no PT_LOAD segments found\n");
+        return 0;
+    }
+
+    // 映射段到目标虚拟地址，初始以可写权限映射（拷贝数据用）
+    // vmspace_alloc_at 内部会向上取整到页边界
+    vmrange_t *rngs[ELF_SEG_MAX];
+    if (!proc_valloc_bulk(pid, seg_count, seg_addrs, seg_sizes, MMU_WRITE, rngs)) {
+        logk("elf_load: failed to allocate %d segments\n", seg_count);
+        return 0;
+    }
+
+    for (int i = 0; i < seg_count; i++) {
+        const Elf64_Phdr *p = segs[i];
+        vmrange_t *rng = rngs[i];
         rng->desc = "elf-load";
 
         // 从文件拷贝段数据
-        // 剩余部分清零（内存大小大于文件大小的部分）
+        // 进程的物理页分配时已经清零，内存大小大于文件大小的部分（bss）无需再清零
         char *vaddr = (char*)rng->vaddr;
         if (p->p_filesz > 0) {
             kmemcpy(vaddr, file_base + p->p_offset, (size_t)p->p_filesz);
         }
-        if (p->p_memsz > p->p_filesz) {
-            size_t bss_start = (size_t)p->p_filesz;
-            size_t bss_size = (size_t)(p->p_memsz - p->p_filesz);
-            kmemset(vaddr + bss_start, 0, bss_size);
-        }
 
         // 根据段标志设置最终页表属性
         // 对于非可写段，移除写权限
         mmu_attr_t final_attrs = elf_to_mmu_attr(p->p_flags);
         vmspace_remap(&pid->vm, rng, final_attrs);
-
-        seg_count++;
-    }
-
-    if (0 == seg_count) {
-        logk("elf_load: no PT_LOAD segments found\n");
-        return 0;
     }
 
     return (size_t)ehdr->e_entry;
@@ -30,12 +30,27 @@ static spinlock_t g_classes_lock = SPINLOCK_INIT;
 static DEFINE_DL_HEAD(g_all_classes);
 
 
-void kclass_register(kclass_t *cls, const char *name, size_t objsize, kobj_dtor_t dtor) {
+// 对象头部 objnode 在 kobj_make 时重新初始化，pool 的 freelist 正好落在这里
+// payload 不会被 freelist 覆盖，构造函数设置的状态可以跨越释放、分配保留
+static void kobj_construct(pool_t *pool, void *ptr) {
+    kclass_t *cls = containerof(pool, kclass_t, pool);
+    kobj_t *obj = (kobj_t*)ptr;
+    cls->ctor(&obj->payload);
+}
+
+// ctor 可以为 NULL，非空则对象释放时必须回到构造之后的状态（SLAB 构造语义）
+// dtor 在引用数归零时执行，负责释放对象持有的资源，并恢复构造状态
+void kclass_register(kclass_t *cls, const char *name, size_t objsize,
+        kobj_ctor_t ctor, kobj_dtor_t dtor) {
     cls->name = name;
+    cls->ctor = ctor;
     cls->dtor = dtor;
     cls->lock = SPINLOCK_INIT;
     dl_init_circular(&cls->head);
-    pool_init(&cls->pool, sizeof(kobj_t) + objsize);
+    pool_init(&cls->pool, name, sizeof(kobj_t) + objsize);
+    if (ctor) {
+        pool_set_ctor(&cls->pool, kobj_construct);
+    }
     {
         SPINLOCK_SCOPED(&g_classes_lock);
         dl_insert_before(&cls->clsnode, &g_all_classes);
@@ -61,21 +76,39 @@ void *kobj_make(kclass_t *cls, const char *name) {
         ASSERT(dl_contains(&g_all_classes, &cls->clsnode));
     }
 #endif
-    kobj_t *obj = NULL;
+    kobj_t *obj = (kobj_t*)pool_alloc(&cls->pool);
+    if (NULL == obj) {
+        logk("cannot allocate %s:%s\n", cls->name, name);
+        return NULL;
+    }
+    obj->name = name; // TODO 需要检查 name 是否与现有对象重复
+    obj->refcnt = 1;
     {
         SPINLOCK_SCOPED(&cls->lock);
-        obj = (kobj_t*)pool_alloc_nolock(&cls->pool);
-        if (NULL == obj) {
-            logk("cannot allocate %s:%s\n", cls->name, name);
-            return NULL;
-        }
-        obj->name = name; // TODO 需要检查 name 是否与现有对象重复
-        obj->refcnt = 1;
         dl_insert_before(&obj->objnode, &cls->head);
     }
     return &obj->payload;
 }
 
+// 批量创建 n 个对象，内存池和类的锁都只获取一次
+// 要么全部成功返回 n，要么全部失败返回 0
+int kobj_make_bulk(kclass_t *cls, int n, const char *names[], void *objs[]) {
+    if (!pool_alloc_bulk(&cls->pool, n, objs)) {
+        logk("cannot allocate %d %s\n", n, cls->name);
+        return 0;
+    }
+
+    SPINLOCK_SCOPED(&cls->lock);
+    for (int i = 0; i < n; ++i) {
+        kobj_t *obj = (kobj_t*)objs[i];
+        obj->name = names[i];
+        obj->refcnt = 1;
+        dl_insert_before(&obj->objnode, &cls->head);
+        objs[i] = &obj->payload;
+    }
+    return n;
+}
+
 // 可能搜索到一个引用数为零的对象，即将删除还残留在队列中的对象
 // 需要持有 class-lock 同时判断对象的 refcnt 大于零
 void *kobj_find(kclass_t *cls, const char *name) {
@@ -127,9 +160,11 @@ void kobj_drop(kclass_t *cls, void *ptr) {
 
 void kobj_free(kclass_t *cls, void *ptr) {
     kobj_t *obj = (kobj_t*)((char*)ptr - sizeof(kobj_t));
-    SPINLOCK_SCOPED(&cls->lock);
-    dl_remove(&obj->objnode);
-    pool_free_nolock(&cls->pool, obj);
+    {
+        SPINLOCK_SCOPED(&cls->lock);
+        dl_remove(&obj->objnode);
+    }
+    pool_free(&cls->pool, obj);
 }
 
 //------------------------------------------------------------------------------
@@ -144,9 +179,17 @@ static void show_objs(int argc, char *argv[]) {
         if ((argc > 1) && kstrcmp(cls->name, argv[1])) {
             continue;
         }
-        size_t waste = PAGE_SIZE % cls->pool.obj_size;
-        console_printf("%s(%u/%u->%zu):", cls->name,
-            cls->pool.raw_size, cls->pool.obj_size, waste);
+        // 利用率：对象本身的字节数占 slab 总字节数的比例，包括对齐和末尾浪费
+        pool_t *pool = &cls->pool;
+        uint32_t slabs;
+        size_t inuse;
+        size_t bytes;
+        pool_usage(pool, &slabs, &inuse, &bytes);
+        size_t per_slab = (PAGE_SIZE << pool->slab_order) / pool->obj_size;
+        size_t util = bytes ? (inuse * pool->raw_size * 100 / bytes) : 0;
+        console_printf("%s(%u/%u, %zu per %zuK slab, %u slabs, %zu used, %zu%%):", cls->name,
+            pool->raw_size, pool->obj_size, per_slab, (PAGE_SIZE << pool->slab_order) >> 10,
+            slabs, inuse, util);
         SPINLOCK_SCOPED(&cls->lock);
         for (dlnode_t *j = cls->head.next; j != &cls->head; j = j->next) {
             kobj_t *obj = containerof(j, kobj_t, objnode);
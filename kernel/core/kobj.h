@@ -5,6 +5,7 @@
 #include <pool_slub.h>
 #include <dllist.h>
 
+typedef void (*kobj_ctor_t)(void *obj);
 typedef void (*kobj_dtor_t)(void *obj);
 
 // 内核对象类，管理相同类型的对象
@@ -12,19 +13,22 @@ typedef void (*kobj_dtor_t)(void *obj);
 // 其实 kclass 也属于特殊的 kobj，但不是动态创建的
 typedef struct kclass {
     const char *name;
+    kobj_ctor_t ctor;    // 构造函数，每个对象只在 slab 创建时执行一次
     kobj_dtor_t dtor;    // 析构函数
     dlnode_t    clsnode; // guarded by g_classes_lock
     spinlock_t  lock;
     dlnode_t    head;   // guarded by lock
-    pool_t      pool;   // guarded by lock
+    pool_t      pool;   // 自带锁
 } kclass_t;
 
-void kclass_register(kclass_t *cls, const char *name, size_t objsize, kobj_dtor_t dtor);
+void kclass_register(kclass_t *cls, const char *name, size_t objsize,
+        kobj_ctor_t ctor, kobj_dtor_t dtor);
 
 const char *kobj_name(const void *ptr);
 int kobj_nref(const void *ptr);
 
 void *kobj_make(kclass_t *cls, const char *name);
+int   kobj_make_bulk(kclass_t *cls, int n, const char *names[], void *objs[]);
 void *kobj_find(kclass_t *cls, const char *name);
 void *kobj_keep(void *obj);                 // 引用数 +1
 void  kobj_drop(kclass_t *cls, void *obj);  // 引用数 -1，可能执行析构函数
@@ -0,0 +1,102 @@
+#include "kreclaim.h"
+#include <task.h>
+#include <sema.h>
+#include <shrinker.h>
+#include <page.h>
+#include <debug.h>
+
+#include <kshell.h>
+#include <console.h>
+
+
+// 后台内存回收任务
+// 空闲页低于 low 水位线时被唤醒，调用所有 shrinker 释放缓存，仍然紧张则整理碎片
+// 文件系统目前没有可以丢弃的干净缓存（FAT 表、打开文件的簇缓存都在使用中），没有注册 shrinker
+
+static sema_t *g_reclaim_sema = NULL;
+static _Atomic int g_reclaim_pending = 0;
+
+// 统计信息
+static _Atomic size_t g_reclaim_wakeups = 0;
+static _Atomic size_t g_reclaim_direct = 0;
+static _Atomic size_t g_reclaim_pages = 0;
+static _Atomic size_t g_reclaim_compacts = 0;
+
+
+// 释放各类缓存，返回释放的页数
+static uint32_t reclaim_caches() {
+    uint32_t num = shrink_all();
+    atomic_fetch_add(&g_reclaim_pages, num);
+    return num;
+}
+
+// 可能在 ISR 中调用，也可能持有其他锁，只能释放信号量，不能阻塞
+// 已经唤醒过、回收任务尚未开始执行，就不必重复释放
+void kreclaim_wakeup() {
+    if (NULL == g_reclaim_sema) {
+        return; // 回收任务尚未创建
+    }
+    if (atomic_exchange(&g_reclaim_pending, 1)) {
+        return;
+    }
+    sema_give(g_reclaim_sema);
+}
+
+// 分配者同步回收，只释放缓存，耗时较长的规整留给后台任务
+uint32_t kreclaim_direct() {
+    atomic_fetch_add(&g_reclaim_direct, 1);
+    return reclaim_caches();
+}
+
+static void kreclaim_proc() {
+    while (1) {
+        sema_take(g_reclaim_sema, FOREVER);
+        atomic_store(&g_reclaim_pending, 0);
+        atomic_fetch_add(&g_reclaim_wakeups, 1);
+
+        reclaim_caches();
+
+        // 释放缓存之后依然低于 high，而且已经没有大块，整理碎片
+        // 保证 FAT 缓存、消息队列、大页映射这类高阶分配还能成功
+        uint32_t rank = LARGE_PAGE_SHIFT - PAGE_SHIFT;
+        if ((page_free_count() < page_watermark(WMARK_HIGH))
+        &&  !page_has_free_block(rank)
+        &&  page_compact(rank)) {
+            atomic_fetch_add(&g_reclaim_compacts, 1);
+        }
+    }
+}
+
+INIT_TEXT void kreclaim_start() {
+    sema_t *sema = sema_make("reclaim", 0, 1);
+    if (NULL == sema) {
+        logk("error: cannot create reclaim semaphore\n");
+        return;
+    }
+
+    task_t *tid = task_make("reclaim", 20, kreclaim_proc, NULL);
+    if (NULL == tid) {
+        logk("error: cannot create reclaim task\n");
+        sema_drop(sema);
+        return;
+    }
+
+    g_reclaim_sema = sema;
+    task_start_now(tid);
+}
+
+//------------------------------------------------------------------------------
+
+#ifndef UNIT_TEST
+
+static void show_reclaim() {
+    console_printf("free %u, watermarks min=%u low=%u high=%u\n",
+        page_free_count(), page_watermark(WMARK_MIN),
+        page_watermark(WMARK_LOW), page_watermark(WMARK_HIGH));
+    console_printf("wakeups %zu, direct %zu, reclaimed %zu pages, compacted %zu\n",
+        g_reclaim_wakeups, g_reclaim_direct, g_reclaim_pages, g_reclaim_compacts);
+}
+
+KSHELL_CMD("reclaim", show_reclaim);
+
+#endif // UNIT_TEST
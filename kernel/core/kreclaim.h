@@ -0,0 +1,11 @@
+#ifndef KRECLAIM_H
+#define KRECLAIM_H
+
+#include <wheel.h>
+
+// 后台内存回收任务，由页分配器根据水位线触发
+void     kreclaim_wakeup();
+uint32_t kreclaim_direct();
+INIT_TEXT void kreclaim_start();
+
+#endif // KRECLAIM_H
@@ -26,7 +26,7 @@ static void msgq_cleanup(void *obj) {
 }
 
 INIT_TEXT void msgq_init(void) {
-    kclass_register(&g_msgq_class, "msgq", sizeof(msgq_t), msgq_cleanup);
+    kclass_register(&g_msgq_class, "msgq", sizeof(msgq_t), NULL, msgq_cleanup);
 }
 
 msgq_t *msgq_make(const char *name) {
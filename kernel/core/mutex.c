@@ -16,8 +16,16 @@ typedef struct mutex {
 } mutex_t;
 
 
+// 释放时锁未被持有、阻塞队列为空，这两个字段只需初始化一次
+static void mutex_construct(void *obj) {
+    mutex_t *mut = (mutex_t*)obj;
+    mut->lock = SPINLOCK_INIT;
+    prioq_init(&mut->wq);
+    mut->owner = NULL;
+}
+
 INIT_TEXT void mutex_init(void) {
-    kclass_register(&g_mutex_class, "mutex", sizeof(mutex_t), NULL);
+    kclass_register(&g_mutex_class, "mutex", sizeof(mutex_t), mutex_construct, NULL);
 }
 
 mutex_t *mutex_make(const char *name) {
@@ -25,9 +33,8 @@ mutex_t *mutex_make(const char *name) {
     if (NULL == mut) {
         return NULL;
     }
-    mut->lock = SPINLOCK_INIT;
-    prioq_init(&mut->wq);
-    mut->owner = NULL;
+    ASSERT(0 == mut->wq.priorities);
+    mut->owner = NULL; // 可能在持有时被释放
     return mut;
 }
 
@@ -1,6 +1,7 @@
 #include "proc.h"
 #include <kobj.h>
 #include <task.h>
+#include <kstring.h>
 #include <debug.h>
 
 
@@ -11,41 +12,154 @@ static kclass_t g_pcb_class;
 
 // 动态分配的地址空间
 // 也可以做成 kobj，但不需要引用计数，因为属于 PCB
-static spinlock_t g_rng_lock = SPINLOCK_INIT;
 static pool_t     g_rng_pool;
 
 
 
 // 如果 va==0，说明不限制虚拟地址
-vmrange_t *proc_valloc(proc_t *pid, size_t addr, size_t size, mmu_attr_t attrs) {
-    vmrange_t *rng;
+static void *proc_vmap(proc_t *pid, vmrange_t *rng, size_t addr, size_t size, mmu_attr_t attrs) {
     size += PAGE_SIZE - 1;
     size &= ~(PAGE_SIZE - 1);
 
-    {
-        SPINLOCK_SCOPED(&g_rng_lock);
-        rng = pool_alloc_nolock(&g_rng_pool);
-        if (NULL == rng) {
-            return NULL;
-        }
+    if (addr) {
+        return vmspace_alloc_at(&pid->vm, rng, addr, size, PT_PROC, attrs);
+    }
+    return vmspace_alloc(&pid->vm, rng, size, PT_PROC, attrs);
+}
+
+vmrange_t *proc_valloc(proc_t *pid, size_t addr, size_t size, mmu_attr_t attrs) {
+    vmrange_t *rng = pool_alloc(&g_rng_pool);
+    if (NULL == rng) {
+        return NULL;
     }
 
-    void *va = NULL;
+    if (NULL == proc_vmap(pid, rng, addr, size, attrs)) {
+        pool_free(&g_rng_pool, rng);
+        return NULL;
+    }
+
+    return rng;
+}
+
+// 按需分配物理页，适合栈、堆这类只用到一部分的范围
+// 缺页次数记录在 pid->vm.faults
+vmrange_t *proc_valloc_lazy(proc_t *pid, size_t addr, size_t size, mmu_attr_t attrs) {
+    vmrange_t *rng = pool_alloc(&g_rng_pool);
+    if (NULL == rng) {
+        return NULL;
+    }
+
+    void *va;
     if (addr) {
-        va = vmspace_alloc_at(&pid->vm, rng, addr, size, PT_PROC, attrs);
+        va = vmspace_alloc_lazy_at(&pid->vm, rng, addr, size, PT_PROC, attrs);
     } else {
-        va = vmspace_alloc(&pid->vm, rng, size, PT_PROC, attrs);
+        va = vmspace_alloc_lazy(&pid->vm, rng, size, PT_PROC, attrs);
     }
     if (NULL == va) {
-        SPINLOCK_SCOPED(&g_rng_lock);
-        pool_free_nolock(&g_rng_pool, rng);
+        pool_free(&g_rng_pool, rng);
         return NULL;
     }
 
     return rng;
 }
 
+// 一次申请多个范围，vmrange 描述符批量分配
+// 要么全部成功返回 n，要么全部失败返回 0
+int proc_valloc_bulk(proc_t *pid, int n, const size_t addrs[], const size_t sizes[],
+        mmu_attr_t attrs, vmrange_t *rngs[]) {
+    if (!pool_alloc_bulk(&g_rng_pool, n, (void**)rngs)) {
+        return 0;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (NULL != proc_vmap(pid, rngs[i], addrs[i], sizes[i], attrs)) {
+            continue;
+        }
+        while (i > 0) {
+            vmspace_remove(&pid->vm, rngs[--i]);
+        }
+        pool_free_bulk(&g_rng_pool, n, (void**)rngs);
+        return 0;
+    }
+
+    return n;
+}
+
+// 范围已经从地址空间删除，物理页在 pages 里
+// 进程的其他线程可能在别的 CPU 上运行，shootdown 之后才能释放物理页
+// 需要在任务上下文调用，开中断
+static void proc_vrelease(vmrange_t *rng, size_t va, size_t vend, pglist_t *pages) {
+    tlb_shootdown(va, vend);
+    pagelist_free(pages);
+    pool_free(&g_rng_pool, rng);
+}
+
+// 删除一段范围，释放描述符
+void proc_vfree(proc_t *pid, vmrange_t *rng) {
+    size_t va = rng->vaddr;
+    size_t vend = rng->vend;
+    pglist_t pages = { 0, 0 };
+    vmspace_detach(&pid->vm, rng, &pages);
+    proc_vrelease(rng, va, vend, &pages);
+}
+
+// 删除从 addr 开始、大小为 size、描述为 desc 的范围，查找和删除在同一个临界区
+// 成功返回 0，没有这样的范围返回 -1
+int proc_vunmap(proc_t *pid, size_t addr, size_t size, const char *desc) {
+    pglist_t pages = { 0, 0 };
+    vmrange_t *rng = vmspace_detach_at(&pid->vm, addr, size, desc, &pages);
+    if (NULL == rng) {
+        return -1;
+    }
+    proc_vrelease(rng, rng->vaddr, rng->vend, &pages);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// 文件表
+//------------------------------------------------------------------------------
 
+// 返回文件描述符，文件表已满返回 -1
+int proc_file_open(proc_t *pid, const char *data, size_t len) {
+    ASSERT(NULL != data);
+
+    SPINLOCK_SCOPED(&pid->lock);
+    for (int i = 3; i < PROC_FILE_NUM; ++i) {
+        if (NULL == pid->files[i].data) {
+            pid->files[i].data = data;
+            pid->files[i].len = len;
+            return i;
+        }
+    }
+    return -1;
+}
+
+int proc_file_close(proc_t *pid, int fd) {
+    if ((fd < 3) || (fd >= PROC_FILE_NUM)) {
+        return -1;
+    }
+
+    SPINLOCK_SCOPED(&pid->lock);
+    if (NULL == pid->files[fd].data) {
+        return -1;
+    }
+    pid->files[fd].data = NULL;
+    pid->files[fd].len = 0;
+    return 0;
+}
+
+// 复制一份文件表项，文件没有打开返回 0
+int proc_file_get(proc_t *pid, int fd, proc_file_t *file) {
+    if ((fd < 3) || (fd >= PROC_FILE_NUM)) {
+        return 0;
+    }
+
+    SPINLOCK_SCOPED(&pid->lock);
+    *file = pid->files[fd];
+    return NULL != file->data;
+}
+
+//------------------------------------------------------------------------------
 
 
 // 属于这个进程的所有vmrange都是动态分配的，需要遍历将其删除
@@ -54,15 +168,15 @@ static void proc_cleanup(void *ptr) {
     proc_t *pid = (proc_t *)ptr;
     logk("destroying process %s-%d\n", kobj_name(ptr), pid->id);
 
-    {
-        SPINLOCK_SCOPED(&g_rng_lock);
-        dlnode_t *dl = pid->vm.head.next;
-        while (dl != &pid->vm.head) {
-            vmrange_t *rng = containerof(dl, vmrange_t, dl);
-            dl = dl->next;
-            vmspace_remove(&pid->vm, rng);
-            pool_free_nolock(&g_rng_pool, rng);
-        }
+    // 不再参与页迁移，必须在持有自旋锁之前，等待迁移时需要响应 IPI
+    vmspace_unregister(&pid->vm);
+
+    dlnode_t *dl = pid->vm.head.next;
+    while (dl != &pid->vm.head) {
+        vmrange_t *rng = containerof(dl, vmrange_t, dl);
+        dl = dl->next;
+        vmspace_remove(&pid->vm, rng);
+        pool_free(&g_rng_pool, rng);
     }
 
     // 删除地址空间
@@ -72,8 +186,8 @@ static void proc_cleanup(void *ptr) {
 
 
 INIT_TEXT void process_init() {
-    kclass_register(&g_pcb_class, "PCB", sizeof(proc_t), proc_cleanup);
-    pool_init(&g_rng_pool, sizeof(vmrange_t));
+    kclass_register(&g_pcb_class, "PCB", sizeof(proc_t), NULL, proc_cleanup);
+    pool_init(&g_rng_pool, "vmrange", sizeof(vmrange_t));
 }
 
 static _Atomic int g_next_id = 0;
@@ -87,14 +201,48 @@ proc_t *proc_make(const char *name) {
     pid->lock = SPINLOCK_INIT;
     pid->ustack = NULL;
     pid->id = atomic_fetch_add(&g_next_id, 1);
+    kmemset(pid->files, 0, sizeof(pid->files));
 
     vmspace_init(&pid->vm, 0x100000, 1UL << 32);
     pid->vm.table = mmu_create();
     mmu_copykernel(pid->vm.table, g_kernel_vm.table);
+    vmspace_register(&pid->vm);
 
     return pid;
 }
 
+static vmrange_t *proc_rng_alloc() {
+    return pool_alloc(&g_rng_pool);
+}
+
+// 复制进程的地址空间，物理页写时复制共享，新进程还没有线程
+// 父进程加载好的代码、数据不必重新加载，只有写入的页才会复制，文件表也一并复制
+proc_t *proc_fork(proc_t *parent, const char *name) {
+    proc_t *pid = proc_make(name);
+    if (NULL == pid) {
+        return NULL;
+    }
+
+    int ok = vmspace_fork(&pid->vm, &parent->vm, proc_rng_alloc);
+
+    // 父进程可写的页改为只读，其他 CPU 上运行的线程可能还缓存着可写的映射
+    tlb_shootdown(parent->vm.dyn_start, parent->vm.dyn_end);
+    if (!ok) {
+        proc_drop(pid);
+        return NULL;
+    }
+
+    pid->entry = parent->entry;
+    {
+        SPINLOCK_SCOPED(&parent->lock);
+        kmemcpy(pid->files, parent->files, sizeof(pid->files));
+    }
+    if (parent->ustack) {
+        pid->ustack = vmspace_lookup(&pid->vm, parent->ustack->vaddr);
+    }
+    return pid;
+}
+
 void proc_drop(proc_t *pid) {
     kobj_drop(&g_pcb_class, pid);
 }
@@ -5,6 +5,15 @@
 #include <dllist.h>
 #include <vmspace.h>
 
+// 进程打开的文件，目前只有内嵌 tar 中的只读文件，内容常驻内存
+typedef struct proc_file {
+    const char *data;   // NULL 表示空闲
+    size_t      len;
+} proc_file_t;
+
+// 0~2 是控制台，不占用文件表
+#define PROC_FILE_NUM 16
+
 typedef struct proc {
     spinlock_t  lock;
 
@@ -14,14 +23,25 @@ typedef struct proc {
     int         id;
     size_t      entry;
 
+    proc_file_t files[PROC_FILE_NUM];   // 受 lock 保护
 } proc_t;
 
 
 INIT_TEXT void process_init();
 proc_t *proc_make(const char *name);
+proc_t *proc_fork(proc_t *parent, const char *name);
 void proc_drop(proc_t *pid);
 
 vmrange_t *proc_valloc(proc_t *pid, size_t va, size_t size, mmu_attr_t attrs);
+vmrange_t *proc_valloc_lazy(proc_t *pid, size_t va, size_t size, mmu_attr_t attrs);
+int proc_valloc_bulk(proc_t *pid, int n, const size_t addrs[], const size_t sizes[],
+        mmu_attr_t attrs, vmrange_t *rngs[]);
+void proc_vfree(proc_t *pid, vmrange_t *rng);
+int proc_vunmap(proc_t *pid, size_t addr, size_t size, const char *desc);
+
+int proc_file_open(proc_t *pid, const char *data, size_t len);
+int proc_file_close(proc_t *pid, int fd);
+int proc_file_get(proc_t *pid, int fd, proc_file_t *file);
 
 void task_enter_process(proc_t *pid);
 void task_leave_process();
@@ -16,8 +16,15 @@ typedef struct sema {
 } sema_t;
 
 
+// 释放时锁未被持有、阻塞队列为空，这两个字段只需初始化一次
+static void sema_construct(void *obj) {
+    sema_t *sema = (sema_t*)obj;
+    sema->lock = SPINLOCK_INIT;
+    prioq_init(&sema->wq);
+}
+
 INIT_TEXT void sema_init(void) {
-    kclass_register(&g_sema_class, "sema", sizeof(sema_t), NULL);
+    kclass_register(&g_sema_class, "sema", sizeof(sema_t), sema_construct, NULL);
 }
 
 sema_t *sema_make(const char *name, int initial, int limit) {
@@ -25,8 +32,7 @@ sema_t *sema_make(const char *name, int initial, int limit) {
     if (NULL == sema) {
         return NULL;
     }
-    sema->lock = SPINLOCK_INIT;
-    prioq_init(&sema->wq);
+    ASSERT(0 == sema->wq.priorities);
     sema->value = initial;
     sema->limit = limit;
     return sema;
@@ -3,6 +3,7 @@
 #include <task.h>
 #include <proc.h>
 
+#include <tar.h>
 #include <kstring.h>
 #include <debug.h>
 #include <console.h>
@@ -28,6 +29,59 @@ static int64_t do_sys_write(int fd, const char *buf, size_t len) {
     return 0;
 }
 
+// 用户指针必须位于进程中用户可以访问的范围，返回从 ptr 到范围末尾的字节数，非法返回 0
+// 范围可能是按需分配的，读取尚未映射的页由缺页处理分配
+static size_t user_bytes(proc_t *pid, const void *ptr) {
+    vmrange_t *rng = vmspace_lookup(&pid->vm, (size_t)ptr);
+    if ((NULL == rng) || !(rng->attrs & MMU_USER)) {
+        return 0;
+    }
+    return rng->vend - (size_t)ptr;
+}
+
+// 内嵌的用户程序 tar，目前唯一可以打开的文件来源
+extern char _binary_users_tar_start;
+extern char _binary_users_tar_end;
+
+static int64_t do_sys_open(const char *path, int flags) {
+    (void)flags; // 文件都是只读的
+    task_t *self = current_task();
+    if (NULL == self->process) {
+        return -1;
+    }
+
+    // 只读取范围之内的部分，没有遇到终止符就当作文件名到此为止
+    char name[100]; // tar 文件名最长 100 字节
+    size_t max = user_bytes(self->process, path);
+    if (0 == max) {
+        return -1;
+    }
+    if (max > sizeof(name) - 1) {
+        max = sizeof(name) - 1;
+    }
+    size_t n = 0;
+    for (; (n < max) && path[n]; ++n) {
+        name[n] = path[n];
+    }
+    name[n] = '\0';
+
+    size_t len;
+    size_t tar_size = (size_t)(&_binary_users_tar_end - &_binary_users_tar_start);
+    const char *data = tar_find(&_binary_users_tar_start, tar_size, name, &len);
+    if (NULL == data) {
+        return -1;
+    }
+    return proc_file_open(self->process, data, len);
+}
+
+static int64_t do_sys_close(int fd) {
+    task_t *self = current_task();
+    if (NULL == self->process) {
+        return -1;
+    }
+    return proc_file_close(self->process, fd);
+}
+
 static int64_t do_sys_getpid() {
     task_t *self = current_task();
     return (self->process) ? ((proc_t*)self->process)->id : 0;
@@ -38,6 +92,84 @@ static int64_t do_sys_yield() {
     return 0;
 }
 
+// mmap 建立的范围都使用这个描述，munmap 只能删除这种范围
+static const char g_mmap_desc[] = "mmap";
+
+// 匿名映射只划分虚拟地址，访问时才分配物理页，适合一次申请大块内存
+// 文件映射是只读的，映射时把文件内容拷贝到新分配的页，之后读取不需要系统调用
+// 页内超出文件末尾的部分为零
+static size_t do_sys_mmap(size_t addr, size_t len, int prot, int flags, int fd, size_t off) {
+    task_t *self = current_task();
+    proc_t *pid = self->process;
+    if ((NULL == pid) || (0 == len) || (addr & (PAGE_SIZE - 1))) {
+        return (size_t)MAP_FAILED;
+    }
+    if (len > (size_t)-PAGE_SIZE) {
+        return (size_t)MAP_FAILED; // 向上取整会回绕
+    }
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    // 固定地址的范围由 vmspace 检查是否位于进程的动态分配范围之内
+    if (!(flags & MAP_FIXED)) {
+        addr = 0;
+    } else if (0 == addr) {
+        return (size_t)MAP_FAILED;
+    }
+
+    mmu_attr_t attrs = MMU_USER;
+    if (prot & PROT_WRITE) {
+        attrs |= MMU_WRITE;
+    }
+    if (prot & PROT_EXEC) {
+        attrs |= MMU_EXEC;
+    }
+
+    vmrange_t *rng;
+    if (flags & MAP_ANONYMOUS) {
+        rng = proc_valloc_lazy(pid, addr, len, attrs);
+        if (NULL == rng) {
+            return (size_t)MAP_FAILED;
+        }
+        rng->desc = g_mmap_desc;
+        return rng->vaddr;
+    }
+
+    proc_file_t file;
+    if ((prot & PROT_WRITE) || !proc_file_get(pid, fd, &file) || (off >= file.len)) {
+        return (size_t)MAP_FAILED;
+    }
+
+    // 文件映射立即分配物理页，长度不能超出文件剩余部分，防止用户指定任意大小耗尽内存
+    size_t size = file.len - off;
+    if (len > ((size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))) {
+        return (size_t)MAP_FAILED;
+    }
+
+    // 和加载 ELF 一样，先以可写权限映射，拷贝完成再改为最终权限
+    rng = proc_valloc(pid, addr, len, MMU_WRITE);
+    if (NULL == rng) {
+        return (size_t)MAP_FAILED;
+    }
+    rng->desc = g_mmap_desc;
+
+    if (size > len) {
+        size = len;
+    }
+    kmemcpy((void*)rng->vaddr, file.data + off, size);
+    vmspace_remap(&pid->vm, rng, attrs);
+    return rng->vaddr;
+}
+
+// 只能整体删除 mmap 建立的范围，不支持拆分
+static int64_t do_sys_munmap(size_t addr, size_t len) {
+    task_t *self = current_task();
+    proc_t *pid = self->process;
+    if (NULL == pid) {
+        return -1;
+    }
+    return proc_vunmap(pid, addr, len, g_mmap_desc);
+}
+
 // NULL 表项 fallback
 void do_sys_unknown() {
     logk("unknown syscall\n");
@@ -50,6 +182,10 @@ CONST void *syscall_tbl[256] = {
     [SYS_exit]   = do_sys_exit,
     [SYS_write]  = do_sys_write,
     [SYS_read]   = do_sys_read,
+    [SYS_open]   = do_sys_open,
+    [SYS_close]  = do_sys_close,
     [SYS_getpid] = do_sys_getpid,
     [SYS_yield]  = do_sys_yield,
+    [SYS_mmap]   = do_sys_mmap,
+    [SYS_munmap] = do_sys_munmap,
 };
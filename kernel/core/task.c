@@ -13,6 +13,7 @@
 #include <kstring.h>
 #include <heap.h>
 #include <pool_slub.h>
+#include <kstack.h>
 #include <debug.h>
 #include <kshell.h>
 #include <console.h>
@@ -107,13 +108,14 @@ inline task_t *current_task() {
 // 任务调度
 //------------------------------------------------------------------------------
 
+static void task_construct(void *obj);
 static void task_cleanup(void *obj);
 
 // 初始化调度器
 INIT_TEXT void sched_init() {
     int cpu = cpu_index();
     if (0 == cpu) {
-        kclass_register(&g_tcb_class, "TCB", sizeof(task_t), task_cleanup);
+        kclass_register(&g_tcb_class, "TCB", sizeof(task_t), task_construct, task_cleanup);
     }
 
     prioq_t *q = THISCPU(&g_rdyq);
@@ -150,13 +152,10 @@ void sched_process() {
 // 创建任务，处于 STOPPED 状态，需要使用 task_start 启动
 //------------------------------------------------------------------------------
 
-task_t *task_make(const char *name, int prio, void *func, void *arg) {
-    task_t *tid = (task_t*)kobj_make(&g_tcb_class, name);
-
-    atomic_store(&tid->state, TS_STOPPED);
-    tid->priority = prio;
-    tid->affinity = -1;
-    kmemcpy(&tid->fp_state, &g_fp_init_state, sizeof(arch_fp_t));
+// 构造函数，只在 slab 创建时执行
+// 任务退出时 wdog 已经停止、join_q 已经清空，这些字段回收之后仍然有效
+static void task_construct(void *obj) {
+    task_t *tid = (task_t*)obj;
 
     // 阻塞相关字段初始化（timer.state 必须 WDOG_IDLE，否则 wdog_start 会断言失败）
     atomic_store(&tid->timer.state, WDOG_IDLE);
@@ -169,12 +168,26 @@ task_t *task_make(const char *name, int prio, void *func, void *arg) {
 
     tid->join_lock = SPINLOCK_INIT;
     prioq_init(&tid->join_q);
+}
+
+task_t *task_make(const char *name, int prio, void *func, void *arg) {
+    task_t *tid = (task_t*)kobj_make(&g_tcb_class, name);
+    ASSERT(WDOG_IDLE == tid->timer.state);
+    ASSERT(0 == tid->join_q.priorities);
+
+    // 浮点状态在运行时被修改，每次都要重新复制
+    atomic_store(&tid->state, TS_STOPPED);
+    tid->priority = prio;
+    tid->affinity = -1;
+    kmemcpy(&tid->fp_state, &g_fp_init_state, sizeof(arch_fp_t));
 
     // 分配内核栈空间
     tid->pgtbl   = g_kernel_vm.table; // 默认使用内核页表，之后可以替换
     tid->process = NULL; // 不属于任何进程，之后可以替换
-    vmspace_alloc_kstack(&g_kernel_vm, &tid->stack);
+    kstack_alloc(&tid->stack);
     tid->stack.desc = name;
+    tid->stack_kept = 0;
+    tid->cow.old = 0;
 
     tid->stack0 = tid->stack.vend; // 记录下内核栈
     tid->stack3  = 0; // 没有用户栈（尚未分配）
@@ -189,7 +202,7 @@ task_t *task_make(const char *name, int prio, void *func, void *arg) {
 static void task_cleanup(void *obj) {
     task_t *tid = (task_t*)obj;
     logk("cleanup task-%s %p\n", kobj_name(obj), obj);
-    vmspace_remove(&g_kernel_vm, &tid->stack);
+    kstack_free(&tid->stack, tid->stack_kept);
     atomic_store(&tid->state, TS_DELETED);
 }
 
@@ -424,7 +437,11 @@ void task_exit() {
     // shootdown 不能在 ISR 里面执行，所以在这里调用
     // 但是任务栈还在使用（当前代码），还不能回收
     // 只剩当前 cpu 还保留 mapping，留到 work 里面删除
-    tlb_shootdown(tid->stack.vaddr, tid->stack.vend);
+    // 如果栈可以放进缓存，映射一直保留，不需要 shootdown
+    tid->stack_kept = kstack_reserve();
+    if (!tid->stack_kept) {
+        tlb_shootdown(tid->stack.vaddr, tid->stack.vend);
+    }
 
     // 任务状态变为 STOPPED，此时可以唤醒等待这个任务结束的线程
     // 将所有正在执行 task_join 的线程唤醒
@@ -509,8 +526,12 @@ void task_drop(task_t *tid) {
 //     }
 // }
 
+// 空闲时预先清零物理页，清零池已满才进入休眠
 static NORETURN void proc_idle() {
     while (1) {
+        if (page_zero_fill()) {
+            continue;
+        }
         cpu_pause();
         cpu_halt();
     }
@@ -51,6 +51,8 @@ typedef struct task {
     // 所属进程的资源
     proc_t     *process;    // parent process (NULL if kernel thread)
     vmrange_t   stack;      // kernel stack
+    int         stack_kept; // 退出时预留了缓存位置，析构时栈放入缓存
+    vm_cow_t    cow;        // 写时复制换下的旧块，返回任务之前完成 shootdown（old 非零表示尚未完成）
 
     // 等待线程退出的阻塞队列
     spinlock_t  join_lock;
@@ -0,0 +1,105 @@
+// 性能测试的入口，运行所有用 KBENCH 注册的测试
+//
+// 用法：kbench [-t threads] [-n ops] [-p pages] [name...]
+// 不指定名称则运行全部
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+
+#include "kbench.h"
+
+
+struct BenchEntry {
+    const char *name;
+    BenchFunc   func;
+};
+
+// 注册发生在静态初始化阶段，顺序不确定，用函数内的静态变量保证先构造
+static std::vector<BenchEntry> &bench_registry() {
+    static std::vector<BenchEntry> registry;
+    return registry;
+}
+
+BenchCase::BenchCase(const char *name, BenchFunc func) {
+    bench_registry().push_back({ name, func });
+}
+
+uint32_t bench_percentile(std::vector<uint32_t> &v, int pct) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t idx = (v.size() - 1) * (size_t)pct / 100;
+    std::nth_element(v.begin(), v.begin() + (long)idx, v.end());
+    return v[idx];
+}
+
+void bench_report(const char *bench, const char *name, const char *op, std::vector<uint32_t> &v) {
+    if (v.empty()) {
+        return;
+    }
+    uint32_t p50 = bench_percentile(v, 50);
+    uint32_t p99 = bench_percentile(v, 99);
+    uint32_t max = *std::max_element(v.begin(), v.end());
+    printf("{\"bench\":\"%s\",\"case\":\"%s\",\"op\":\"%s\",\"calls\":%zu,"
+        "\"p50_ns\":%u,\"p99_ns\":%u,\"max_ns\":%u}\n",
+        bench, name, op, v.size(), p50, p99, max);
+}
+
+static bool selected(const char *name, int argc, char *argv[]) {
+    if (optind >= argc) {
+        return true;
+    }
+    for (int i = optind; i < argc; ++i) {
+        if (0 == strcmp(name, argv[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions opt;
+    opt.threads = (int)std::thread::hardware_concurrency();
+    opt.ops = 100000;
+    opt.pages = 0x40000; // 1G
+
+    int c;
+    while (-1 != (c = getopt(argc, argv, "t:n:p:"))) {
+        switch (c) {
+        case 't': opt.threads = atoi(optarg); break;
+        case 'n': opt.ops = strtoul(optarg, NULL, 0); break;
+        case 'p': opt.pages = (uint32_t)strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-t threads] [-n ops] [-p pages] [name...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (opt.threads < 1) {
+        opt.threads = 1;
+    }
+
+    // 内核自旋锁假定持有者不会被抢占，线程数超过 CPU 数量，等锁的线程会空转整个时间片
+    int ncpu = (int)std::thread::hardware_concurrency();
+    if ((ncpu > 0) && (opt.threads > ncpu)) {
+        fprintf(stderr, "warning: %d threads on %d cpus, clamped\n", opt.threads, ncpu);
+        opt.threads = ncpu;
+    }
+
+    // 按名称排序，输出顺序不受链接顺序影响
+    std::vector<BenchEntry> &all = bench_registry();
+    std::sort(all.begin(), all.end(), [](const BenchEntry &a, const BenchEntry &b) {
+        return strcmp(a.name, b.name) < 0;
+    });
+
+    size_t errors = 0;
+    for (const BenchEntry &e : all) {
+        if (selected(e.name, argc, argv)) {
+            errors += e.func(opt);
+        }
+    }
+    return errors ? 1 : 0;
+}
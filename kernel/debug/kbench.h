@@ -0,0 +1,43 @@
+#ifndef KBENCH_H
+#define KBENCH_H
+
+// 性能测试框架，每个 *.bench.cc 用 KBENCH 注册若干测试，由 kbench 依次运行
+// 结果每行一个 JSON 对象，便于脚本比较不同版本，耗时只报告、不判断快慢
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct BenchOptions {
+    int      threads;   // 多线程测试使用的线程数
+    size_t   ops;       // 每个线程的操作次数
+    uint32_t pages;     // 页分配器管理的物理页数量
+};
+
+// 返回一致性错误的数量，非零则 kbench 以失败退出
+typedef size_t (*BenchFunc)(const BenchOptions &opt);
+
+struct BenchCase {
+    BenchCase(const char *name, BenchFunc func);
+};
+
+#define KBENCH(name) \
+    static size_t kbench_##name(const BenchOptions &opt); \
+    static BenchCase kbench_case_##name(#name, kbench_##name); \
+    static size_t kbench_##name(const BenchOptions &opt)
+
+using BenchClock = std::chrono::steady_clock;
+
+// 从 t0 到现在经过的纳秒数
+static inline uint32_t bench_elapsed(BenchClock::time_point t0) {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - t0).count();
+}
+
+// 会重排 v 的元素，v 为空返回 0
+uint32_t bench_percentile(std::vector<uint32_t> &v, int pct);
+
+// 输出一组延迟样本的分布，bench、name 标识测试项，op 是被测的操作
+void bench_report(const char *bench, const char *name, const char *op, std::vector<uint32_t> &v);
+
+#endif // KBENCH_H
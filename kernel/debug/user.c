@@ -32,7 +32,8 @@ void user_task(proc_t *pid) {
 }
 
 
-static task_t *launch_user_task(const char *name, const char *data, size_t len) {
+// 创建进程，加载 ELF，分配用户栈，还没有线程
+static proc_t *load_user_proc(const char *name, const char *data, size_t len) {
     // name = kernel_heap_mkstr("p-%s", name);
     proc_t *pid = proc_make(kernel_heap_mkstr("p-%s", name));
     if (NULL == pid) {
@@ -57,8 +58,8 @@ static task_t *launch_user_task(const char *name, const char *data, size_t len)
     logk("ELF loaded, entry point: 0x%zx\n", entry);
     pid->entry = entry;
 
-    // 分配用户栈，可以分配多个栈
-    pid->ustack = proc_valloc(pid, 0, PAGE_SIZE, MMU_WRITE|MMU_USER);
+    // 分配用户栈，可以分配多个栈，用到的页才分配物理内存
+    pid->ustack = proc_valloc_lazy(pid, 0, USTACK_SIZE, MMU_WRITE|MMU_USER);
     if (NULL == pid->ustack) {
         logk("error: failed to allocate user stack\n");
         task_leave_process();
@@ -67,15 +68,26 @@ static task_t *launch_user_task(const char *name, const char *data, size_t len)
     }
     pid->ustack->desc = "user stack";
     task_leave_process(); // refcnt=1
+    return pid;
+}
 
-    // 创建一个新线程，入口为 entry，使用 pid
+// 创建一个新线程，入口为 entry，使用 pid，进程的引用转交给线程
+static task_t *start_user_proc(const char *name, proc_t *pid) {
     logk("starting user program\n");
-    task_t *tuser = task_make(kernel_heap_mkstr("t-%s", name), 10, user_task, pid);
+    task_t *tuser = task_make(name, 10, user_task, pid);
     kobj_keep(tuser);
     task_start_now(tuser);
     return tuser;
 }
 
+static task_t *launch_user_task(const char *name, const char *data, size_t len) {
+    proc_t *pid = load_user_proc(name, data, len);
+    if (NULL == pid) {
+        return NULL;
+    }
+    return start_user_proc(kernel_heap_mkstr("t-%s", name), pid);
+}
+
 //------------------------------------------------------------------------------
 // 解析 tar，其中包含用户态程序镜像
 //------------------------------------------------------------------------------
@@ -97,15 +109,11 @@ typedef struct tar_result {
     size_t len;
 } tar_result_t;
 
-static int tar_find_cb(const char *name, const char *data, size_t len, void *user) {
-    tar_result_t *res = (tar_result_t*)user;
-    if (kstrcmp(res->filename, name)) {
-        return 1;
-    }
-
-    res->data = data;
-    res->len = len;
-    return 0;
+static void find_user_prog(tar_result_t *res, const char *name) {
+    kmemset(res, 0, sizeof(tar_result_t));
+    snprintk(res->filename, sizeof(res->filename), "%s.elf", name);
+    size_t tar_size = (size_t)(&_binary_users_tar_end - &_binary_users_tar_start);
+    res->data = tar_find(&_binary_users_tar_start, tar_size, res->filename, &res->len);
 }
 
 // 创建一个新任务，运行用户态代码，等待该进程结束
@@ -116,10 +124,7 @@ void run_user(int argc, char *argv[]) {
     }
 
     tar_result_t res;
-    kmemset(&res, 0, sizeof(res));
-    snprintk(res.filename, sizeof(res.filename), "%s.elf", argv[1]);
-    size_t tar_size = (size_t)(&_binary_users_tar_end - &_binary_users_tar_start);
-    tar_iterate(&_binary_users_tar_start, tar_size, tar_find_cb, &res);
+    find_user_prog(&res, argv[1]);
 
     if (res.data && res.len) {
         task_t *utid = launch_user_task(res.filename, res.data, res.len);
@@ -137,10 +142,7 @@ void start_user(int argc, char *argv[]) {
     }
 
     tar_result_t res;
-    kmemset(&res, 0, sizeof(res));
-    snprintk(res.filename, sizeof(res.filename), "%s.elf", argv[1]);
-    size_t tar_size = (size_t)(&_binary_users_tar_end - &_binary_users_tar_start);
-    tar_iterate(&_binary_users_tar_start, tar_size, tar_find_cb, &res);
+    find_user_prog(&res, argv[1]);
 
     if (res.data && res.len) {
         task_t *utid = launch_user_task(res.filename, res.data, res.len);
@@ -150,6 +152,39 @@ void start_user(int argc, char *argv[]) {
     }
 }
 
+// 只加载一次 ELF，再 fork 出多个进程后台运行
+// 代码段、数据段在进程之间写时复制共享，只有写入的页才占用新的物理内存
+void spawn_user(int argc, char *argv[]) {
+    if (argc < 3) {
+        console_printf("usage: %s USER_PROG_NAME COUNT\n", argv[0]);
+        return;
+    }
+
+    tar_result_t res;
+    find_user_prog(&res, argv[1]);
+    if ((NULL == res.data) || (0 == res.len)) {
+        return;
+    }
+
+    proc_t *parent = load_user_proc(res.filename, res.data, res.len);
+    if (NULL == parent) {
+        return;
+    }
+
+    int num = (int)str2num(argv[2]);
+    for (int i = 0; i < num; ++i) {
+        proc_t *pid = proc_fork(parent, kernel_heap_mkstr("p-%s-%d", res.filename, i));
+        if (NULL == pid) {
+            logk("error: cannot fork process\n");
+            break;
+        }
+        task_t *utid = start_user_proc(kernel_heap_mkstr("t-%s-%d", res.filename, i), pid);
+        task_drop(utid);
+    }
+    proc_drop(parent);
+}
+
 KSHELL_CMD("tar", show_tar);
 KSHELL_CMD("run", run_user);
 KSHELL_CMD("start", start_user);
+KSHELL_CMD("spawn", spawn_user);
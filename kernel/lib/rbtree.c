@@ -25,6 +25,11 @@ static inline void set_parent(rbnode_t *node, rbnode_t *parent) {
     node->parent_color = (node->parent_color & 1UL) | ((size_t)parent & ~1UL);
 }
 
+// 空节点就是叶节点，是黑色的
+static inline int is_black(rbnode_t *node) {
+    return (NULL == node) || (RB_BLACK == RB_COLOR(node));
+}
+
 
 
 // 二叉树左旋
@@ -35,7 +40,9 @@ static inline void set_parent(rbnode_t *node, rbnode_t *parent) {
 //   a   Y         X   c    .
 //      / \       / \       .
 //     b   c     a   b      .
-static void rb_rotate_left(rbtree_t *tree, rbnode_t *node) {
+//
+// 旋转前后整棵子树包含的节点不变，只需要更新 X、Y 的增强信息（先下后上）
+static void rb_rotate_left(rbtree_t *tree, rbnode_t *node, rb_update_t update) {
     rbnode_t *X = node;
     rbnode_t *Y = X->right;
     rbnode_t *P = RB_PARENT(X);
@@ -54,6 +61,11 @@ static void rb_rotate_left(rbtree_t *tree, rbnode_t *node) {
     } else {
         P->right = Y;
     }
+
+    if (update) {
+        update(X);
+        update(Y);
+    }
 }
 
 
@@ -65,7 +77,7 @@ static void rb_rotate_left(rbtree_t *tree, rbnode_t *node) {
 //   Y   c         a   X    .
 //  / \               / \   .
 // a   b             b   c  .
-static void rb_rotate_right(rbtree_t *tree, rbnode_t *node) {
+static void rb_rotate_right(rbtree_t *tree, rbnode_t *node, rb_update_t update) {
     rbnode_t *X = node;
     rbnode_t *Y = X->left;
     rbnode_t *P = RB_PARENT(X);
@@ -84,6 +96,11 @@ static void rb_rotate_right(rbtree_t *tree, rbnode_t *node) {
     } else {
         P->right = Y;
     }
+
+    if (update) {
+        update(X);
+        update(Y);
+    }
 }
 
 
@@ -96,7 +113,7 @@ void rb_init_root(rbnode_t *node) {
 
 
 // 添加新节点后执行，保持红黑树性质（node 已经添加到红黑树）
-static void rb_insert_fixup(rbtree_t *tree, rbnode_t *node) {
+static void rb_insert_fixup(rbtree_t *tree, rbnode_t *node, rb_update_t update) {
     rbnode_t *X = node;
     rbnode_t *P = NULL; // 父节点
     rbnode_t *G = NULL; // 爷节点
@@ -137,7 +154,7 @@ static void rb_insert_fixup(rbtree_t *tree, rbnode_t *node) {
                 //   (P) [U]  -->  (X) [U]  .
                 //     \           /        .
                 //     (X)       (P)        .
-                rb_rotate_left(tree, P);
+                rb_rotate_left(tree, P, update);
                 rbnode_t *tmp = X;
                 X = P;
                 P = tmp;
@@ -150,20 +167,20 @@ static void rb_insert_fixup(rbtree_t *tree, rbnode_t *node) {
             //   (P) [U]  -->  (X) [G]  -->  (X) (G)    .
             //   /                   \             \    .
             // (X)                   [U]           [U]  .
-            rb_rotate_right(tree, G);
+            rb_rotate_right(tree, G, update);
             set_color(P, RB_BLACK);
             set_color(G, RB_RED);
         } else /* if (P == G->right) */ {
             if (X == P->left) {
                 // 将两个相邻红节点旋转到右链
-                rb_rotate_right(tree, P);
+                rb_rotate_right(tree, P, update);
                 rbnode_t *tmp = X;
                 X = P;
                 P = tmp;
             }
 
             // 右侧连续两个红节点，左旋并重新染色
-            rb_rotate_left(tree, G);
+            rb_rotate_left(tree, G, update);
             set_color(P, RB_BLACK);
             set_color(G, RB_RED);
         }
@@ -174,15 +191,7 @@ static void rb_insert_fixup(rbtree_t *tree, rbnode_t *node) {
 }
 
 void rb_insert(rbtree_t *tree, rbnode_t *node, rbnode_t *parent, rbnode_t **link) {
-    ASSERT(NULL != tree);
-    ASSERT(NULL != node);
-    ASSERT(NULL != link);
-
-    node->parent_color = (size_t)parent;
-    node->left = NULL;
-    node->right = NULL;
-    *link = node;
-    rb_insert_fixup(tree, node);
+    rb_insert_augmented(tree, node, parent, link, NULL);
 }
 
 void rb_insert_left(rbtree_t *tree, rbnode_t *node, rbnode_t *parent) {
@@ -200,23 +209,23 @@ void rb_insert_right(rbtree_t *tree, rbnode_t *node, rbnode_t *parent) {
 
 // 删除黑节点后执行，保持红黑树性质
 // child 是刚刚被删除的节点的唯一子节点，这棵子树黑高度少一
-static void rb_remove_fixup(rbtree_t *tree, rbnode_t *child) {
+// child 可能为空，因此需要单独传入父节点
+static void rb_remove_fixup(rbtree_t *tree, rbnode_t *child, rbnode_t *parent, rb_update_t update) {
     rbnode_t *X = child;
+    rbnode_t *P = parent;
     rbnode_t *S = NULL; // 兄弟节点
     rbnode_t *L = NULL; // 左侄节点
-    rbnode_t *R = NULL; // 左侄节点
+    rbnode_t *R = NULL; // 右侄节点
 
     // X 子树黑高度少一，如果 X 是红色，将其染黑即可
     // 如果 X 是黑色，就需要旋转并沿树上移，直到遇到红节点
 
-    while ((X != tree->root) && (RB_BLACK == RB_COLOR(X))) {
+    while ((X != tree->root) && is_black(X)) {
         // X 不是根节点，父节点一定非空
-        rbnode_t *P = RB_PARENT(X);
-
         if (X == P->left) {
             // X 是父节点的左子节点，兄弟节点在右
-            // X 是黑色，且黑高度少一（不算叶节点），兄弟子树黑高度至少为二
-            // 说明兄弟节点一定非空，两个侄节点也一定非空
+            // X 是黑色，且黑高度少一（不算叶节点），兄弟子树黑高度至少为一
+            // 说明兄弟节点一定非空，但侄节点可能为空
             S = P->right;
 
             if (RB_RED == RB_COLOR(S)) {
@@ -231,14 +240,14 @@ static void rb_remove_fixup(rbtree_t *tree, rbnode_t *child) {
                 //   [a] [b]   [X] [a]      .
                 set_color(S, RB_BLACK);
                 set_color(P, RB_RED);
-                rb_rotate_left(tree, P);
+                rb_rotate_left(tree, P, update);
                 S = P->right;
             }
 
             L = S->left;
             R = S->right;
 
-            if ((RB_BLACK == RB_COLOR(L)) && (RB_BLACK == RB_COLOR(R))) {
+            if (is_black(L) && is_black(R)) {
                 // 兄弟节点黑色，且两个侄节点均为黑色
                 // 这样兄弟节点可以染红，黑高度也减一
                 // 黑高度少一的子树便上升了一层
@@ -249,8 +258,9 @@ static void rb_remove_fixup(rbtree_t *tree, rbnode_t *child) {
                 //   [L] [R]       [L] [R]  .
                 set_color(S, RB_RED);
                 X = P;
+                P = RB_PARENT(X);
             } else {
-                if (RB_BLACK == RB_COLOR(R)) {
+                if (is_black(R)) {
                     // 右侄节点黑色，重新染色并旋转，使右侄节点为红色
                     //    P             P       .
                     //   / \           / \      .
@@ -259,7 +269,7 @@ static void rb_remove_fixup(rbtree_t *tree, rbnode_t *child) {
                     //   (L) [R]       [a] (S)  .
                     set_color(L, RB_BLACK);
                     set_color(S, RB_RED);
-                    rb_rotate_right(tree, S);
+                    rb_rotate_right(tree, S, update);
                     S = L;
                     L = S->left;
                     R = S->right;
@@ -274,7 +284,7 @@ static void rb_remove_fixup(rbtree_t *tree, rbnode_t *child) {
                 set_color(S, RB_COLOR(P));
                 set_color(P, RB_BLACK);
                 set_color(R, RB_BLACK);
-                rb_rotate_left(tree, P);
+                rb_rotate_left(tree, P, update);
                 X = tree->root;
                 break;
             }
@@ -286,21 +296,22 @@ static void rb_remove_fixup(rbtree_t *tree, rbnode_t *child) {
             if (RB_RED == RB_COLOR(S)) {
                 set_color(S, RB_BLACK);
                 set_color(P, RB_RED);
-                rb_rotate_right(tree, P);
+                rb_rotate_right(tree, P, update);
                 S = P->left;
             }
 
             L = S->left;
             R = S->right;
 
-            if ((RB_BLACK == RB_COLOR(L)) && (RB_BLACK == RB_COLOR(R))) {
+            if (is_black(L) && is_black(R)) {
                 set_color(S, RB_RED);
                 X = P;
+                P = RB_PARENT(X);
             } else {
-                if (RB_BLACK == RB_COLOR(L)) {
+                if (is_black(L)) {
                     set_color(R, RB_BLACK);
                     set_color(S, RB_RED);
-                    rb_rotate_left(tree, S);
+                    rb_rotate_left(tree, S, update);
                     S = R;
                     L = S->left;
                     R = S->right;
@@ -309,7 +320,7 @@ static void rb_remove_fixup(rbtree_t *tree, rbnode_t *child) {
                 set_color(S, RB_COLOR(P));
                 set_color(P, RB_BLACK);
                 set_color(L, RB_BLACK);
-                rb_rotate_right(tree, P);
+                rb_rotate_right(tree, P, update);
                 X = tree->root;
                 break;
             }
@@ -323,6 +334,36 @@ static void rb_remove_fixup(rbtree_t *tree, rbnode_t *child) {
 
 
 void rb_remove(rbtree_t *tree, rbnode_t *node) {
+    rb_remove_augmented(tree, node, NULL);
+}
+
+// 从 node 开始向上，更新到根节点路径上所有节点的增强信息
+void rb_propagate(rbnode_t *node, rb_update_t update) {
+    for (; NULL != node; node = RB_PARENT(node)) {
+        update(node);
+    }
+}
+
+// 增强红黑树，每个节点保存子树的汇总信息，例如子树中的最大值
+// update 根据节点自身和两个子节点重新计算汇总信息，可以为 NULL
+// 链接新节点之后先向上更新一遍，再调整平衡，旋转只影响旋转的两个节点
+void rb_insert_augmented(rbtree_t *tree, rbnode_t *node, rbnode_t *parent, rbnode_t **link,
+        rb_update_t update) {
+    ASSERT(NULL != tree);
+    ASSERT(NULL != node);
+    ASSERT(NULL != link);
+
+    node->parent_color = (size_t)parent;
+    node->left = NULL;
+    node->right = NULL;
+    *link = node;
+    if (update) {
+        rb_propagate(node, update);
+    }
+    rb_insert_fixup(tree, node, update);
+}
+
+void rb_remove_augmented(rbtree_t *tree, rbnode_t *node, rb_update_t update) {
     ASSERT(NULL != tree);
     ASSERT(NULL != node);
 
@@ -362,11 +403,19 @@ void rb_remove(rbtree_t *tree, rbnode_t *node) {
     if (X != node) {
         // 使用 X 顶替 node 在红黑树中的位置
         rb_replace(tree, node, X);
+        if (P == node) {
+            P = X; // X 就是 node 的右子节点，顶替之后成为 C 的父节点
+        }
+    }
+
+    // P 到根节点路径上的子树发生了变化，X 如果顶替了 node，也在这条路径上
+    if (update) {
+        rb_propagate(P, update);
     }
 
     if (RB_BLACK == color) {
         // 删除了一个黑节点，需要重新染色
-        rb_remove_fixup(tree, C);
+        rb_remove_fixup(tree, C, P, update);
     }
 }
 
@@ -18,6 +18,9 @@ typedef struct rbtree {
 #define RB_COLOR(node)  ((size_t)    ((node)->parent_color &  1UL))
 #define RB_PARENT(node) ((rbnode_t *)((node)->parent_color & ~1UL))
 
+// 增强红黑树，根据子节点重新计算 node 的汇总信息
+typedef void (*rb_update_t)(rbnode_t *node);
+
 void rb_init_root(rbnode_t *node);
 
 void rb_insert(rbtree_t *tree, rbnode_t *node, rbnode_t *parent, rbnode_t **link);
@@ -26,6 +29,11 @@ void rb_insert_right(rbtree_t *tree, rbnode_t *node, rbnode_t *parent);
 
 void rb_remove(rbtree_t *tree, rbnode_t *node);
 
+void rb_propagate(rbnode_t *node, rb_update_t update);
+void rb_insert_augmented(rbtree_t *tree, rbnode_t *node, rbnode_t *parent, rbnode_t **link,
+        rb_update_t update);
+void rb_remove_augmented(rbtree_t *tree, rbnode_t *node, rb_update_t update);
+
 void rb_replace(rbtree_t *tree, rbnode_t *victim, rbnode_t *node);
 
 #endif // RBTREE_H
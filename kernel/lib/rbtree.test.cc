@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <vector>
 
 extern "C" {
 #include "rbtree.h"
@@ -139,3 +141,91 @@ TEST_F(RbTreeTest, RemoveLast) {
 }
 
 
+
+// 删除的节点没有子节点时，调整平衡需要处理空的子节点
+TEST_F(RbTreeTest, RemoveRandom) {
+    std::vector<treeitem_t*> items;
+    srand(1);
+    for (int i = 0; i < 1000; ++i) {
+        treeitem_t *item = new_item(i);
+        insert_item(item);
+        items.push_back(item);
+    }
+    validate();
+
+    for (int i = 0; i < 1000; ++i) {
+        size_t idx = (size_t)rand() % items.size();
+        remove_item(items[idx]);
+        free(items[idx]);
+        items[idx] = items.back();
+        items.pop_back();
+        if (0 == i % 100) {
+            validate();
+        }
+    }
+    EXPECT_TRUE(NULL == tree.root);
+}
+
+// 增强红黑树，每个节点记录子树中最大的 value
+typedef struct maxitem {
+    rbnode_t rb;
+    int      key;
+    int      value;
+    int      max;
+} maxitem_t;
+
+static void max_update(rbnode_t *node) {
+    maxitem_t *item = containerof(node, maxitem_t, rb);
+    item->max = item->value;
+    if (node->left) {
+        item->max = std::max(item->max, containerof(node->left, maxitem_t, rb)->max);
+    }
+    if (node->right) {
+        item->max = std::max(item->max, containerof(node->right, maxitem_t, rb)->max);
+    }
+}
+
+static int max_check(rbnode_t *node) {
+    if (NULL == node) {
+        return -1;
+    }
+    maxitem_t *item = containerof(node, maxitem_t, rb);
+    int expect = std::max(item->value, std::max(max_check(node->left), max_check(node->right)));
+    EXPECT_EQ(expect, item->max);
+    return expect;
+}
+
+TEST(RbTreeAugmented, SubtreeMax) {
+    rbtree_t tree = { NULL };
+    std::vector<maxitem_t> items(500);
+    srand(2);
+
+    for (int i = 0; i < 500; ++i) {
+        maxitem_t *item = &items[i];
+        item->key = i * 7 % 500;
+        item->value = rand() % 10000;
+
+        rbnode_t **link = &tree.root;
+        rbnode_t *parent = NULL;
+        while (*link) {
+            parent = *link;
+            if (item->key < containerof(parent, maxitem_t, rb)->key) {
+                link = &parent->left;
+            } else {
+                link = &parent->right;
+            }
+        }
+        rb_insert_augmented(&tree, &item->rb, parent, link, max_update);
+    }
+    max_check(tree.root);
+
+    // 修改一个节点的值，向上传播
+    items[123].value = 20000;
+    rb_propagate(&items[123].rb, max_update);
+    EXPECT_EQ(20000, containerof(tree.root, maxitem_t, rb)->max);
+
+    for (int i = 0; i < 500; i += 2) {
+        rb_remove_augmented(&tree, &items[i].rb, max_update);
+    }
+    max_check(tree.root);
+}
@@ -52,3 +52,29 @@ void tar_iterate(const void *data_base, size_t tar_size, tar_cb cb, void *user)
         ptr = data + fsize;
     }
 }
+
+
+typedef struct tar_found {
+    const char *name;
+    const char *data;
+    size_t      len;
+} tar_found_t;
+
+static int tar_find_cb(const char *file, const char *data, size_t len, void *user) {
+    tar_found_t *found = (tar_found_t*)user;
+    if (kstrcmp(found->name, file)) {
+        return 1;
+    }
+    found->data = data;
+    found->len = len;
+    return 0;
+}
+
+const char *tar_find(const void *data_base, size_t tar_size, const char *name, size_t *len) {
+    tar_found_t found = { name, NULL, 0 };
+    tar_iterate(data_base, tar_size, tar_find_cb, &found);
+    if (found.data && len) {
+        *len = found.len;
+    }
+    return found.data;
+}
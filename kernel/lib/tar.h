@@ -8,4 +8,7 @@ typedef int (*tar_cb)(const char *file, const char *data, size_t len, void *user
 
 void tar_iterate(const void *data_base, size_t tar_size, tar_cb cb, void *user);
 
+// 查找文件，找到则返回数据起始地址，文件大小通过 len 返回，没找到返回 NULL
+const char *tar_find(const void *data_base, size_t tar_size, const char *name, size_t *len);
+
 #endif // TAR_H
@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "tar.h"
+}
+
+// 构造只包含文件名和大小的 tar 条目
+static void tar_append(std::vector<char> &tar, const char *name, const char *data) {
+    size_t len = strlen(data);
+    size_t pos = tar.size();
+    tar.resize(pos + 512 + (len + 511) / 512 * 512, 0);
+    strcpy(&tar[pos], name);
+    snprintf(&tar[pos + 124], 12, "%011zo", len);
+    memcpy(&tar[pos + 512], data, len);
+}
+
+TEST(Tar, Find) {
+    std::vector<char> tar;
+    tar_append(tar, "a.elf", "hello");
+    tar_append(tar, "b.elf", std::string(600, 'x').c_str());
+    tar_append(tar, "c.elf", "world");
+    tar.resize(tar.size() + 1024, 0);
+
+    size_t len = 0;
+    const char *data = tar_find(tar.data(), tar.size(), "c.elf", &len);
+    ASSERT_TRUE(NULL != data);
+    EXPECT_EQ(5U, len);
+    EXPECT_EQ(0, memcmp(data, "world", 5));
+
+    data = tar_find(tar.data(), tar.size(), "b.elf", &len);
+    ASSERT_TRUE(NULL != data);
+    EXPECT_EQ(600U, len);
+
+    EXPECT_TRUE(NULL == tar_find(tar.data(), tar.size(), "d.elf", &len));
+}
@@ -0,0 +1,62 @@
+// 内核堆性能测试，空闲块尺寸各不相同时，分配释放的延迟
+//
+// 换成 TLSF 之前，同样的测试在 ASan、单核下的结果（best-fit 红黑树）：
+// alloc p50 ~280ns p99 ~465ns，free p50 ~290ns p99 ~405ns
+
+#include <random>
+#include <vector>
+
+#include "kbench.h"
+
+extern "C" {
+    #include "heap.h"
+}
+
+// 随机尺寸分配，隔一个释放一个，得到大量尺寸各异、无法合并的空闲块
+// 之后随机尺寸的分配释放交替进行，统计每次操作的延迟分布
+KBENCH(heap) {
+    (void)opt;
+    const size_t size = 16 << 20;
+    const int count = 40000;
+    std::vector<uint8_t> buff(size);
+    heap_t heap;
+    heap_init(&heap, buff.data(), size);
+
+    std::mt19937 rng(1);
+    std::vector<void*> ptrs;
+    for (int i = 0; i < count; ++i) {
+        void *p = heap_alloc(&heap, 16 + rng() % 512);
+        if (nullptr == p) {
+            return 1;
+        }
+        ptrs.push_back(p);
+    }
+    for (int i = 0; i < count; i += 2) {
+        heap_free(&heap, ptrs[i]);
+    }
+
+    std::vector<uint32_t> alloc_ns;
+    std::vector<uint32_t> free_ns;
+    size_t errors = 0;
+    for (int i = 0; i < count; ++i) {
+        size_t n = 16 + rng() % 1024;
+        BenchClock::time_point t0 = BenchClock::now();
+        void *p = heap_alloc(&heap, n);
+        alloc_ns.push_back(bench_elapsed(t0));
+        if (nullptr == p) {
+            ++errors;
+            continue;
+        }
+        t0 = BenchClock::now();
+        heap_free(&heap, p);
+        free_ns.push_back(bench_elapsed(t0));
+    }
+
+    bench_report("heap", "fragmented", "heap_alloc", alloc_ns);
+    bench_report("heap", "fragmented", "heap_free", free_ns);
+
+    for (int i = 1; i < count; i += 2) {
+        heap_free(&heap, ptrs[i]);
+    }
+    return errors;
+}
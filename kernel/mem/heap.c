@@ -1,5 +1,7 @@
 #include "heap.h"
-#include <dllist.h>
+#include "vmspace.h"
+#include "shrinker.h"
+#include <arch_api.h>
 #include <kstring.h>
 #include <format.h>
 #include <debug.h>
@@ -8,15 +10,15 @@
 #include <kshell.h>
 
 
-// 非常粗糙的堆实现
-// 可以替换成 TLSF 算法（Two-Level Segregated Fit）
-
-// 相同大小的 free-chunk 组成链表，称作 freelist
-// freelist 的头节点还有一个 sizenode，组成红黑树，按 size 排序
-// 通过 sizenode.parent_color 是否为零可以判断这个 chunk 是否为头节点
-
-// 一种尺寸只需要一个 sizenode，理论上可以将 size_bin 提取出来，做成单独的 object
-// 但这样的话，一次 heap_alloc 可能要分配两个 chunk，一个返回用户，一个用于 size_bin
+// Two-Level Segregated Fit
+// chunk 按大小分级，第一级是 2 的幂区间（fl），第二级把区间等分为 HEAP_SL_COUNT 份（sl）
+// 每个 (fl, sl) 对应一条 freelist，两级 bitmap 记录哪些链表非空
+// 分配时把 size 向上取整到下一个区间的起点，该区间内任意 chunk 都足够大，取链表头即可
+// 分配、释放只需常数次位运算和链表操作，耗时有确定上界，适合中断附近的代码
+// 代价是向上取整带来的内部碎片，最多为 size 的 1/HEAP_SL_COUNT
+//
+// 堆由若干 arena 组成，每个 arena 首尾各有一个 guard chunk，相邻 chunk 合并不会越界
+// 所有 arena 共用同一组 freelist
 
 
 #define ALIGNMENT 8
@@ -26,6 +28,8 @@
 
 #define CHUNK_INUSE 1U // 表示已分配
 
+#define SMALL_SIZE (1U << HEAP_FL_SHIFT) // 小于这个值的 chunk 不分级
+
 typedef struct chunk_hdr {
     uint32_t prevsize;   // 包括 header
     uint32_t selfsize;   // 包括 header，最低位表示已分配
@@ -35,13 +39,25 @@ typedef struct chunk {
     chunk_hdr_t hdr;
     union {
         uint8_t data[8];    // 已分配 chunk 拥有此成员
-        struct {
-            dlnode_t freenode;
-            rbnode_t sizenode; // 相同大小的 chunk 只有一个具有 sizenode
-        };
+        dlnode_t freenode;  // 空闲 chunk 位于 freelist 中
     };
 } ALIGNED(ALIGNMENT) chunk_t;
 
+// 位于每个 arena 开头
+typedef struct heap_arena {
+    dlnode_t dl;
+    char    *base;  // arena 所在内存片段，release 时传回
+    size_t   size;
+    char    *buff;  // 第一个 chunk，不含 guard
+    char    *end;   // 结尾 guard chunk
+    int      keep;  // heap_init 添加的 arena 不归还
+} ALIGNED(ALIGNMENT) heap_arena_t;
+
+// chunk 大小用 32 位记录，arena 最大 UINT32_MAX 字节，扣除描述符、首尾 guard
+// 查找时还要向上取整到下一个分级，超过这个大小的请求任何 arena 都无法满足
+#define ALLOC_MAX ((size_t)UINT32_MAX - UINT32_MAX / HEAP_SL_COUNT \
+        - sizeof(heap_arena_t) - sizeof(chunk_t) * 3 - PAGE_SIZE)
+
 
 static inline chunk_t *build_chunk_used(size_t addr, size_t prevsize, size_t selfsize) {
     ASSERT(prevsize <= UINT32_MAX);
@@ -66,115 +82,109 @@ static inline chunk_t *build_chunk_free(size_t addr, size_t prevsize, size_t sel
     chunk_t *chk = (chunk_t*)addr;
     chk->hdr.prevsize = prevsize;
     chk->hdr.selfsize = selfsize;
-    dl_init_circular(&chk->freenode);
-    rb_init_root(&chk->sizenode);
-    // chk->sizenode = RBNODE_INIT;
     return chk;
 }
 
 
+// 计算 size 所属的链表
+static inline void size_to_index(size_t size, uint32_t *fl, uint32_t *sl) {
+    ASSERT(size <= UINT32_MAX);
+    if (size < SMALL_SIZE) {
+        *fl = 0;
+        *sl = (uint32_t)size / ALIGNMENT;
+        return;
+    }
 
+    uint32_t msb = 31 - __builtin_clz((uint32_t)size);
+    *fl = msb - HEAP_FL_SHIFT + 1;
+    *sl = ((uint32_t)size >> (msb - HEAP_SL_SHIFT)) ^ HEAP_SL_COUNT;
+}
+
+// 查找的起点，向上取整到下一条链表，保证链表中的 chunk 都不小于 size
+// 返回 0 表示 size 太大
+static inline int size_to_search(size_t size, uint32_t *fl, uint32_t *sl) {
+    if (size >= SMALL_SIZE) {
+        uint32_t msb = 63 - __builtin_clzll(size);
+        size += (1UL << (msb - HEAP_SL_SHIFT)) - 1;
+    }
+    if (size > UINT32_MAX) {
+        return 0;
+    }
+    size_to_index(size, fl, sl);
+    return 1;
+}
 
-// 将 chunk 放入未分配集合
-// 不会检查相邻 chunk
+
+// 将 chunk 放入未分配集合，不会检查相邻 chunk
 static void put_chunk_into_heap(heap_t *heap, chunk_t *chk) {
     ASSERT(NULL != heap);
     ASSERT(NULL != chk);
-    // ASSERT(chk->hdr.selfsize & CHUNK_INUSE);
 
     chk->hdr.selfsize &= ~CHUNK_INUSE; // 标记为可用
-    // chk->sizenode = RBNODE_INIT;
-
-    // 在 sizetree 中搜索相同大小的节点
-    rbnode_t **link = &heap->sizetree.root;
-    rbnode_t *parent = NULL;
-    while (NULL != *link) {
-        parent = *link;
-        chunk_t *ref = containerof(parent, chunk_t, sizenode);
-        size_t size = ref->hdr.selfsize;
-        ASSERT(0 == (size & CHUNK_INUSE));
-
-        if (chk->hdr.selfsize == size) {
-            // 已存在相同大小的 freelist，只需添加到链表结尾
-            chk->sizenode.parent_color = 0;
-            dl_insert_before(&chk->freenode, &ref->freenode);
-            return;
-        } else if (chk->hdr.selfsize < size) {
-            link = &parent->left;
-        } else {
-            link = &parent->right;
-        }
-    }
 
-    // 没有该大小的 bin，创建新的 freelist
-    // 此 chunk 作为新的 size-node 放入平衡树
-    rb_init_root(&chk->sizenode);
-    dl_init_circular(&chk->freenode);
-    rb_insert(&heap->sizetree, &chk->sizenode, parent, link);
+    uint32_t fl, sl;
+    size_to_index(chk->hdr.selfsize, &fl, &sl);
+    dl_insert_after(&chk->freenode, &heap->lists[fl][sl]);
+    heap->fl_bitmap |= 1U << fl;
+    heap->sl_bitmap[fl] |= 1U << sl;
 }
 
 // 从集合中取出一个 chunk，标记为已分配
 static void take_chunk_from_heap(heap_t *heap, chunk_t *chk) {
     ASSERT(NULL != heap);
     ASSERT(NULL != chk);
-    // ASSERT(0 == (chk->hdr.selfsize & CHUNK_INUSE));
+    ASSERT(0 == (chk->hdr.selfsize & CHUNK_INUSE));
+
+    uint32_t fl, sl;
+    size_to_index(chk->hdr.selfsize, &fl, &sl);
+    dl_remove(&chk->freenode);
+    if (dl_is_lastone(&heap->lists[fl][sl])) {
+        heap->sl_bitmap[fl] &= ~(1U << sl);
+        if (0 == heap->sl_bitmap[fl]) {
+            heap->fl_bitmap &= ~(1U << fl);
+        }
+    }
 
     chk->hdr.selfsize |= CHUNK_INUSE; // 标记为已分配
+}
 
-    // 检查 parent 指针，判断是否位于 sizetree（红黑树根节点为黑色，非零）
-    if (chk->sizenode.parent_color) {
-        dlnode_t *next_dl = dl_remove(&chk->freenode);
-        if (NULL == next_dl) {
-            rb_remove(&heap->sizetree, &chk->sizenode);
-        } else {
-            chunk_t *next_chk = containerof(next_dl, chunk_t, freenode);
-            rb_replace(&heap->sizetree, &chk->sizenode, &next_chk->sizenode);
+
+// 寻找一条非空链表，其中的 chunk 都不小于 size，找不到返回 0
+static int find_suitable(heap_t *heap, size_t size, uint32_t *fl, uint32_t *sl) {
+    if (!size_to_search(size, fl, sl)) {
+        return 0;
+    }
+
+    // 先在同一个第一级区间里找，再找更大的区间
+    uint32_t slmap = heap->sl_bitmap[*fl] & (~0U << *sl);
+    if (0 == slmap) {
+        uint32_t flmap = (*fl + 1 < 32) ? heap->fl_bitmap & (~0U << (*fl + 1)) : 0;
+        if (0 == flmap) {
+            return 0; // 内存不足
         }
-        rb_init_root(&chk->sizenode); // 已从红黑树中取出
-    } else {
-        // 不是 freelist 头节点，只要将它从链表中删除
-        dl_remove(&chk->freenode);
+        *fl = __builtin_ctz(flmap);
+        slmap = heap->sl_bitmap[*fl];
     }
+    *sl = __builtin_ctz(slmap);
+    return 1;
 }
 
-
 static chunk_t *chunk_alloc(heap_t *heap, size_t size) {
     ASSERT(NULL != heap);
     ASSERT(0 == (size & (ALIGNMENT - 1)));
 
-    // size += sizeof(chunk_hdr_t);
-    // size = ROUND_UP(size);
-
-    // 在红黑树中寻找最合适的节点（最小的的大于 size 的 chunk）
-    rbnode_t *rb = heap->sizetree.root;
-    chunk_t *best = NULL;
-    while (rb) {
-        chunk_t *chk = containerof(rb, chunk_t, sizenode);
-        ASSERT(rb->parent_color);
-        ASSERT(0 == (chk->hdr.selfsize & CHUNK_INUSE));
-
-        if (chk->hdr.selfsize < size) {
-            rb = rb->right;
-        } else if (chk->hdr.selfsize > size) {
-            best = chk;
-            rb = rb->left;
-        } else {
-            best = chk;
-            break;
-        }
-    }
-
-    if (NULL == best) {
-        // 内存不足，需要扩容
+    uint32_t fl, sl;
+    if (!find_suitable(heap, size, &fl, &sl)) {
         return NULL;
     }
 
-    // 取出 freelist 中的最后一个节点，尽量不移除头节点
-    chunk_t *chk = containerof(best->freenode.prev, chunk_t, freenode);
+    dlnode_t *node = heap->lists[fl][sl].next;
+    chunk_t *chk = containerof(node, chunk_t, freenode);
     take_chunk_from_heap(heap, chk);
 
     // 如果剩余空间足够大，就分割为前后两个 chunk，后一部分放回 heap
     uint32_t selfsize = chk->hdr.selfsize & ~CHUNK_INUSE;
+    ASSERT(selfsize >= size);
     size_t remain = selfsize - size;
     if (remain >= sizeof(chunk_t))  {
         chunk_t *rest = build_chunk_free((size_t)chk + size, size, remain);
@@ -187,22 +197,25 @@ static chunk_t *chunk_alloc(heap_t *heap, size_t size) {
         chk->hdr.selfsize = size | CHUNK_INUSE;
     }
 
+    heap->used += chk->hdr.selfsize & ~CHUNK_INUSE;
+    if (heap->peak < heap->used) {
+        heap->peak = heap->used;
+    }
     return chk;
 }
 
 
-static void chunk_free(heap_t *heap, chunk_t *chk) {
+// 返回合并之后的空闲 chunk
+static chunk_t *chunk_free(heap_t *heap, chunk_t *chk) {
     ASSERT(NULL != heap);
     ASSERT(NULL != chk);
     ASSERT(0 == ((size_t)chk & (ALIGNMENT - 1)));
 
-    // size_t addr = (size_t)ptr - sizeof(chunk_hdr_t);
-    // ASSERT(0 == (addr & (ALIGNMENT - 1)));
-
-    // chunk_t *chk = (chunk_t*)addr;
     ASSERT(chk->hdr.selfsize & CHUNK_INUSE);
     size_t size = chk->hdr.selfsize & ~CHUNK_INUSE;
     ASSERT(0 == (size & (ALIGNMENT - 1)));
+    ASSERT(heap->used >= size);
+    heap->used -= size;
 
     chunk_t *prev = (chunk_t*)((size_t)chk - chk->hdr.prevsize);
     chunk_t *next = (chunk_t*)((size_t)chk + size);
@@ -225,13 +238,13 @@ static void chunk_free(heap_t *heap, chunk_t *chk) {
     }
 
     put_chunk_into_heap(heap, chk);
+    return chk;
 }
 
 
 
-// 在给定内存片段建立堆
-// TODO 如果传入 buff 是空指针，表示自动分配，支持自动扩容
-void heap_init(heap_t *heap, void *buff, size_t size) {
+// 把一段内存加入堆，开头存放 arena 描述符，剩余部分划分为三个 chunk，头尾始终处于 inuse 状态
+static int arena_add(heap_t *heap, void *buff, size_t size, int keep) {
     ASSERT(NULL != heap);
     ASSERT(NULL != buff);
 
@@ -240,30 +253,92 @@ void heap_init(heap_t *heap, void *buff, size_t size) {
         size = UINT32_MAX;
     }
 
-    size_t start = ROUND_UP((size_t)buff);
+    size_t start = ROUND_UP((size_t)buff + sizeof(heap_arena_t));
     size_t end = ROUND_DOWN((size_t)buff + size);
-    ASSERT(start + sizeof(chunk_t) * 3 <= end);
+    if (start + sizeof(chunk_t) * 3 > end) {
+        return 0;
+    }
+
+    heap_arena_t *arena = (heap_arena_t*)ROUND_UP((size_t)buff);
+    arena->base = buff;
+    arena->size = size;
+    arena->keep = keep;
 
-    // 划分为三个 chunk，头尾始终处于 inuse 状态
     size_t guard_size = ROUND_UP(sizeof(chunk_hdr_t));
     build_chunk_used(start, 0, guard_size);
     start += guard_size;
     end -= guard_size;
     chunk_t *body_chk = build_chunk_free(start, guard_size, end - start);
     build_chunk_used(end, end - start, guard_size);
+    arena->buff = (char*)start;
+    arena->end  = (char*)end;
+
+    SPINLOCK_SCOPED(&heap->spin);
+    dl_insert_before(&arena->dl, &heap->arenas);
+    ++heap->arena_num;
+    heap->total += end - start;
+    put_chunk_into_heap(heap, body_chk);
+    return 1;
+}
+
+// 查找 chunk 所在的 arena，不属于这个堆则返回 NULL
+static heap_arena_t *arena_of(heap_t *heap, chunk_t *chk) {
+    for (dlnode_t *i = heap->arenas.next; &heap->arenas != i; i = i->next) {
+        heap_arena_t *arena = containerof(i, heap_arena_t, dl);
+        if (((char*)chk >= arena->buff) && ((char*)chk < arena->end)) {
+            return arena;
+        }
+    }
+    return NULL;
+}
+
+// arena 完全空闲，并且其他 arena 剩余的空间不少于它的四分之一，才归还
+// 避免在边界附近反复分配释放时，频繁地扩容、归还
+static int arena_releasable(heap_t *heap, heap_arena_t *arena, chunk_t *chk) {
+    if (arena->keep || (NULL == heap->release)) {
+        return 0;
+    }
+    size_t size = arena->end - arena->buff;
+    if (((char*)chk != arena->buff) || (chk->hdr.selfsize != size)) {
+        return 0;
+    }
+    return heap->total - heap->used - size >= size / 4;
+}
+
+// 在给定内存片段建立堆，buff 可以为 NULL，此时堆为空，依靠 grow 扩容
+void heap_init(heap_t *heap, void *buff, size_t size) {
+    ASSERT(NULL != heap);
 
     kmemset(heap, 0, sizeof(heap_t));
-    // spin_init(&heap->spin);
     heap->spin = SPINLOCK_INIT;
-    // heap->sizetree = RBTREE_INIT;
-    heap->buff = (char*)start;
-    heap->end  = (char*)end;
-    put_chunk_into_heap(heap, body_chk);
+    for (uint32_t fl = 0; fl < HEAP_FL_COUNT; ++fl) {
+        for (uint32_t sl = 0; sl < HEAP_SL_COUNT; ++sl) {
+            dl_init_circular(&heap->lists[fl][sl]);
+        }
+    }
+    dl_init_circular(&heap->arenas);
+
+    if (NULL != buff) {
+        int ok = arena_add(heap, buff, size, 1);
+        ASSERT(ok);
+        (void)ok;
+    }
+}
+
+// 添加一段内存，完全空闲时可以通过 release 归还
+// 内存太小无法使用，返回 0
+int heap_add(heap_t *heap, void *buff, size_t size) {
+    return arena_add(heap, buff, size, 0);
 }
 
 MALLOC void *heap_alloc(heap_t *heap, size_t size) {
     ASSERT(NULL != heap);
 
+    // 不可能满足的请求直接失败，不能扩容，否则会一直扩容到耗尽 arena 或内存
+    if (size > ALLOC_MAX) {
+        return NULL;
+    }
+
     size += sizeof(chunk_hdr_t);
     if (size < sizeof(chunk_t)) {
         size = sizeof(chunk_t);
@@ -275,6 +350,13 @@ MALLOC void *heap_alloc(heap_t *heap, size_t size) {
         SPINLOCK_SCOPED(&heap->spin);
         chk = chunk_alloc(heap, size);
     }
+
+    // 扩容期间不能持有堆的锁，扩容之后重试
+    while ((NULL == chk) && (NULL != heap->grow) && heap->grow(heap, size)) {
+        SPINLOCK_SCOPED(&heap->spin);
+        chk = chunk_alloc(heap, size);
+    }
+
     if (NULL == chk) {
         return NULL;
     }
@@ -287,14 +369,62 @@ void heap_free(heap_t *heap, void *ptr) {
 
     chunk_t *chk = (chunk_t*)((size_t)ptr - sizeof(chunk_hdr_t));
 
-    // 检查这个 chk 是否位于 heap 内部
-    if (((char*)chk < heap->buff) || ((char*)chk >= heap->end)) {
-        return;
-    }
-
+    heap_arena_t *arena;
     {
         SPINLOCK_SCOPED(&heap->spin);
-        chunk_free(heap, chk);
+
+        // 检查这个 chk 是否位于 heap 内部
+        arena = arena_of(heap, chk);
+        if (NULL == arena) {
+            return;
+        }
+
+        chk = chunk_free(heap, chk);
+        if (!arena_releasable(heap, arena, chk)) {
+            return;
+        }
+
+        // 整个 arena 都空闲，从堆中摘除
+        take_chunk_from_heap(heap, chk);
+        dl_remove(&arena->dl);
+        --heap->arena_num;
+        heap->total -= arena->end - arena->buff;
+    }
+
+    // 释放锁之后再归还，release 可能要修改页表
+    heap->release(heap, arena->base, arena->size);
+}
+
+void heap_get_stats(heap_t *heap, heap_stats_t *stats) {
+    ASSERT(NULL != heap);
+    ASSERT(NULL != stats);
+
+    kmemset(stats, 0, sizeof(heap_stats_t));
+
+    SPINLOCK_SCOPED(&heap->spin);
+    stats->arena_num = heap->arena_num;
+    stats->total = heap->total;
+    stats->used = heap->used;
+    stats->peak = heap->peak;
+    stats->free = heap->total - heap->used;
+
+    // buff、end 之间的范围不含头尾两个 guard chunk
+    for (dlnode_t *i = heap->arenas.next; &heap->arenas != i; i = i->next) {
+        heap_arena_t *arena = containerof(i, heap_arena_t, dl);
+        for (char *ptr = arena->buff; ptr < arena->end;) {
+            chunk_hdr_t *hdr = (chunk_hdr_t*)ptr;
+            uint32_t size = hdr->selfsize & ~CHUNK_INUSE;
+            ptr += size;
+
+            if (hdr->selfsize & CHUNK_INUSE) {
+                ++stats->used_cnt;
+            } else {
+                ++stats->free_cnt;
+                if (stats->max_free < size) {
+                    stats->max_free = size;
+                }
+            }
+        }
     }
 }
 
@@ -305,23 +435,402 @@ void heap_free(heap_t *heap, void *ptr) {
 //------------------------------------------------------------------------------
 
 // 用来分配一些零碎的小对象，例如对象名称字符串
+// 启动时使用内核数据段之后的一小段内存，不够用就从 g_kernel_vm 申请新的 arena
+// 新 arena 的大小翻倍增长，不超过 KERNEL_HEAP_ARENA_MAX，arena 描述符来自静态数组
+
+#define KERNEL_HEAP_ARENA_NUM   64
+#define KERNEL_HEAP_ARENA_MAX   0x100000
 
 static heap_t g_kernel_heap;
 
+static spinlock_t g_kernel_arena_lock = SPINLOCK_INIT;
+static vmrange_t g_kernel_arenas[KERNEL_HEAP_ARENA_NUM];
+static size_t g_kernel_arena_size = KERNEL_HEAP_SIZE;
+
+// 在关中断的地方归还的 arena 无法 shootdown，保持映射，只在这里记录
+// 由下一次能够 shootdown 的归还，或者 shrinker 一并删除
+static uint64_t g_kernel_arena_pending = 0; // guarded by g_kernel_arena_lock
+
+// shrinker 解除映射的 arena，shootdown 之后才删除范围、释放描述符
+static shrink_defer_t g_kernel_arena_defers[KERNEL_HEAP_ARENA_NUM];
+
+static int kernel_heap_grow(heap_t *heap, size_t size) {
+    ASSERT(&g_kernel_heap == heap);
+
+    // 留出 arena 描述符、guard，以及 TLSF 向上取整的余量
+    size_t need = size + size / HEAP_SL_COUNT + sizeof(heap_arena_t) + sizeof(chunk_t) * 3;
+    need = (need + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (need > UINT32_MAX) {
+        return 0; // arena_add 会截断，扩容之后仍然放不下
+    }
+
+    SPINLOCK_SCOPED(&g_kernel_arena_lock);
+
+    // 等锁期间可能已经有别的 CPU 完成了扩容
+    {
+        SPINLOCK_SCOPED(&heap->spin);
+        uint32_t fl, sl;
+        if (find_suitable(heap, size, &fl, &sl)) {
+            return 1;
+        }
+    }
+
+    vmrange_t *rng = NULL;
+    for (int i = 0; i < KERNEL_HEAP_ARENA_NUM; ++i) {
+        if (NULL == g_kernel_arenas[i].desc) {
+            rng = &g_kernel_arenas[i];
+            break;
+        }
+    }
+    if (NULL == rng) {
+        logk("kernel heap: too many arenas\n");
+        return 0;
+    }
+
+    if (g_kernel_arena_size < KERNEL_HEAP_ARENA_MAX) {
+        g_kernel_arena_size *= 2;
+    }
+    if (need < g_kernel_arena_size) {
+        need = g_kernel_arena_size;
+    }
+
+    rng->desc = "heap";
+    void *va = vmspace_alloc(&g_kernel_vm, rng, need, PT_KERNEL, MMU_WRITE);
+    if (NULL == va) {
+        rng->desc = NULL;
+        return 0;
+    }
+    return heap_add(heap, va, need);
+}
+
+// 堆的锁已经释放，arena 不会再被访问
+// 先解除映射，让其他 CPU 清除 TLB，再释放物理页、删除范围，tlb-shootdown 要求开中断、不在中断里
+// 无法 shootdown 就先记入 pending，能够 shootdown 时连同之前 pending 的一起删除
+static void kernel_heap_release(heap_t *heap, void *buff, size_t size) {
+    ASSERT(&g_kernel_heap == heap);
+    (void)heap;
+    (void)size;
+
+    int shootdown = tlb_may_shootdown();
+    uint64_t pending;
+    {
+        SPINLOCK_SCOPED(&g_kernel_arena_lock);
+        int i = 0;
+        while ((i < KERNEL_HEAP_ARENA_NUM)
+            && ((NULL == g_kernel_arenas[i].desc) || (g_kernel_arenas[i].vaddr != (size_t)buff))) {
+            ++i;
+        }
+        ASSERT(i < KERNEL_HEAP_ARENA_NUM); // 不是 kernel_heap_grow 申请的
+        g_kernel_arena_pending |= 1UL << i;
+        if (!shootdown) {
+            return;
+        }
+        pending = g_kernel_arena_pending;
+        g_kernel_arena_pending = 0;
+    }
+
+    // desc 仍然非空，范围也还在，shootdown 期间这些 arena 和地址都不会被重新使用
+    pglist_t pages = { 0, 0 };
+    size_t vstart = (size_t)-1;
+    size_t vend = 0;
+    for (int i = 0; i < KERNEL_HEAP_ARENA_NUM; ++i) {
+        if (pending & (1UL << i)) {
+            vmrange_t *rng = &g_kernel_arenas[i];
+            vstart = (rng->vaddr < vstart) ? rng->vaddr : vstart;
+            vend = (rng->vend > vend) ? rng->vend : vend;
+            vmspace_unmap(&g_kernel_vm, rng, &pages);
+        }
+    }
+    tlb_shootdown(vstart, vend);
+    pagelist_free(&pages);
+
+    SPINLOCK_SCOPED(&g_kernel_arena_lock);
+    for (int i = 0; i < KERNEL_HEAP_ARENA_NUM; ++i) {
+        if (pending & (1UL << i)) {
+            vmspace_release(&g_kernel_vm, &g_kernel_arenas[i]);
+            g_kernel_arenas[i].desc = NULL;
+        }
+    }
+}
+
+// shrink_all 执行 tlb-shootdown 之后调用，arena 的地址和描述符可以重新使用了
+static void kernel_arena_release(shrink_defer_t *defer) {
+    int i = (int)(defer - g_kernel_arena_defers);
+    SPINLOCK_SCOPED(&g_kernel_arena_lock);
+    vmspace_release(&g_kernel_vm, &g_kernel_arenas[i]);
+    g_kernel_arenas[i].desc = NULL;
+}
+
+
+// per-CPU magazine，缓存常用尺寸的小对象，分配释放大多不需要获取堆的锁
+// 每个 CPU、每个尺寸有两个 magazine（loaded、prev），都空或都满时才与 depot 交换
+// 对象通过第一个字连成链表，一个 magazine 就是一条最多 MAG_SIZE 个对象的链表
+// depot 只保存满的 magazine，头部对象的第二个字指向下一个 magazine
+// 缓存中的对象在堆看来仍然是已分配状态，内存紧张时由 shrinker 全部归还给堆
+
+#define MAG_SIZE        16  // 每个 magazine 的对象数量
+#define MAG_DEPOT_MAX   8   // 每个尺寸在 depot 中最多保存的 magazine 数量
+#define MAG_CLASS_NUM   10
+
+static const uint32_t g_mag_sizes[MAG_CLASS_NUM] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512
+};
+
+typedef struct magazine {
+    void    *head;
+    uint32_t count;
+} magazine_t;
+
+typedef struct heap_cache {
+    spinlock_t lock;    // shrinker 可能访问其他 CPU 的缓存
+    magazine_t loaded[MAG_CLASS_NUM];
+    magazine_t prev[MAG_CLASS_NUM];
+    size_t     hits;    // 直接从 magazine 分配/回收
+    size_t     misses;  // 需要访问堆
+} heap_cache_t;
+
+typedef struct mag_depot {
+    void    *full;
+    uint32_t count;
+} mag_depot_t;
+
+// percpu 需要在 thiscpu_init 之后才能访问
+// 单元测试没有 percpu，缓存始终关闭
+static CONST int g_heap_cache_on = 0;
+static PERCPU_BSS heap_cache_t g_heap_cache;
+static shrinker_t g_heap_shrinker;
+
+static spinlock_t g_depot_spin = SPINLOCK_INIT;
+static mag_depot_t g_depots[MAG_CLASS_NUM]; // guarded by g_depot_spin
+
+
+// 能容纳 size 的最小尺寸，太大返回 -1
+static int mag_class_alloc(size_t size) {
+    for (int i = 0; i < MAG_CLASS_NUM; ++i) {
+        if (size <= g_mag_sizes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 不超过 chunk 可用空间的最大尺寸，太大返回 -1
+// chunk 可能因为分割剩余太小而略大于申请的尺寸，向下取整不影响复用
+static int mag_class_free(void *ptr) {
+    chunk_t *chk = (chunk_t*)((size_t)ptr - sizeof(chunk_hdr_t));
+    ASSERT(chk->hdr.selfsize & CHUNK_INUSE);
+    size_t usable = (chk->hdr.selfsize & ~CHUNK_INUSE) - sizeof(chunk_hdr_t);
+    if (usable > g_mag_sizes[MAG_CLASS_NUM - 1]) {
+        return -1;
+    }
+    int cls = MAG_CLASS_NUM - 1;
+    while ((cls > 0) && (g_mag_sizes[cls] > usable)) {
+        --cls;
+    }
+    return cls;
+}
+
+static inline void mag_swap(magazine_t *a, magazine_t *b) {
+    magazine_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+// 缓存为空返回 NULL
+static void *mag_alloc(int cls) {
+    heap_cache_t *cache = THISCPU(&g_heap_cache);
+    SPINLOCK_SCOPED(&cache->lock);
+    magazine_t *loaded = &cache->loaded[cls];
+    magazine_t *prev = &cache->prev[cls];
+
+    if (0 == loaded->count) {
+        if (prev->count) {
+            mag_swap(loaded, prev);
+        } else {
+            SPINLOCK_SCOPED(&g_depot_spin);
+            mag_depot_t *depot = &g_depots[cls];
+            if (depot->full) {
+                void **mag = (void**)depot->full;
+                depot->full = mag[1];
+                --depot->count;
+                loaded->head = mag;
+                loaded->count = MAG_SIZE;
+            }
+        }
+    }
+
+    void *obj = NULL;
+    if (loaded->count) {
+        obj = loaded->head;
+        loaded->head = *(void**)obj;
+        --loaded->count;
+        ++cache->hits;
+    } else {
+        ++cache->misses;
+    }
+
+    return obj;
+}
+
+// 对象放入缓存，depot 已满时，多出来的 magazine 通过 flush 返回，由调用者归还给堆
+static void mag_free(void *obj, int cls, magazine_t *flush) {
+    heap_cache_t *cache = THISCPU(&g_heap_cache);
+    SPINLOCK_SCOPED(&cache->lock);
+    magazine_t *loaded = &cache->loaded[cls];
+    magazine_t *prev = &cache->prev[cls];
+    int hit = 1;
+
+    if (MAG_SIZE == loaded->count) {
+        if (MAG_SIZE != prev->count) {
+            mag_swap(loaded, prev);
+        } else {
+            // 两个都满了，prev 交给 depot，换成一个空的
+            {
+                SPINLOCK_SCOPED(&g_depot_spin);
+                mag_depot_t *depot = &g_depots[cls];
+                if (depot->count < MAG_DEPOT_MAX) {
+                    void **mag = (void**)prev->head;
+                    mag[1] = depot->full;
+                    depot->full = mag;
+                    ++depot->count;
+                } else {
+                    *flush = *prev;
+                }
+            }
+            prev->head = NULL;
+            prev->count = 0;
+            mag_swap(loaded, prev);
+            hit = 0;
+        }
+    }
+
+    *(void**)obj = loaded->head;
+    loaded->head = obj;
+    ++loaded->count;
+    if (hit) {
+        ++cache->hits;
+    } else {
+        ++cache->misses;
+    }
+}
+
+// 一条 magazine 链表中的对象全部归还给堆
+static void mag_release(void *head) {
+    while (head) {
+        void *obj = head;
+        head = *(void**)obj;
+        heap_free(&g_kernel_heap, obj);
+    }
+}
+
+// 清空所有 CPU 的 magazine 和 depot，对象归还给堆
+// 此时持有注册表锁，不能 shootdown，完全空闲的 arena 只会记入 pending
+// 再把 pending 的 arena 解除映射，交给 shrink_all 统一 shootdown、释放物理页
+// 范围和描述符保留到 shootdown 之后，由 kernel_arena_release 删除
+static uint32_t heap_shrink(shrinker_t *self UNUSED, shrink_ctl_t *ctl) {
+    for (int i = 0; i < cpu_count(); ++i) {
+        heap_cache_t *cache = PERCPU(i, &g_heap_cache);
+        for (int c = 0; c < MAG_CLASS_NUM; ++c) {
+            magazine_t loaded;
+            magazine_t prev;
+            {
+                SPINLOCK_SCOPED(&cache->lock);
+                loaded = cache->loaded[c];
+                prev = cache->prev[c];
+                cache->loaded[c] = (magazine_t){ NULL, 0 };
+                cache->prev[c] = (magazine_t){ NULL, 0 };
+            }
+            mag_release(loaded.head);
+            mag_release(prev.head);
+        }
+    }
+
+    for (int c = 0; c < MAG_CLASS_NUM; ++c) {
+        void *full;
+        {
+            SPINLOCK_SCOPED(&g_depot_spin);
+            full = g_depots[c].full;
+            g_depots[c].full = NULL;
+            g_depots[c].count = 0;
+        }
+        while (full) {
+            void *next = ((void**)full)[1]; // 头部对象归还之前读出下一个 magazine
+            mag_release(full);
+            full = next;
+        }
+    }
+
+    uint32_t num = 0;
+    SPINLOCK_SCOPED(&g_kernel_arena_lock);
+    for (int i = 0; i < KERNEL_HEAP_ARENA_NUM; ++i) {
+        if (g_kernel_arena_pending & (1UL << i)) {
+            vmrange_t *rng = &g_kernel_arenas[i];
+            ctl->vstart = (rng->vaddr < ctl->vstart) ? rng->vaddr : ctl->vstart;
+            ctl->vend = (rng->vend > ctl->vend) ? rng->vend : ctl->vend;
+            num += vmspace_unmap(&g_kernel_vm, rng, &ctl->pages);
+            g_kernel_arena_defers[i].release = kernel_arena_release;
+            g_kernel_arena_defers[i].next = ctl->defers;
+            ctl->defers = &g_kernel_arena_defers[i];
+        }
+    }
+    g_kernel_arena_pending = 0;
+    return num;
+}
+
+// 需要在 thiscpu_init 之后调用，其他 CPU 启动时会先执行 thiscpu_init
+INIT_TEXT void kernel_heap_cache_enable() {
+    g_heap_cache_on = 1;
+    shrinker_register(&g_heap_shrinker, "heap", heap_shrink);
+}
+
+
 INIT_TEXT void kernel_heap_init(void *buff, size_t size) {
-    ASSERT(NULL == g_kernel_heap.sizetree.root);
+    ASSERT(0 == g_kernel_heap.arena_num);
     ASSERT(NULL != buff);
     heap_init(&g_kernel_heap, buff, size);
+    g_kernel_heap.grow = kernel_heap_grow;
+    g_kernel_heap.release = kernel_heap_release;
 }
 
 MALLOC void *kernel_heap_alloc(size_t size) {
-    ASSERT(NULL != g_kernel_heap.sizetree.root);
-    return heap_alloc(&g_kernel_heap, size);
+    ASSERT(NULL != g_kernel_heap.grow);
+
+    int cls = -1;
+    if (g_heap_cache_on) {
+        cls = mag_class_alloc(size);
+    }
+    if (cls < 0) {
+        return heap_alloc(&g_kernel_heap, size);
+    }
+
+    void *obj = mag_alloc(cls);
+    if (NULL == obj) {
+        // 按尺寸上限分配，释放时才能放回同一个缓存
+        obj = heap_alloc(&g_kernel_heap, g_mag_sizes[cls]);
+    }
+    return obj;
 }
 
 void kernel_heap_free(void *ptr) {
-    ASSERT(NULL != g_kernel_heap.sizetree.root);
-    heap_free(&g_kernel_heap, ptr);
+    ASSERT(NULL != g_kernel_heap.grow);
+
+    int cls = -1;
+    if (g_heap_cache_on) {
+        cls = mag_class_free(ptr);
+    }
+    if (cls < 0) {
+        heap_free(&g_kernel_heap, ptr);
+        return;
+    }
+
+    // 归还堆可能要修改页表，需要在开启中断之后进行
+    magazine_t flush = { NULL, 0 };
+    mag_free(ptr, cls, &flush);
+    while (flush.head) {
+        void *obj = flush.head;
+        flush.head = *(void**)obj;
+        heap_free(&g_kernel_heap, obj);
+    }
 }
 
 // 分配一个字符串
@@ -353,31 +862,47 @@ char *kernel_heap_mkstr(const char *fmt, ...) {
 #ifndef UNIT_TEST
 
 static void dump_heap_state() {
-    size_t used_cnt = 0;
-    size_t used_size = 0;
-    size_t free_size = 0;
+    heap_stats_t stats;
+    heap_get_stats(&g_kernel_heap, &stats);
 
     console_printf("min chunk size %zu\n", sizeof(chunk_t));
+    console_printf("%zu arenas, %zu bytes total\n", stats.arena_num, stats.total);
+    console_printf("%zu allocated objects, %zu bytes used, peak %zu bytes\n",
+        stats.used_cnt, stats.used, stats.peak);
+
+    // 碎片率：空闲空间中不能用于最大一次分配的比例
+    size_t frag = 0;
+    if (stats.free) {
+        frag = 100 - stats.max_free * 100 / stats.free;
+    }
+    console_printf("%zu free chunks, %zu bytes free, largest %zu, fragmentation %zu%%\n",
+        stats.free_cnt, stats.free, stats.max_free, frag);
 
-    // buff、end 之间的范围不含头尾两个 guard chunk
-    char *ptr = g_kernel_heap.buff;
-    console_printf("allocated sizes:");
-    while (ptr < g_kernel_heap.end) {
-        chunk_hdr_t *hdr = (chunk_hdr_t*)ptr;
-        ptr += hdr->selfsize & ~CHUNK_INUSE;
-
-        if (hdr->selfsize & CHUNK_INUSE) {
-            ++used_cnt;
-            used_size += hdr->selfsize & ~CHUNK_INUSE;
-            console_printf("%u,", hdr->selfsize & ~CHUNK_INUSE);
-        } else {
-            free_size += hdr->selfsize & ~CHUNK_INUSE;
-        }
+    if (!g_heap_cache_on) {
+        console_printf("per-cpu magazines disabled\n");
+        return;
     }
-    console_printf("\b.\n");
 
-    console_printf("heap %zu allocated objects, %zu bytes used, %zu bytes free\n",
-        used_cnt, used_size, free_size);
+    console_printf("size:  ");
+    for (int i = 0; i < MAG_CLASS_NUM; ++i) {
+        console_printf(" %4u", g_mag_sizes[i]);
+    }
+    console_printf("\n");
+    for (int i = 0; i < cpu_count(); ++i) {
+        heap_cache_t *cache = PERCPU(i, &g_heap_cache);
+        console_printf("cpu-%-2d:", i);
+        for (int c = 0; c < MAG_CLASS_NUM; ++c) {
+            console_printf(" %4u", cache->loaded[c].count + cache->prev[c].count);
+        }
+        size_t total = cache->hits + cache->misses;
+        size_t rate = total ? (cache->hits * 100 / total) : 0;
+        console_printf("  hit=%zu miss=%zu (%zu%%)\n", cache->hits, cache->misses, rate);
+    }
+    console_printf("depot: ");
+    for (int c = 0; c < MAG_CLASS_NUM; ++c) {
+        console_printf(" %4u", g_depots[c].count * MAG_SIZE);
+    }
+    console_printf("\n");
 }
 
 KSHELL_CMD("heap", dump_heap_state);
@@ -2,20 +2,55 @@
 #define HEAP_H
 
 #include <spinlock.h>
-#include <rbtree.h>
+#include <dllist.h>
 
-typedef struct heap {
+// TLSF 两级索引，第二级把每个 2 的幂区间等分为 16 份
+// 小于 128 字节的 chunk 不再分级，每 8 字节一条链表
+#define HEAP_SL_SHIFT   4
+#define HEAP_SL_COUNT   (1U << HEAP_SL_SHIFT)
+#define HEAP_FL_SHIFT   (HEAP_SL_SHIFT + 3)
+#define HEAP_FL_COUNT   (32 - HEAP_FL_SHIFT + 1)
+
+typedef struct heap heap_t;
+
+// 内存不足时调用 grow 扩容，成功返回非零，之后会重试分配
+// 扩容得到的 arena 完全空闲，就调用 release 归还，此时已从堆中摘除
+typedef int  (*heap_grow_t)(heap_t *heap, size_t size);
+typedef void (*heap_release_t)(heap_t *heap, void *buff, size_t size);
+
+struct heap {
     spinlock_t spin;
-    rbtree_t sizetree;
-    char *buff;
-    char *end;
-} heap_t;
+    uint32_t fl_bitmap;                 // 哪些第一级区间非空
+    uint32_t sl_bitmap[HEAP_FL_COUNT];  // 区间内哪些链表非空
+    dlnode_t lists[HEAP_FL_COUNT][HEAP_SL_COUNT];
+    dlnode_t arenas;    // 组成堆的内存片段，chunk 不会跨越 arena
+    size_t   arena_num;
+    size_t   total;     // 所有 arena 中可分配的字节数
+    size_t   used;      // 已分配 chunk 的字节数，包括 header
+    size_t   peak;      // used 的历史最大值
+    heap_grow_t    grow;
+    heap_release_t release;
+};
+
+typedef struct heap_stats {
+    size_t arena_num;
+    size_t total;
+    size_t used;
+    size_t peak;
+    size_t free;
+    size_t used_cnt;    // 已分配 chunk 数量
+    size_t free_cnt;    // 空闲 chunk 数量
+    size_t max_free;    // 最大的空闲 chunk
+} heap_stats_t;
 
 
 void heap_init(heap_t *heap, void *buff, size_t size);
+int heap_add(heap_t *heap, void *buff, size_t size);
 MALLOC void *heap_alloc(heap_t *heap, size_t size);
 void heap_free(heap_t *heap, void *ptr);
+void heap_get_stats(heap_t *heap, heap_stats_t *stats);
 
+INIT_TEXT void kernel_heap_cache_enable();
 INIT_TEXT void kernel_heap_init(void *buff, size_t size);
 MALLOC void *kernel_heap_alloc(size_t size);
 void kernel_heap_free(void *ptr);
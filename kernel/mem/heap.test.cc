@@ -1,4 +1,6 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
 
 extern "C" {
     #include "heap.h"
@@ -41,7 +43,7 @@ TEST_F(HeapTest, AllocBasic) {
     // 两次分配不重叠
     EXPECT_NE(p1, p2);
     size_t d = (size_t)p1 > (size_t)p2 ? (size_t)p1 - (size_t)p2 : (size_t)p2 - (size_t)p1;
-    EXPECT_GE(d, 48U); // 至少相隔一个 chunk_t
+    EXPECT_GE(d, 24U); // 至少相隔一个最小 chunk
 }
 
 TEST_F(HeapTest, AllocZero) {
@@ -64,17 +66,17 @@ TEST_F(HeapTest, AllocAlignment) {
 //------------------------------------------------------------------------------
 
 TEST_F(HeapTest, AllocMultiple) {
-    void *ptrs[50];
+    void *ptrs[100];
     int count = 0;
 
-    for (int i = 0; i < 50; ++i) {
+    for (int i = 0; i < 100; ++i) {
         ptrs[i] = heap_alloc(&m_heap, 8);
         if (!ptrs[i]) break;
         EXPECT_TRUE(in_range(ptrs[i]));
         ++count;
     }
     EXPECT_GT(count, 10);  // 至少能分配十几个
-    EXPECT_LT(count, 50);  // 不可能全部分配
+    EXPECT_LT(count, 100); // 不可能全部分配
 
     // 释放后还能继续分配
     heap_free(&m_heap, ptrs[0]);
@@ -277,3 +279,132 @@ TEST_F(HeapTest, DoubleFreeSafe) {
     // heap_free(&m_heap, p); // 不应调用
     SUCCEED();  // 不做 double-free 是为了不崩溃
 }
+
+//------------------------------------------------------------------------------
+// 多个 arena，自动扩容和归还
+//------------------------------------------------------------------------------
+
+static std::vector<void*> g_grown;
+static std::vector<void*> g_released;
+
+static int test_grow(heap_t *heap, size_t size) {
+    size_t n = std::max<size_t>(size * 2, 1024);
+    void *buff = malloc(n);
+    g_grown.push_back(buff);
+    return heap_add(heap, buff, n);
+}
+
+static void test_release(heap_t *heap, void *buff, size_t size) {
+    (void)heap;
+    (void)size;
+    g_released.push_back(buff);
+    free(buff);
+}
+
+TEST(HeapArena, Stats) {
+    uint8_t buff[BUF_SIZE];
+    heap_t heap;
+    heap_init(&heap, buff, sizeof(buff));
+
+    heap_stats_t st;
+    heap_get_stats(&heap, &st);
+    EXPECT_EQ(1U, st.arena_num);
+    EXPECT_EQ(0U, st.used);
+    EXPECT_EQ(st.total, st.free);
+    EXPECT_EQ(st.total, st.max_free);
+    EXPECT_EQ(1U, st.free_cnt);
+
+    void *a = heap_alloc(&heap, 100);
+    void *b = heap_alloc(&heap, 100);
+    void *c = heap_alloc(&heap, 100);
+    heap_free(&heap, b);
+    heap_get_stats(&heap, &st);
+    EXPECT_EQ(2U, st.used_cnt);
+    EXPECT_EQ(2U, st.free_cnt);     // 中间空洞，以及末尾剩余部分
+    EXPECT_LT(st.max_free, st.free);
+    EXPECT_EQ(st.total, st.used + st.free);
+
+    heap_free(&heap, a);
+    heap_free(&heap, c);
+    heap_get_stats(&heap, &st);
+    EXPECT_EQ(0U, st.used);
+    EXPECT_GE(st.peak, 300U);       // 峰值保留
+}
+
+TEST(HeapArena, GrowAndRelease) {
+    g_grown.clear();
+    g_released.clear();
+
+    heap_t heap;
+    heap_init(&heap, NULL, 0); // 空堆，全部依靠扩容
+    heap.grow = test_grow;
+    heap.release = test_release;
+
+    // 分配总量远大于单个 arena
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 200; ++i) {
+        void *p = heap_alloc(&heap, 64);
+        ASSERT_NE(nullptr, p);
+        kmemset(p, i, 64);
+        ptrs.push_back(p);
+    }
+    void *big = heap_alloc(&heap, 5000);
+    ASSERT_NE(nullptr, big);
+    kmemset(big, 0xff, 5000);
+
+    heap_stats_t st;
+    heap_get_stats(&heap, &st);
+    EXPECT_GT(st.arena_num, 1U);
+    EXPECT_EQ(g_grown.size(), st.arena_num);
+    EXPECT_EQ(201U, st.used_cnt);
+
+    // 全部释放，空闲的 arena 被归还，最后剩下的那个不足以覆盖自身的四分之一
+    for (void *p : ptrs) {
+        heap_free(&heap, p);
+    }
+    heap_free(&heap, big);
+    heap_get_stats(&heap, &st);
+    EXPECT_EQ(0U, st.used);
+    EXPECT_EQ(1U, st.arena_num);
+    EXPECT_EQ(g_grown.size() - 1, g_released.size());
+
+    // 剩余的 arena 仍然可用
+    void *p = heap_alloc(&heap, 64);
+    ASSERT_NE(nullptr, p);
+    heap_free(&heap, p);
+
+    for (void *buff : g_grown) {
+        if (std::find(g_released.begin(), g_released.end(), buff) == g_released.end()) {
+            free(buff);
+        }
+    }
+}
+
+// 超过单个 arena 容量的请求直接失败，不会触发扩容
+TEST(HeapArena, HugeAllocNoGrow) {
+    g_grown.clear();
+
+    heap_t heap;
+    heap_init(&heap, NULL, 0);
+    heap.grow = test_grow;
+    heap.release = test_release;
+
+    EXPECT_EQ(nullptr, heap_alloc(&heap, (size_t)UINT32_MAX));
+    EXPECT_EQ(nullptr, heap_alloc(&heap, (size_t)-1));
+    EXPECT_TRUE(g_grown.empty());
+}
+
+// 不属于堆的指针，释放时忽略
+TEST(HeapArena, FreeForeign) {
+    uint8_t buff[BUF_SIZE];
+    uint8_t other[64];
+    heap_t heap;
+    heap_init(&heap, buff, sizeof(buff));
+
+    heap_free(&heap, other + 16);
+
+    heap_stats_t st;
+    heap_get_stats(&heap, &st);
+    EXPECT_EQ(0U, st.used);
+    EXPECT_EQ(1U, st.free_cnt);
+}
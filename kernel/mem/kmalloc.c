@@ -0,0 +1,143 @@
+#include "kmalloc.h"
+#include "pool_slub.h"
+#include "vmspace.h"
+#include <arch_api.h>
+#include <debug.h>
+
+#include <kshell.h>
+#include <console.h>
+
+
+// 通用的内存分配，不需要像 kclass 那样预先注册对象类型
+// 不超过 2048 字节的对象来自一组不同尺寸的内存池，分配释放都只涉及一个 slab
+// 内存池的编号写在 slab 的页描述符里，释放时由地址找到页描述符，不需要传入大小
+// 更大的对象直接从 g_kernel_vm 分配，释放时查找所在的 vmrange
+//
+// kernel_heap_mkstr 生成的名称字符串仍然来自内核堆，长度不定、很少释放，
+// 而且 percpu 初始化时就要使用，早于 kmalloc_init
+
+#define KMALLOC_CLASS_NUM   11
+
+static const uint16_t g_kmalloc_sizes[KMALLOC_CLASS_NUM] = {
+    8, 16, 32, 64, 96, 128, 192, 256, 512, 1024, 2048
+};
+
+static const char *g_kmalloc_names[KMALLOC_CLASS_NUM] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-96", "kmalloc-128",
+    "kmalloc-192", "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+
+static pool_t g_kmalloc_pools[KMALLOC_CLASS_NUM];
+
+
+INIT_TEXT void kmalloc_init() {
+    for (int i = 0; i < KMALLOC_CLASS_NUM; ++i) {
+        // 按尺寸的最低位对齐，96 按 32 对齐，192 按 64 对齐，其余按自身对齐
+        size_t size = g_kmalloc_sizes[i];
+        size_t align = size & -size;
+        pool_init_align(&g_kmalloc_pools[i], g_kmalloc_names[i], size, align);
+        g_kmalloc_pools[i].tag = (uint8_t)(i + 1); // 零表示不属于 kmalloc
+    }
+}
+
+// 能容纳 size 字节的最小尺寸编号，超过 2048 字节返回 -1
+int kmalloc_class(size_t size) {
+    for (int i = 0; i < KMALLOC_CLASS_NUM; ++i) {
+        if (size <= g_kmalloc_sizes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+size_t kmalloc_class_size(int cls) {
+    ASSERT((cls >= 0) && (cls < KMALLOC_CLASS_NUM));
+    return g_kmalloc_sizes[cls];
+}
+
+// 根据地址找到对象的尺寸编号，大对象返回 -1
+// 小对象位于 guarded-idmap，slab 页描述符的 tag 就是编号加一
+int kmalloc_ptr_class(const void *ptr) {
+    if (((size_t)ptr >= DYNAMIC_ZONE_START) && ((size_t)ptr < DYNAMIC_ZONE_END)) {
+        return -1;
+    }
+
+    uint32_t slab = pool_obj_slab(ptr);
+    ASSERT(PT_POOL == g_pages[slab].type);
+    uint32_t tag = g_pages[slab].tag;
+    ASSERT((tag > 0) && (tag <= KMALLOC_CLASS_NUM));
+    return (int)tag - 1;
+}
+
+static void *large_alloc(size_t size) {
+    vmrange_t *rng = kmalloc(sizeof(vmrange_t));
+    if (NULL == rng) {
+        return NULL;
+    }
+
+    void *va = vmspace_alloc(&g_kernel_vm, rng, size, PT_KERNEL, MMU_WRITE);
+    if (NULL == va) {
+        kfree(rng);
+        return NULL;
+    }
+    rng->desc = "kmalloc";
+    return va;
+}
+
+// 先让其他 CPU 清除映射，再删除范围，否则其他 CPU 仍可能访问到已经释放的物理页
+// 需要执行 tlb-shootdown，必须开中断，不能在中断里调用
+static void large_free(void *ptr) {
+    vmrange_t *rng = vmspace_lookup(&g_kernel_vm, (size_t)ptr);
+    ASSERT(NULL != rng);
+    ASSERT(rng->vaddr == (size_t)ptr);
+    ASSERT(tlb_may_shootdown());
+    tlb_shootdown(rng->vaddr, rng->vend);
+    vmspace_remove(&g_kernel_vm, rng);
+    kfree(rng);
+}
+
+MALLOC void *kmalloc(size_t size) {
+    int idx = kmalloc_class(size);
+    if (idx < 0) {
+        return large_alloc(size);
+    }
+
+    return pool_alloc(&g_kmalloc_pools[idx]);
+}
+
+void kfree(void *ptr) {
+    if (NULL == ptr) {
+        return;
+    }
+
+    int idx = kmalloc_ptr_class(ptr);
+    if (idx < 0) {
+        large_free(ptr);
+        return;
+    }
+
+    pool_free(&g_kmalloc_pools[idx], ptr);
+}
+
+//------------------------------------------------------------------------------
+// 调试命令，显示每个尺寸的 slab 数量和使用率
+//------------------------------------------------------------------------------
+
+#ifndef UNIT_TEST
+
+static void show_kmalloc() {
+    for (int i = 0; i < KMALLOC_CLASS_NUM; ++i) {
+        pool_t *pool = &g_kmalloc_pools[i];
+        uint32_t slabs;
+        size_t inuse;
+        size_t bytes;
+        pool_usage(pool, &slabs, &inuse, &bytes);
+        size_t total = bytes / pool->obj_size;
+        console_printf("kmalloc-%-4u slabs %u, objects %zu/%zu\n",
+            g_kmalloc_sizes[i], slabs, inuse, total);
+    }
+}
+
+KSHELL_CMD("kmalloc", show_kmalloc);
+
+#endif // UNIT_TEST
@@ -0,0 +1,14 @@
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include <wheel.h>
+
+INIT_TEXT void kmalloc_init();
+MALLOC void *kmalloc(size_t size);
+void kfree(void *ptr); // 大对象释放需要 tlb-shootdown，必须开中断
+
+int kmalloc_class(size_t size);
+size_t kmalloc_class_size(int cls);
+int kmalloc_ptr_class(const void *ptr);
+
+#endif // KMALLOC_H
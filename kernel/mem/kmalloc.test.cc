@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include "page.mock.h"
+
+extern "C" {
+    #include "kmalloc.h"
+    #include "page.h"
+    #include <arch_config.h>
+}
+
+// 每个尺寸的上限落在自身，多一个字节就进入下一个尺寸
+TEST(Kmalloc, ClassBoundary) {
+    EXPECT_EQ(kmalloc_class(1), 0);
+    EXPECT_EQ(kmalloc_class(8), 0);
+    EXPECT_EQ(kmalloc_class_size(0), 8U);
+    EXPECT_EQ(kmalloc_class(9), 1);
+
+    EXPECT_EQ(kmalloc_class_size(kmalloc_class(96)), 96U);
+    EXPECT_EQ(kmalloc_class_size(kmalloc_class(97)), 128U);
+
+    int last = kmalloc_class(2048);
+    ASSERT_GE(last, 0);
+    EXPECT_EQ(kmalloc_class_size(last), 2048U);
+    EXPECT_EQ(kmalloc_class(2047), last);
+
+    // 超过 2048 字节，直接从 g_kernel_vm 分配
+    EXPECT_EQ(kmalloc_class(2049), -1);
+    EXPECT_EQ(kmalloc_class(1 << 20), -1);
+}
+
+// 释放时不传入大小，由 slab 页描述符的 tag 找到尺寸
+TEST(Kmalloc, ClassFromTag) {
+    PageContext pc(64);
+
+    size_t pa = page_alloc(1, PT_POOL);
+    ASSERT_NE(pa, 0U);
+    g_pages[pa >> PAGE_SHIFT].tag = 5;
+
+    // 对象可以位于多页 slab 的任意位置
+    size_t va = GUARDED_IDMAP_ADDR + pa * 2;
+    EXPECT_EQ(kmalloc_ptr_class((void*)(va + 24)), 4);
+    EXPECT_EQ(kmalloc_ptr_class((void*)(va + PAGE_SIZE + 24)), 4);
+
+    // 动态分配区域的地址是大对象
+    EXPECT_EQ(kmalloc_ptr_class((void*)(DYNAMIC_ZONE_START + PAGE_SIZE)), -1);
+
+    g_pages[pa >> PAGE_SHIFT].tag = 0;
+    page_free(pa);
+}
@@ -0,0 +1,198 @@
+#include "kstack.h"
+#include "shrinker.h"
+#include <arch_api.h>
+#include <spinlock.h>
+#include <debug.h>
+
+#include <kshell.h>
+#include <console.h>
+
+
+// 内核栈缓存，任务频繁创建、退出时避免分配物理页、修改页表、tlb-shootdown
+//
+// 任务退出后，内核栈不解除映射，放入当前 CPU 的缓存，下次创建任务直接取用
+// 缓存的栈两侧仍然是 guard page，映射始终有效，其他 CPU 的 TLB 条目不会过期
+// 描述这段范围的 vmrange 放在 percpu 的节点数组中，所有 CPU 的节点组成一个空闲链表
+//
+// 是否缓存必须在 task_exit 里决定，不缓存的栈需要在这里执行 tlb-shootdown
+// 析构函数可能在 work 中执行，那时已经不能 shootdown 了
+// 所以退出时先预留一个位置（kstack_reserve），析构时一定能放进缓存
+// 预留和缓存的总数不超过 KSTACK_CACHE_PER_CPU * cpu_count()
+//
+// 内存不足时 shrinker 清空所有 CPU 的缓存，由 shrink_all 统一 shootdown 之后释放
+// 栈解除映射之后地址仍然保留，shootdown 之后才删除范围、归还节点
+// 节点归还之前仍然计入总数，因此节点总数等于缓存上限，不会不够用
+
+
+#define KSTACK_CACHE_PER_CPU 8
+
+typedef struct kstack_node {
+    vmrange_t      rng;
+    shrink_defer_t defer;
+    struct kstack_node *next;
+} kstack_node_t;
+
+typedef struct kstack_cache {
+    spinlock_t     lock;    // shrinker 可能访问其他 CPU 的缓存
+    kstack_node_t *head;
+    int            num;
+    size_t         hits;
+    size_t         misses;
+    kstack_node_t  nodes[KSTACK_CACHE_PER_CPU];
+} kstack_cache_t;
+
+// percpu 需要在 thiscpu_init 之后才能访问
+// 单元测试没有 percpu，缓存始终关闭
+static CONST int g_kstack_max = 0;
+static PERCPU_BSS kstack_cache_t g_kstack_cache;
+static _Atomic int g_kstack_num = 0;    // 缓存、预留和等待 shootdown 的总数
+static shrinker_t g_kstack_shrinker;
+
+static spinlock_t g_kstack_spare_lock = SPINLOCK_INIT;
+static kstack_node_t *g_kstack_spare = NULL;
+
+
+static kstack_node_t *spare_take() {
+    SPINLOCK_SCOPED(&g_kstack_spare_lock);
+    kstack_node_t *node = g_kstack_spare;
+    ASSERT(NULL != node);
+    g_kstack_spare = node->next;
+    return node;
+}
+
+static void spare_put(kstack_node_t *node) {
+    SPINLOCK_SCOPED(&g_kstack_spare_lock);
+    node->next = g_kstack_spare;
+    g_kstack_spare = node;
+}
+
+
+// 优先取当前 CPU 缓存的栈，没有才分配新的，成功返回 1
+int kstack_alloc(vmrange_t *rng) {
+    if (g_kstack_max) {
+        kstack_node_t *node = NULL;
+        {
+            kstack_cache_t *cache = THISCPU(&g_kstack_cache);
+            SPINLOCK_SCOPED(&cache->lock);
+            node = cache->head;
+            if (node) {
+                cache->head = node->next;
+                --cache->num;
+                ++cache->hits;
+            } else {
+                ++cache->misses;
+            }
+        }
+        if (node) {
+            vmspace_move(&g_kernel_vm, rng, &node->rng);
+            spare_put(node);
+            atomic_fetch_sub(&g_kstack_num, 1);
+            return 1;
+        }
+    }
+    return NULL != vmspace_alloc_kstack(&g_kernel_vm, rng);
+}
+
+// 任务退出时调用，返回 1 表示析构时可以放入缓存，不用 tlb-shootdown
+int kstack_reserve() {
+    int num = atomic_load(&g_kstack_num);
+    while (num < g_kstack_max) {
+        if (atomic_compare_exchange_weak(&g_kstack_num, &num, num + 1)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 栈已经不再使用，reserved 是 kstack_reserve 的返回值
+// 没有预留则退出时已经执行过 tlb-shootdown，直接释放
+void kstack_free(vmrange_t *rng, int reserved) {
+    if (!reserved) {
+        vmspace_remove(&g_kernel_vm, rng);
+        return;
+    }
+
+    kstack_node_t *node = spare_take();
+    vmspace_move(&g_kernel_vm, &node->rng, rng);
+    node->rng.desc = "kstack cache";
+
+    kstack_cache_t *cache = THISCPU(&g_kstack_cache);
+    SPINLOCK_SCOPED(&cache->lock);
+    node->next = cache->head;
+    cache->head = node;
+    ++cache->num;
+}
+
+// shrink_all 执行 tlb-shootdown 之后调用，这段地址可以重新分配了
+static void kstack_release(shrink_defer_t *defer) {
+    kstack_node_t *node = containerof(defer, kstack_node_t, defer);
+    vmspace_release(&g_kernel_vm, &node->rng);
+    spare_put(node);
+    atomic_fetch_sub(&g_kstack_num, 1);
+}
+
+// 清空所有 CPU 的缓存，解除映射的物理页交给 shrink_all 释放
+// 范围暂时保留，shootdown 之后才删除
+static uint32_t kstack_shrink(shrinker_t *self UNUSED, shrink_ctl_t *ctl) {
+    uint32_t num = 0;
+    for (int i = 0; i < cpu_count(); ++i) {
+        kstack_cache_t *cache = PERCPU(i, &g_kstack_cache);
+        kstack_node_t *node;
+        {
+            SPINLOCK_SCOPED(&cache->lock);
+            node = cache->head;
+            cache->head = NULL;
+            cache->num = 0;
+        }
+
+        while (node) {
+            kstack_node_t *next = node->next;
+            num += vmspace_unmap(&g_kernel_vm, &node->rng, &ctl->pages);
+            ctl->vstart = (node->rng.vaddr < ctl->vstart) ? node->rng.vaddr : ctl->vstart;
+            ctl->vend = (node->rng.vend > ctl->vend) ? node->rng.vend : ctl->vend;
+            node->defer.release = kstack_release;
+            node->defer.next = ctl->defers;
+            ctl->defers = &node->defer;
+            node = next;
+        }
+    }
+    return num;
+}
+
+// 需要在 thiscpu_init 之后调用
+INIT_TEXT void kstack_cache_enable() {
+    for (int i = 0; i < cpu_count(); ++i) {
+        kstack_cache_t *cache = PERCPU(i, &g_kstack_cache);
+        for (int j = 0; j < KSTACK_CACHE_PER_CPU; ++j) {
+            spare_put(&cache->nodes[j]);
+        }
+    }
+    g_kstack_max = KSTACK_CACHE_PER_CPU * cpu_count();
+    shrinker_register(&g_kstack_shrinker, "kstack", kstack_shrink);
+}
+
+//------------------------------------------------------------------------------
+// 调试命令，显示每个 CPU 缓存的内核栈
+//------------------------------------------------------------------------------
+
+#ifndef UNIT_TEST
+
+static void show_kstacks() {
+    if (!g_kstack_max) {
+        console_printf("kstack cache disabled\n");
+        return;
+    }
+    console_printf("kstack cache: %d/%d (including reserved)\n",
+        atomic_load(&g_kstack_num), g_kstack_max);
+    for (int i = 0; i < cpu_count(); ++i) {
+        kstack_cache_t *cache = PERCPU(i, &g_kstack_cache);
+        size_t total = cache->hits + cache->misses;
+        size_t rate = total ? (cache->hits * 100 / total) : 0;
+        console_printf("cpu-%-2d: %d cached, hit=%zu miss=%zu (%zu%%)\n",
+            i, cache->num, cache->hits, cache->misses, rate);
+    }
+}
+
+KSHELL_CMD("kstack", show_kstacks);
+
+#endif // UNIT_TEST
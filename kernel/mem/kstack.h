@@ -0,0 +1,12 @@
+#ifndef KSTACK_H
+#define KSTACK_H
+
+#include <wheel.h>
+#include "vmspace.h"
+
+INIT_TEXT void kstack_cache_enable();
+int  kstack_alloc(vmrange_t *rng);
+int  kstack_reserve();
+void kstack_free(vmrange_t *rng, int reserved);
+
+#endif // KSTACK_H
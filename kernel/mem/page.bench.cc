@@ -0,0 +1,386 @@
+// 页分配器性能测试，多线程调用真实的 page.c
+// 每个 (模式, 接口) 输出一行 JSON，每个模式再输出一行总数和吞吐量
+// 只报告耗时，不判断快慢，正确性由 kunit 检查
+
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "early_alloc.mock.h"
+#include "page.mock.h"
+#include "kbench.h"
+
+extern "C" {
+    #include "page.h"
+    #include <arch_api.h>
+}
+
+
+enum Api {
+    API_ALLOC,
+    API_COLOR,
+    API_LIST,
+    API_FREE,
+    API_LIST_FREE,
+    API_NUM
+};
+
+static const char *g_api_names[API_NUM] = {
+    "page_alloc",
+    "page_alloc_color",
+    "pagelist_alloc",
+    "page_free",
+    "pagelist_free",
+};
+
+// 一次分配的结果，块或者链表
+struct Alloc {
+    uint32_t blk;   // 块分配的起始页号，链表为 0
+    pglist_t pl;
+};
+
+struct Worker {
+    std::mt19937 rng;
+    std::vector<uint32_t> lat[API_NUM]; // 每次调用的耗时，纳秒
+    size_t fails[API_NUM] = {};  // 内存不足导致的分配失败，不算错误
+    size_t errors = 0;  // 重复分配等一致性错误
+};
+
+static uint32_t g_page_num;
+static std::vector<std::atomic<uint8_t>> *g_owned; // 每个页是否已被分配
+
+
+//------------------------------------------------------------------------------
+// 分配结果检查，不计入耗时
+//------------------------------------------------------------------------------
+
+static void mark_block(Worker &w, uint32_t blk, uint8_t val) {
+    uint32_t size = 1U << g_pages[blk].rank;
+    for (uint32_t i = 0; i < size; ++i) {
+        if ((*g_owned)[blk + i].exchange(val) == val) {
+            ++w.errors; // 分配了已分配的页，或者释放了空闲页
+        }
+    }
+}
+
+static void mark(Worker &w, const Alloc &a, uint8_t val) {
+    if (a.blk) {
+        mark_block(w, a.blk, val);
+        return;
+    }
+    for (uint32_t blk = a.pl.head; blk; blk = g_pages[blk].next) {
+        mark_block(w, blk, val);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// 计时调用
+//------------------------------------------------------------------------------
+
+// 随机选择一个分配接口，rank 不超过 max_rank
+static bool do_alloc(Worker &w, Alloc &a, uint32_t max_rank) {
+    uint32_t rank = w.rng() % (max_rank + 1);
+    a.blk = 0;
+    a.pl.head = 0;
+    a.pl.tail = 0;
+
+    int api = (int)(w.rng() % 3);
+    BenchClock::time_point t0 = BenchClock::now();
+    switch (api) {
+    case API_ALLOC:
+        a.blk = (uint32_t)(page_alloc(rank, PT_KERNEL) >> PAGE_SHIFT);
+        w.lat[API_ALLOC].push_back(bench_elapsed(t0));
+        break;
+    case API_COLOR: {
+        uint32_t period = 1U << (rank + w.rng() % 4);
+        uint32_t phase = (w.rng() % period) & ~((1U << rank) - 1);
+        t0 = BenchClock::now();
+        a.blk = (uint32_t)(page_alloc_color(rank, PT_KERNEL, period, phase) >> PAGE_SHIFT);
+        w.lat[API_COLOR].push_back(bench_elapsed(t0));
+        break;
+    }
+    default: {
+        uint32_t num = 1 + w.rng() % 64;
+        t0 = BenchClock::now();
+        int ok = pagelist_alloc(&a.pl, num, PT_KERNEL);
+        w.lat[API_LIST].push_back(bench_elapsed(t0));
+        if (!ok) {
+            ++w.fails[API_LIST];
+            return false;
+        }
+        mark(w, a, 1);
+        return true;
+    }
+    }
+
+    if (0 == a.blk) {
+        ++w.fails[api];
+        return false;
+    }
+    mark(w, a, 1);
+    return true;
+}
+
+static void do_free(Worker &w, Alloc &a) {
+    mark(w, a, 0);
+    BenchClock::time_point t0 = BenchClock::now();
+    if (a.blk) {
+        page_free((size_t)a.blk << PAGE_SHIFT);
+        w.lat[API_FREE].push_back(bench_elapsed(t0));
+    } else {
+        pagelist_free(&a.pl);
+        w.lat[API_LIST_FREE].push_back(bench_elapsed(t0));
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// 分配模式，每个线程独立运行，共享同一个页分配器
+//------------------------------------------------------------------------------
+
+#define LIVE_MAX 128    // 每个线程最多同时持有的分配数量
+#define BATCH    64     // LIFO、FIFO 每批的数量
+
+// 分配和释放随机交替，释放的对象随机选择
+static void run_random(Worker &w, size_t ops, uint32_t max_rank) {
+    std::vector<Alloc> live;
+    for (size_t i = 0; i < ops; ++i) {
+        if (live.empty() || ((live.size() < LIVE_MAX) && (w.rng() & 1))) {
+            Alloc a;
+            if (do_alloc(w, a, max_rank)) {
+                live.push_back(a);
+            }
+        } else {
+            size_t idx = w.rng() % live.size();
+            std::swap(live[idx], live.back());
+            do_free(w, live.back());
+            live.pop_back();
+        }
+    }
+    for (Alloc &a : live) {
+        do_free(w, a);
+    }
+}
+
+// 连续分配一批，再按相反顺序释放
+static void run_lifo(Worker &w, size_t ops, uint32_t max_rank) {
+    std::vector<Alloc> live;
+    for (size_t i = 0; i < ops; i += 2 * BATCH) {
+        for (int j = 0; j < BATCH; ++j) {
+            Alloc a;
+            if (do_alloc(w, a, max_rank)) {
+                live.push_back(a);
+            }
+        }
+        while (!live.empty()) {
+            do_free(w, live.back());
+            live.pop_back();
+        }
+    }
+}
+
+// 队列，持有的数量超过一批就释放最早的分配
+static void run_fifo(Worker &w, size_t ops, uint32_t max_rank) {
+    std::vector<Alloc> ring(BATCH);
+    std::vector<bool> used(BATCH, false);
+    size_t head = 0;
+    for (size_t i = 0; i < ops / 2; ++i) {
+        if (used[head]) {
+            do_free(w, ring[head]);
+            used[head] = false;
+        }
+        used[head] = do_alloc(w, ring[head], max_rank);
+        head = (head + 1) % BATCH;
+    }
+    for (size_t i = 0; i < BATCH; ++i) {
+        if (used[i]) {
+            do_free(w, ring[i]);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// 统计输出
+//------------------------------------------------------------------------------
+
+struct Pattern {
+    const char *name;
+    void (*run)(Worker &w, size_t ops, uint32_t max_rank);
+    bool fragment;  // 运行之前把内存打碎，每两个页占用一个
+};
+
+static const Pattern g_patterns[] = {
+    { "random",   run_random, false },
+    { "lifo",     run_lifo,   false },
+    { "fifo",     run_fifo,   false },
+    { "fragment", run_random, true  },
+};
+
+// 返回一致性错误数量
+static size_t run_pattern(const Pattern &pat, int nthreads, size_t ops) {
+    clear_early_chunks();
+    PageContext ctx(g_page_num);
+    std::vector<std::atomic<uint8_t>> owned(g_page_num + 1);
+    g_owned = &owned;
+    uint32_t nfree = page_free_count();
+
+    // 碎片化，所有单页分配出去，再释放奇数页
+    std::vector<size_t> pinned;
+    uint32_t max_rank = 3;
+    if (pat.fragment) {
+        std::vector<size_t> pages;
+        while (size_t pa = page_alloc(0, PT_KERNEL)) {
+            pages.push_back(pa);
+        }
+        for (size_t pa : pages) {
+            if ((pa >> PAGE_SHIFT) & 1) {
+                page_free(pa);
+            } else {
+                pinned.push_back(pa);
+            }
+        }
+        max_rank = 0; // 只剩单页可用
+    }
+
+    std::vector<Worker> workers(nthreads);
+    std::vector<std::thread> threads;
+    BenchClock::time_point t0 = BenchClock::now();
+    for (int i = 0; i < nthreads; ++i) {
+        workers[i].rng.seed((unsigned)i + 1);
+        threads.emplace_back(pat.run, std::ref(workers[i]), ops, max_rank);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    double secs = std::chrono::duration<double>(BenchClock::now() - t0).count();
+
+    for (size_t pa : pinned) {
+        page_free(pa);
+    }
+
+    size_t errors = 0;
+    for (Worker &w : workers) {
+        errors += w.errors;
+    }
+    if (page_free_count() != nfree) {
+        ++errors; // 有页丢失
+    }
+
+    // 每个接口一行，只包含这个接口自己的调用次数、延迟和失败次数
+    size_t calls = 0;
+    size_t fails = 0;
+    for (int api = 0; api < API_NUM; ++api) {
+        std::vector<uint32_t> all;
+        size_t api_fails = 0;
+        for (Worker &w : workers) {
+            all.insert(all.end(), w.lat[api].begin(), w.lat[api].end());
+            api_fails += w.fails[api];
+        }
+        calls += all.size();
+        fails += api_fails;
+        if (all.empty()) {
+            continue;
+        }
+        printf("{\"bench\":\"page\",\"pattern\":\"%s\",\"api\":\"%s\",\"threads\":%d,"
+            "\"calls\":%zu,\"p50_ns\":%u,\"p99_ns\":%u,\"fails\":%zu}\n",
+            pat.name, g_api_names[api], nthreads, all.size(),
+            bench_percentile(all, 50), bench_percentile(all, 99), api_fails);
+    }
+
+    // 整个模式一行，吞吐量是所有接口的调用总数除以墙钟时间
+    printf("{\"bench\":\"page\",\"pattern\":\"%s\",\"threads\":%d,"
+        "\"calls\":%zu,\"secs\":%.3f,\"ops_per_sec\":%.0f,\"fails\":%zu,\"errors\":%zu}\n",
+        pat.name, nthreads, calls, secs, (double)calls / secs, fails, errors);
+
+    g_owned = nullptr;
+    return errors;
+}
+
+
+//------------------------------------------------------------------------------
+// 块头查找，对比逐页回溯的方法，在最大的块（rank-15）上抽样
+//------------------------------------------------------------------------------
+
+static void bench_block_head() {
+    const uint32_t start = 0x10000;
+    const uint32_t end = 0x18000;
+    clear_early_chunks();
+    page_init((size_t)start << PAGE_SHIFT, (size_t)end << PAGE_SHIFT);
+    pages_add((size_t)start << PAGE_SHIFT, (size_t)end << PAGE_SHIFT);
+
+    const uint32_t step = 31;
+    const size_t n = (end - start + step - 1) / step;
+    uint64_t sum_linear = 0;  // 累加结果，防止循环被优化掉
+    uint64_t sum_fast = 0;
+
+    BenchClock::time_point t0 = BenchClock::now();
+    for (uint32_t pfn = start; pfn < end; pfn += step) {
+        uint32_t head = pfn;
+        while (!g_pages[head].head) --head;
+        sum_linear += head;
+    }
+    BenchClock::time_point t1 = BenchClock::now();
+    for (uint32_t pfn = start; pfn < end; pfn += step) {
+        sum_fast += page_block_head(pfn);
+    }
+    BenchClock::time_point t2 = BenchClock::now();
+
+    auto ns = [](BenchClock::time_point a, BenchClock::time_point b) {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count();
+    };
+    printf("{\"bench\":\"page\",\"case\":\"block_head\",\"samples\":%zu,"
+        "\"linear_ns\":%.1f,\"aligned_ns\":%.1f,\"same\":%s}\n",
+        n, ns(t0, t1) / (double)n, ns(t1, t2) / (double)n,
+        (sum_linear == sum_fast) ? "true" : "false");
+}
+
+// 内存严重碎片化时着色分配的耗时，只有 1/64 的空闲页满足颜色要求
+static void bench_color_fragmented() {
+    const uint32_t start = 0x10000;
+    const uint32_t end = 0x30000;
+    clear_early_chunks();
+    page_init((size_t)start << PAGE_SHIFT, (size_t)end << PAGE_SHIFT);
+    pages_add((size_t)start << PAGE_SHIFT, (size_t)end << PAGE_SHIFT);
+
+    // 每两个页释放一个，得到大量无法合并的 rank-0 空闲块
+    std::vector<size_t> pages;
+    while (size_t pa = page_alloc(0, PT_FS)) {
+        pages.push_back(pa);
+    }
+    for (size_t pa : pages) {
+        if ((pa >> PAGE_SHIFT) & 1) {
+            page_free(pa);
+        }
+    }
+
+    const uint32_t period = 0x80;
+    const uint32_t count = page_free_count() * 2 / period;
+    std::vector<uint32_t> lat;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t phase = (2 * i + 1) & (period - 1);
+        BenchClock::time_point t0 = BenchClock::now();
+        page_alloc_color(0, PT_FS, period, phase);
+        lat.push_back(bench_elapsed(t0));
+    }
+    bench_report("page", "color_fragmented", "page_alloc_color", lat);
+}
+
+KBENCH(page) {
+    g_page_num = opt.pages;
+    bench_block_head();
+    bench_color_fragmented();
+
+    // 单线程结果反映算法本身，多线程结果反映锁竞争
+    size_t errors = 0;
+    for (const Pattern &pat : g_patterns) {
+        errors += run_pattern(pat, 1, opt.ops);
+        if (opt.threads > 1) {
+            errors += run_pattern(pat, opt.threads, opt.ops);
+        }
+    }
+    return errors;
+}
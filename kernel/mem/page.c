@@ -1,5 +1,6 @@
 #include "page.h"
 #include "early_alloc.h"
+#include "shrinker.h"
 #include <arch_api.h>
 #include <kstring.h>
 #include <spinlock.h>
@@ -15,8 +16,101 @@ CONST page_t *g_pages;
 
 static _Atomic uint32_t g_free_cnt = 0;
 
+// per-CPU 缓存和清零池中的页，对伙伴系统而言是已分配状态，但随时可以归还
+// 水位线检查把这些页也算作空闲，内存紧张时由 shrinker 归还到伙伴系统
+static _Atomic uint32_t g_cached_cnt = 0;
+
+// 每个 rank 的空闲块按颜色分成多条链表，用 bitmap 记录哪些颜色非空
+// 块的颜色是起始页号在 rank 之上的若干位，即 (blk >> rank) % PAGE_COLOR_NUM
+// 分配指定颜色的块只需检查 bitmap，不必遍历整个 free-list
+#define PAGE_COLOR_SHIFT    6
+#define PAGE_COLOR_NUM      (1U << PAGE_COLOR_SHIFT)
+
+typedef struct free_area {
+    uint64_t colors;                    // 非空链表的 bitmap
+    pglist_t lists[PAGE_COLOR_NUM];
+} free_area_t;
+
 static spinlock_t g_page_spin = SPINLOCK_INIT;
-static pglist_t g_blocks[PAGE_BLOCK_RANK_NUM];
+static free_area_t g_blocks[PAGE_NODE_NUM][PAGE_BLOCK_RANK_NUM];
+static uint32_t g_node_free[PAGE_NODE_NUM];  // guarded by g_page_spin
+
+
+// NUMA 节点，每个节点有独立的空闲块索引，伙伴块不会跨越节点
+// 分配时优先使用当前 CPU 所在节点，不足时按距离由近到远回退
+// 页表、内核栈都由使用它的 CPU 分配，自然来自本地节点，因此不提供指定节点的接口
+// 单元测试和没有 SRAT 的机器只有一个节点
+static CONST int g_node_num = 1;
+static CONST uint8_t g_node_distance[PAGE_NODE_NUM][PAGE_NODE_NUM];
+static CONST uint8_t g_node_order[PAGE_NODE_NUM][PAGE_NODE_NUM]; // 回退顺序，第一个是自身
+
+// percpu 可用之后才能查询当前 CPU 所在节点
+static CONST int g_numa_on = 0;
+static PERCPU_BSS int g_this_node;
+
+static inline int this_node() {
+    return g_numa_on ? *THISCPU(&g_this_node) : 0;
+}
+
+
+// per-CPU 页缓存，缓存 rank 0~3 的小块，大部分单页分配无需获取 g_page_spin
+// 缓存中的块对伙伴系统而言是已分配状态（PT_PCPU），不会参与合并
+// 每个缓存有自己的锁，平时只有本 CPU 获取，shrinker 才会访问其他 CPU 的缓存
+#define PAGE_CACHE_RANKS    4U
+#define PAGE_CACHE_HIGH     64U // 超过上限，就归还到伙伴系统
+#define PAGE_CACHE_LOW      32U // 归还时，降低到这个数量
+#define PAGE_CACHE_BATCH    16U // 缓存为空时，一次回填的数量
+
+// 上面的数量针对 rank-0，rank 越大，缓存的块越少
+#define CACHE_HIGH(rank)    (PAGE_CACHE_HIGH  >> (rank))
+#define CACHE_LOW(rank)     (PAGE_CACHE_LOW   >> (rank))
+#define CACHE_BATCH(rank)   (PAGE_CACHE_BATCH >> (rank))
+
+typedef struct page_cache {
+    spinlock_t lock;
+    pglist_t blocks[PAGE_CACHE_RANKS];  // 头部是最近释放的块（cache hot）
+    uint32_t counts[PAGE_CACHE_RANKS];
+    size_t   hits;      // 直接从缓存分配/回收到缓存
+    size_t   misses;    // 需要访问伙伴系统（回填或归还）
+} page_cache_t;
+
+// percpu 需要在 thiscpu_init 之后才能访问
+// 单元测试没有 percpu，缓存始终关闭
+static CONST int g_page_cache_on = 0;
+static PERCPU_BSS page_cache_t g_page_cache;
+static shrinker_t g_page_cache_shrinker;
+
+
+// 空闲内存水位线，根据物理页总数计算
+// 分配之后低于 low，唤醒后台任务回收，直到恢复到 high
+// 分配之前低于 min，分配者先同步回收，尽量避免分配失败
+static CONST uint32_t g_total_cnt = 0;
+static CONST uint32_t g_wmarks[3];
+static CONST page_wakeup_t  g_page_wakeup  = NULL;
+static CONST page_reclaim_t g_page_reclaim = NULL;
+
+
+// 内存规整，把可迁移的块搬走，腾出一个对齐的大块
+// 迁移需要修改页表并执行 tlb-shootdown，具体操作由 vmspace 注册的函数完成
+// 同一时刻只允许一个规整过程
+static CONST page_migrate_t g_page_migrate = NULL;
+static _Atomic int g_compacting = 0;
+
+
+// 预先清零的单页，由空闲 CPU 在后台填充
+// 页表、栈、进程内存需要清零，直接从这里取，分配路径上不用执行 memset
+#define ZERO_POOL_HIGH      512U    // 后台清零的上限，最多保留 2M
+#define ZERO_POOL_DIRECT    16U     // 页数不超过这个值，才使用清零池
+
+// 每个节点有独立的清零池，页表、栈也能使用本地内存
+typedef struct zero_pool {
+    pglist_t pages;
+    uint32_t count;
+} zero_pool_t;
+
+static spinlock_t g_zero_spin = SPINLOCK_INIT;
+static zero_pool_t g_zero_pools[PAGE_NODE_NUM]; // guarded by g_zero_spin
+static shrinker_t g_zero_shrinker;
 
 
 
@@ -26,9 +120,21 @@ static pglist_t g_blocks[PAGE_BLOCK_RANK_NUM];
 //------------------------------------------------------------------------------
 
 // 从任意 pfn 向上找到所在 block 的头页
+// 伙伴块总是按自身大小对齐，头页只可能是 pfn 清除低 r 位的结果
+// r 从小到大尝试，第一个 head==1 的就是所在块，最多检查 PAGE_BLOCK_RANK_NUM 次
+// 块内其他页的 head 始终为零，不需要逐页回溯，也不需要在拆分合并时更新尾页
+// 如果 pfn 不属于任何块，返回 0
 uint32_t page_block_head(uint32_t pfn) {
-    while (!g_pages[pfn].head) --pfn;
-    return pfn;
+    for (uint32_t rank = 0; rank < PAGE_BLOCK_RANK_NUM; ++rank) {
+        uint32_t blk = pfn & ~((1U << rank) - 1);
+        if (blk < g_page_start) {
+            break;
+        }
+        if (g_pages[blk].head) {
+            return (pfn - blk < (1U << g_pages[blk].rank)) ? blk : 0;
+        }
+    }
+    return 0;
 }
 
 void pglist_push_tail(pglist_t *pl, uint32_t blk) {
@@ -75,18 +181,161 @@ void pglist_remove(pglist_t *pl, uint32_t blk) {
     }
 }
 
+// 用 blk 替换链表中的 old，位置不变
+void pglist_replace(pglist_t *pl, uint32_t old, uint32_t blk) {
+    uint32_t prev = g_pages[old].prev;
+    uint32_t next = g_pages[old].next;
+    g_pages[blk].prev = prev;
+    g_pages[blk].next = next;
+
+    if (prev) {
+        g_pages[prev].next = blk;
+    } else {
+        pl->head = blk;
+    }
+    if (next) {
+        g_pages[next].prev = blk;
+    } else {
+        pl->tail = blk;
+    }
+}
+
+// 将 other 链表整体追加到 pl 末尾
+static void pglist_concat(pglist_t *pl, pglist_t *other) {
+    if (0 == other->head) {
+        return;
+    }
+    if (0 == pl->head) {
+        *pl = *other;
+        return;
+    }
+    g_pages[pl->tail].next = other->head;
+    g_pages[other->head].prev = pl->tail;
+    pl->tail = other->tail;
+}
+
+
+//------------------------------------------------------------------------------
+// 空闲块索引，按 rank 和颜色分组
+//------------------------------------------------------------------------------
+
+// 颜色低 k 位相同的颜色集合，例如 k=2 对应颜色 0、4、8、...
+// 左移 phase 就得到低 k 位等于 phase 的颜色集合
+static const uint64_t g_color_match[PAGE_COLOR_SHIFT + 1] = {
+    0xffffffffffffffffUL,
+    0x5555555555555555UL,
+    0x1111111111111111UL,
+    0x0101010101010101UL,
+    0x0001000100010001UL,
+    0x0000000100000001UL,
+    0x0000000000000001UL,
+};
+
+static inline uint32_t block_color(uint32_t blk, uint32_t rank) {
+    return (blk >> rank) & (PAGE_COLOR_NUM - 1);
+}
+
+// 块所在节点的空闲块索引
+static inline free_area_t *block_area(uint32_t blk, uint32_t rank) {
+    return &g_blocks[g_pages[blk].node][rank];
+}
+
+static void area_push_head(uint32_t rank, uint32_t blk) {
+    free_area_t *area = block_area(blk, rank);
+    uint32_t color = block_color(blk, rank);
+    area->colors |= 1UL << color;
+    pglist_push_head(&area->lists[color], blk);
+}
+
+static void area_push_tail(uint32_t rank, uint32_t blk) {
+    free_area_t *area = block_area(blk, rank);
+    uint32_t color = block_color(blk, rank);
+    area->colors |= 1UL << color;
+    pglist_push_tail(&area->lists[color], blk);
+}
+
+static void area_remove(uint32_t rank, uint32_t blk) {
+    free_area_t *area = block_area(blk, rank);
+    uint32_t color = block_color(blk, rank);
+    pglist_t *pl = &area->lists[color];
+    pglist_remove(pl, blk);
+    if (0 == pl->head) {
+        area->colors &= ~(1UL << color);
+    }
+}
+
+// 返回节点中本层任意一个空闲块，没有则返回 0
+static uint32_t area_first(int node, uint32_t rank) {
+    uint64_t colors = g_blocks[node][rank].colors;
+    if (0 == colors) {
+        return 0;
+    }
+    return g_blocks[node][rank].lists[__builtin_ctzll(colors)].head;
+}
+
+// 在 rank 层寻找起始页号满足 (blk % period) == (phase 去掉低 rank 位) 的空闲块
+// 只要 period 不超过 rank + PAGE_COLOR_SHIFT，查找只需检查 bitmap
+static uint32_t area_find(int node, uint32_t rank, uint32_t period, uint32_t phase) {
+    free_area_t *area = &g_blocks[node][rank];
+    uint64_t colors = area->colors;
+    if (0 == colors) {
+        return 0;
+    }
+
+    uint32_t shift = __builtin_ctz(period);
+    if (shift <= rank) {
+        return area_first(node, rank); // 块已经按 period 对齐，任意块都满足
+    }
+
+    // 需要匹配颜色的低 k 位
+    uint32_t k = shift - rank;
+    uint32_t want = phase >> rank;
+    if (k <= PAGE_COLOR_SHIFT) {
+        colors &= g_color_match[k] << want;
+        if (0 == colors) {
+            return 0;
+        }
+        return area->lists[__builtin_ctzll(colors)].head;
+    }
+
+    // period 超过颜色数量，颜色只能确定低位，还要在链表中筛选
+    uint32_t color = want & (PAGE_COLOR_NUM - 1);
+    if (0 == (colors & (1UL << color))) {
+        return 0;
+    }
+    uint32_t target = phase & ~((1U << rank) - 1);
+    uint32_t blk = area->lists[color].head;
+    for (; blk; blk = g_pages[blk].next) {
+        if ((blk & (period - 1)) == target) {
+            return blk;
+        }
+    }
+    return 0;
+}
+
 
 //------------------------------------------------------------------------------
 // 物理页块级别的分配释放
 //------------------------------------------------------------------------------
 
+// 空闲页数量，总数和各节点分别统计
+static inline void free_add(uint32_t blk, uint32_t num) {
+    g_free_cnt += num;
+    g_node_free[g_pages[blk].node] += num;
+}
+
+static inline void free_sub(uint32_t blk, uint32_t num) {
+    g_free_cnt -= num;
+    g_node_free[g_pages[blk].node] -= num;
+}
+
 // 释放一个页块
 static void block_free_nolock(uint32_t blk) {
     ASSERT(blk >= g_page_start);
     ASSERT(blk < g_page_end);
     ASSERT(g_pages[blk].head);
 
-    g_free_cnt += 1U << g_pages[blk].rank;
+    free_add(blk, 1U << g_pages[blk].rank);
 
     // 不断检查伙伴块，如果也是 free，则不断合并为更大的块
     uint32_t rank = g_pages[blk].rank;
@@ -98,12 +347,13 @@ static void block_free_nolock(uint32_t blk) {
         ||  (sib >= g_page_end)
         ||  (0 == g_pages[sib].head)
         ||  (rank != g_pages[sib].rank)
-        ||  (PT_FREE != g_pages[sib].type)) {
+        ||  (PT_FREE != g_pages[sib].type)
+        ||  (g_pages[sib].node != g_pages[blk].node)) {
             break;
         }
 
         // 将伙伴块从 free-list 中移除，合并为更大的块
-        pglist_remove(&g_blocks[rank], sib);
+        area_remove(rank, sib);
         g_pages[blk | sib].head = 0; // 后一个块
         g_pages[blk & sib].rank++;   // 前一个块
         blk &= sib;
@@ -111,38 +361,29 @@ static void block_free_nolock(uint32_t blk) {
 
     // 已经合并到最大，标记为 FREE
     g_pages[blk].type = PT_FREE;
-    pglist_push_head(&g_blocks[rank], blk);
+    area_push_head(rank, blk);
 }
 
 
-// 分配一个页块，起始页号必须是 N*period+phase
+// 在指定节点分配一个页块，起始页号必须是 N*period+phase
 // 限制起始页号可以实现页面着色，优化缓存性能
-static uint32_t block_alloc_nolock(uint32_t rank, uint32_t period, uint32_t phase, page_type_t type) {
-    ASSERT(type > PT_FREE);
-    ASSERT(0 == (period & (period - 1)));   // period 必须是 2 的幂
-    ASSERT(phase == (phase & (period - 1))); // phase 必须小于 period
-    ASSERT(0 == (phase & ((1U << rank) - 1))); // phase 必须是 rank 的倍数
-
+static uint32_t node_alloc_nolock(int node, uint32_t rank, uint32_t period, uint32_t phase, page_type_t type) {
     // 不断寻找大小足够的块，将更大的块拆分
+    // 每一层只需查询颜色 bitmap，总共 O(rank) 次
     uint32_t blk_rank;
     uint32_t blk;
     for (blk_rank = rank; blk_rank < PAGE_BLOCK_RANK_NUM; ++blk_rank) {
-        uint32_t color = phase & ~((1U << blk_rank) - 1);   // 相对于这个级别 block 的偏移
-
-        // 遍历本层的 free blocks，寻找起始地址符合要求的块
-        blk = g_blocks[blk_rank].head;
-        for (; blk; blk = g_pages[blk].next) {
-            if ((blk & (period - 1)) == color) {
-                goto found;
-            }
+        blk = area_find(node, blk_rank, period, phase);
+        if (blk) {
+            goto found;
         }
     }
     return 0U;
 
 found:
-    pglist_remove(&g_blocks[blk_rank], blk);
+    area_remove(blk_rank, blk);
     g_pages[blk].type = type; // 标记为已分配
-    g_free_cnt -= 1U << blk_rank;
+    free_sub(blk, 1U << blk_rank);
 
     // 如果这个块超过所需，则将 block 分割为两个子块，返回不需要的部分
     // 根据 phase 决定每一级回收前一半还是后一半
@@ -165,16 +406,35 @@ found:
     return blk;
 }
 
-// 分配若干不连续的物理页，成功返程 1，失败返回 0
-static uint32_t pagelist_alloc_nolock(pglist_t *pl, uint32_t num, page_type_t type) {
+// 分配一个页块，优先使用 node，不足时按距离回退到其他节点
+static uint32_t block_alloc_nolock(int node, uint32_t rank, uint32_t period, uint32_t phase, page_type_t type) {
+    ASSERT(type > PT_FREE);
+    ASSERT(0 != period);
+    ASSERT(0 == (period & (period - 1)));   // period 必须是 2 的幂
+    ASSERT(phase == (phase & (period - 1))); // phase 必须小于 period
+    ASSERT(0 == (phase & ((1U << rank) - 1))); // phase 必须是 rank 的倍数
+    ASSERT(node < g_node_num);
+
+    for (int i = 0; i < g_node_num; ++i) {
+        uint32_t blk = node_alloc_nolock(g_node_order[node][i], rank, period, phase, type);
+        if (blk) {
+            return blk;
+        }
+    }
+    return 0U;
+}
+
+// 在指定节点分配若干不连续的物理页，成功返程 1，失败返回 0
+static uint32_t node_pagelist_nolock(int node, pglist_t *pl, uint32_t num, page_type_t type) {
     uint32_t rank;
     uint32_t size;
     uint32_t blk;
 
     // 检查剩余 page 数量是否满足，如果剩余内存太少则直接退出
-    if (g_free_cnt < num) {
+    if (g_node_free[node] < num) {
         return 0;
     }
+    g_node_free[node] -= num;
     g_free_cnt -= num;
 
     pl->head = 0U; // 清楚原本的内容
@@ -184,8 +444,8 @@ static uint32_t pagelist_alloc_nolock(pglist_t *pl, uint32_t num, page_type_t ty
         size = 1U << rank;
 
         // 不断从队列中取页块
-        while (0 != (blk = g_blocks[rank].head)) {
-            pglist_remove(&g_blocks[rank], blk);
+        while (0 != (blk = area_first(node, rank))) {
+            area_remove(rank, blk);
             if (num < size) {
                 // 页块超过所需，将其拆开
                 // 此时 blk 页类型还是 FREE
@@ -226,11 +486,11 @@ split_into_smaller:
             g_pages[sib].type = type;
             pglist_push_head(pl, sib);
         } else {
-            pglist_push_head(&g_blocks[rank], sib);
+            area_push_head(rank, sib);
         }
 
         if (0 == num) {
-            pglist_push_tail(&g_blocks[rank], blk);
+            area_push_tail(rank, blk);
             return 1;
         }
     }
@@ -239,34 +499,483 @@ split_into_smaller:
     return 0;
 }
 
+// 分配若干不连续的物理页，优先使用 node，不足的部分从其他节点按距离补齐
+static uint32_t pagelist_alloc_nolock(int node, pglist_t *pl, uint32_t num, page_type_t type) {
+    ASSERT(node < g_node_num);
+
+    pl->head = 0U;
+    pl->tail = 0U;
+    if (g_free_cnt < num) {
+        return 0;
+    }
+
+    for (int i = 0; (i < g_node_num) && num; ++i) {
+        int n = g_node_order[node][i];
+        uint32_t part = (num < g_node_free[n]) ? num : g_node_free[n];
+        if (0 == part) {
+            continue;
+        }
+
+        pglist_t sub;
+        if (!node_pagelist_nolock(n, &sub, part, type)) {
+            break;
+        }
+        pglist_concat(pl, &sub);
+        num -= part;
+    }
+
+    if (num) {
+        for (uint32_t blk = pl->head; blk; ) {
+            uint32_t next = g_pages[blk].next;
+            block_free_nolock(blk);
+            blk = next;
+        }
+        pl->head = 0U;
+        pl->tail = 0U;
+        return 0;
+    }
+    return 1;
+}
+
+
+//------------------------------------------------------------------------------
+// per-CPU 页缓存
+//------------------------------------------------------------------------------
+
+// 缓存为空时，从伙伴系统批量取出 batch 个块
+// 缓存超过 high 时，批量归还，降低到 low
+// 获取缓存的锁之前可能被抢占，换到其他 CPU，有锁保护，访问原来 CPU 的缓存也是安全的
+
+static uint32_t cache_take(uint32_t rank, page_type_t type) {
+
+    page_cache_t *cache = THISCPU(&g_page_cache);
+    SPINLOCK_SCOPED(&cache->lock);
+    pglist_t *pl = &cache->blocks[rank];
+
+    if (0 == cache->counts[rank]) {
+        SPINLOCK_SCOPED(&g_page_spin);
+        for (uint32_t i = 0; i < CACHE_BATCH(rank); ++i) {
+            uint32_t blk = block_alloc_nolock(this_node(), rank, 1, 0, PT_PCPU);
+            if (0 == blk) {
+                break;
+            }
+            pglist_push_tail(pl, blk);
+            ++cache->counts[rank];
+            g_cached_cnt += 1U << rank;
+        }
+        ++cache->misses;
+    } else {
+        ++cache->hits;
+    }
+
+    uint32_t blk = pl->head;
+    if (blk) {
+        pglist_remove(pl, blk);
+        --cache->counts[rank];
+        g_cached_cnt -= 1U << rank;
+        g_pages[blk].type = type;
+    }
+
+    return blk;
+}
+
+// 把所有 CPU 缓存的块归还到伙伴系统，返回归还的页数
+// 每次只持有一个缓存的锁，加锁顺序与 cache_free 相同，先缓存后 g_page_spin
+static uint32_t cache_drain() {
+    uint32_t num = 0;
+    for (int i = 0; i < cpu_count(); ++i) {
+        page_cache_t *cache = PERCPU(i, &g_page_cache);
+        SPINLOCK_SCOPED(&cache->lock);
+        SPINLOCK_SCOPED(&g_page_spin);
+        for (uint32_t rank = 0; rank < PAGE_CACHE_RANKS; ++rank) {
+            pglist_t *pl = &cache->blocks[rank];
+            uint32_t got = cache->counts[rank] << rank;
+            while (pl->head) {
+                uint32_t blk = pl->head;
+                pglist_remove(pl, blk);
+                block_free_nolock(blk);
+            }
+            cache->counts[rank] = 0;
+            g_cached_cnt -= got;
+            num += got;
+        }
+    }
+    return num;
+}
+
+// 本地缓存为空，伙伴系统也无法回填时，空闲的块可能都在其他 CPU 的缓存里
+// 释放本地缓存的锁之后清空所有缓存，再从伙伴系统分配
+static uint32_t cache_alloc(uint32_t rank, page_type_t type) {
+    ASSERT(rank < PAGE_CACHE_RANKS);
+
+    uint32_t blk = cache_take(rank, type);
+    if ((0 == blk) && cache_drain()) {
+        SPINLOCK_SCOPED(&g_page_spin);
+        blk = block_alloc_nolock(this_node(), rank, 1, 0, type);
+    }
+    return blk;
+}
+
+static void cache_free(uint32_t blk) {
+    uint32_t rank = g_pages[blk].rank;
+    ASSERT(rank < PAGE_CACHE_RANKS);
+
+    page_cache_t *cache = THISCPU(&g_page_cache);
+    SPINLOCK_SCOPED(&cache->lock);
+    pglist_t *pl = &cache->blocks[rank];
+
+    g_pages[blk].type = PT_PCPU;
+    pglist_push_head(pl, blk);
+    g_cached_cnt += 1U << rank;
+
+    if (++cache->counts[rank] > CACHE_HIGH(rank)) {
+        // 从尾部归还，尾部的块最久没有使用
+        SPINLOCK_SCOPED(&g_page_spin);
+        while (cache->counts[rank] > CACHE_LOW(rank)) {
+            uint32_t tail = pl->tail;
+            pglist_remove(pl, tail);
+            --cache->counts[rank];
+            g_cached_cnt -= 1U << rank;
+            block_free_nolock(tail);
+        }
+        ++cache->misses;
+    } else {
+        ++cache->hits;
+    }
+}
+
+// 清空所有 CPU 的缓存，块不需要 shootdown，直接归还到伙伴系统
+static uint32_t cache_shrink(shrinker_t *self UNUSED, shrink_ctl_t *ctl UNUSED) {
+    return cache_drain();
+}
+
+static uint32_t zero_shrink(shrinker_t *self, shrink_ctl_t *ctl);
+
+// 需要在 thiscpu_init 之后调用，其他 CPU 启动时会先执行 thiscpu_init
+// 同时注册 shrinker，内存紧张时清空 per-CPU 缓存和清零池
+INIT_TEXT void page_cache_enable() {
+    g_page_cache_on = 1;
+    shrinker_register(&g_page_cache_shrinker, "page-cache", cache_shrink);
+    shrinker_register(&g_zero_shrinker, "page-zero", zero_shrink);
+}
+
+
+//------------------------------------------------------------------------------
+// 水位线与内存回收
+//------------------------------------------------------------------------------
+
+// 分配之前调用，分配 num 页之后将低于 min，先同步回收
+// 同步回收要执行 tlb-shootdown，只能在任务上下文、中断开启时进行
+static void wmark_reclaim(uint32_t num) {
+    if (g_page_reclaim
+    &&  (g_free_cnt + g_cached_cnt < g_wmarks[WMARK_MIN] + num)
+    &&  tlb_may_shootdown()) {
+        g_page_reclaim();
+    }
+}
+
+// 分配之后调用，低于 low 则唤醒后台回收任务
+// 可能在 ISR 中调用，wakeup 函数不能阻塞
+static void wmark_wakeup() {
+    if (g_page_wakeup && (g_free_cnt + g_cached_cnt < g_wmarks[WMARK_LOW])) {
+        g_page_wakeup();
+    }
+}
+
+uint32_t page_watermark(page_wmark_t mark) {
+    ASSERT(mark <= WMARK_HIGH);
+    return g_wmarks[mark];
+}
+
+// 需要在回收任务能够运行之前调用，wakeup 要能处理任务尚未创建的情况
+INIT_TEXT void page_reclaim_enable(page_wakeup_t wakeup, page_reclaim_t reclaim) {
+    g_page_wakeup = wakeup;
+    g_page_reclaim = reclaim;
+}
+
+
+//------------------------------------------------------------------------------
+// 内存规整
+//------------------------------------------------------------------------------
+
+// 只有进程页可以迁移，进程页只通过页表访问，迁移之后重新映射即可
+// pool 的 slab 映射地址由物理地址决定，对象又被指针引用，无法迁移
+static inline int block_movable(uint32_t blk) {
+    return PT_PROC == g_pages[blk].type;
+}
+
+// 统计对齐窗口内空闲页的数量，包含不可迁移的块则返回 -1
+static int window_score(uint32_t win, uint32_t rank) {
+    if ((win < g_page_start) || (win + (1U << rank) > g_page_end)) {
+        return -1;
+    }
+
+    int nfree = 0;
+    uint32_t end = win + (1U << rank);
+    for (uint32_t blk = win; blk < end; blk += 1U << g_pages[blk].rank) {
+        if (!g_pages[blk].head || (g_pages[blk].rank >= rank)) {
+            return -1; // 空洞，或者本身就是大块
+        }
+        if (g_pages[blk].node != g_pages[win].node) {
+            return -1; // 跨越节点的窗口无法合并
+        }
+        if (PT_FREE == g_pages[blk].type) {
+            nfree += 1 << g_pages[blk].rank;
+        } else if (!block_movable(blk)) {
+            return -1;
+        }
+    }
+    return nfree;
+}
+
+// 选出空闲页最多的窗口，把其中的空闲块隔离，不再参与分配
+// 返回窗口起始页号，没有合适的窗口则返回 0
+static uint32_t window_isolate(uint32_t rank) {
+    SPINLOCK_SCOPED(&g_page_spin);
+
+    uint32_t size = 1U << rank;
+    uint32_t best = 0;
+    int best_score = 0;
+    uint32_t win = (g_page_start + size - 1) & ~(size - 1);
+    for (; win + size <= g_page_end; win += size) {
+        int score = window_score(win, rank);
+        if (score > best_score) {
+            best_score = score;
+            best = win;
+        }
+    }
+    if (0 == best) {
+        return 0;
+    }
+
+    for (uint32_t blk = best; blk < best + size; blk += 1U << g_pages[blk].rank) {
+        if (PT_FREE == g_pages[blk].type) {
+            area_remove(g_pages[blk].rank, blk);
+            g_pages[blk].type = PT_ISOLATE;
+            free_sub(blk, 1U << g_pages[blk].rank);
+        }
+    }
+    return best;
+}
+
+// 规整结束，如果整个窗口都已空闲，合并为一个大块
+// type 为 PT_FREE 则放回伙伴系统，否则直接作为分配结果返回
+// 窗口没能完全腾空，就把隔离的块放回伙伴系统
+static uint32_t window_release(uint32_t win, uint32_t rank, page_type_t type) {
+    SPINLOCK_SCOPED(&g_page_spin);
+
+    // 迁移期间，窗口内的块可能被所有者释放并合并，需要重新定位块头
+    // 甚至整个窗口都已空闲，并入了更大的块，这个大块也可能已经被别人分配
+    uint32_t head = page_block_head(win);
+    uint32_t head_rank = g_pages[head].rank;
+    if (head_rank >= rank) {
+        if (PT_FREE != g_pages[head].type) {
+            return 0;
+        }
+        if (PT_FREE == type) {
+            return win;
+        }
+
+        // 从空闲的大块中拆出窗口，作为分配结果，其余部分放回伙伴系统
+        area_remove(head_rank, head);
+        free_sub(head, 1U << head_rank);
+        g_pages[head].type = type; // 拆分过程中不能和伙伴块合并
+        while (head_rank > rank) {
+            --head_rank;
+            uint32_t sib = head + (1U << head_rank);
+            g_pages[head].rank = head_rank;
+            g_pages[sib].head = 1;
+            g_pages[sib].rank = head_rank;
+            g_pages[sib].type = type;
+            if (win >= sib) {
+                block_free_nolock(head); // 窗口在后一半
+                head = sib;
+            } else {
+                block_free_nolock(sib);
+            }
+        }
+        ASSERT(head == win);
+        g_pages[win].type = type;
+        return win;
+    }
+
+    uint32_t end = win + (1U << rank);
+    int whole = 1;
+    for (uint32_t blk = win; blk < end; ) {
+        head = page_block_head(blk);
+        if ((PT_FREE != g_pages[head].type) && (PT_ISOLATE != g_pages[head].type)) {
+            whole = 0;
+        }
+        blk = head + (1U << g_pages[head].rank);
+    }
+
+    if (!whole) {
+        for (uint32_t blk = win; blk < end; ) {
+            head = page_block_head(blk);
+            uint32_t next = head + (1U << g_pages[head].rank);
+            if (PT_ISOLATE == g_pages[head].type) {
+                block_free_nolock(head);
+            }
+            blk = next;
+        }
+        return 0;
+    }
+
+    for (uint32_t blk = win; blk < end; ) {
+        uint32_t next = blk + (1U << g_pages[blk].rank);
+        if (PT_FREE == g_pages[blk].type) {
+            area_remove(g_pages[blk].rank, blk);
+            free_sub(blk, 1U << g_pages[blk].rank);
+        }
+        g_pages[blk].head = 0;
+        blk = next;
+    }
+
+    g_pages[win].head = 1;
+    g_pages[win].rank = rank;
+    g_pages[win].type = type;
+    if (PT_FREE == type) {
+        block_free_nolock(win);
+    }
+    return win;
+}
+
+// 迁移窗口内所有已分配的块，迁移之后旧块标记为隔离
+// 有一个块迁移失败就停止，窗口无法腾空
+static void window_migrate(uint32_t win, uint32_t rank) {
+    uint32_t end = win + (1U << rank);
+    for (uint32_t blk = win; blk < end; ) {
+        uint32_t head;
+        int movable;
+        {
+            SPINLOCK_SCOPED(&g_page_spin);
+            head = page_block_head(blk);
+            movable = block_movable(head);
+            blk = head + (1U << g_pages[head].rank);
+        }
+        if (!movable) {
+            continue;
+        }
+        if (!g_page_migrate(head)) {
+            return;
+        }
+
+        SPINLOCK_SCOPED(&g_page_spin);
+        g_pages[head].type = PT_ISOLATE;
+    }
+}
+
+// 腾出一个 2^rank 的块，失败返回 0
+static uint32_t compact(uint32_t rank, page_type_t type) {
+    if ((NULL == g_page_migrate) || atomic_exchange(&g_compacting, 1)) {
+        return 0;
+    }
+
+    uint32_t blk = window_isolate(rank);
+    if (blk) {
+        window_migrate(blk, rank);
+        blk = window_release(blk, rank, type);
+    }
+
+    atomic_store(&g_compacting, 0);
+    return blk;
+}
+
+int page_compact(uint32_t rank) {
+    ASSERT(rank < PAGE_BLOCK_RANK_NUM);
+    return 0 != compact(rank, PT_FREE);
+}
+
+// 需要在 vmspace 能够迁移进程页之后调用
+INIT_TEXT void page_compact_enable(page_migrate_t migrate) {
+    g_page_migrate = migrate;
+}
+
 
 //------------------------------------------------------------------------------
 // public functions
 //------------------------------------------------------------------------------
 
+static size_t block_alloc(int node, uint32_t rank, page_type_t type,
+        uint32_t period, uint32_t phase) {
+    wmark_reclaim(1U << rank);
+
+    uint32_t blk;
+    {
+        SPINLOCK_SCOPED(&g_page_spin);
+        blk = block_alloc_nolock(node, rank, period, phase, type);
+    }
+
+    wmark_wakeup();
+    return (size_t)blk << PAGE_SHIFT;
+}
+
 size_t page_alloc_color(uint32_t rank, page_type_t type,
         uint32_t period, uint32_t phase) {
-    SPINLOCK_SCOPED(&g_page_spin);
-    return (size_t)block_alloc_nolock(rank, period, phase, type) << PAGE_SHIFT;
+    return block_alloc(this_node(), rank, type, period, phase);
+}
+
+
+// 分配失败时同步回收，回收到页面则再尝试一次伙伴系统
+// 各 CPU 的缓存也会被回收，因此重试不经过缓存
+static size_t reclaim_retry(uint32_t rank, page_type_t type) {
+    if ((NULL == g_page_reclaim) || !tlb_may_shootdown() || (0 == g_page_reclaim())) {
+        return 0;
+    }
+
+    uint32_t blk;
+    {
+        SPINLOCK_SCOPED(&g_page_spin);
+        blk = block_alloc_nolock(this_node(), rank, 1, 0, type);
+    }
+    return (size_t)blk << PAGE_SHIFT;
 }
 
 size_t page_alloc(uint32_t rank, page_type_t type) {
-    return page_alloc_color(rank, type, 1, 0);
+    size_t pa;
+    if (g_page_cache_on && (rank < PAGE_CACHE_RANKS)) {
+        wmark_reclaim(1U << rank);
+        pa = (size_t)cache_alloc(rank, type) << PAGE_SHIFT;
+        wmark_wakeup();
+    } else {
+        pa = page_alloc_color(rank, type, 1, 0);
+    }
+
+    if (0 == pa) {
+        pa = reclaim_retry(rank, type);
+    }
+    if ((0 == pa) && g_page_migrate && tlb_may_shootdown()) {
+        pa = (size_t)compact(rank, type) << PAGE_SHIFT;
+    }
+    return pa;
 }
 
 void page_free(size_t pa) {
+    uint32_t blk = (uint32_t)(pa >> PAGE_SHIFT);
+    if (g_page_cache_on && (g_pages[blk].rank < PAGE_CACHE_RANKS)) {
+        cache_free(blk);
+        return;
+    }
+
     SPINLOCK_SCOPED(&g_page_spin);
-    block_free_nolock((uint32_t)(pa >> PAGE_SHIFT));
+    block_free_nolock(blk);
 }
 
 
 int pagelist_alloc(pglist_t *pl, uint32_t num, page_type_t type) {
-    SPINLOCK_SCOPED(&g_page_spin);
-    return pagelist_alloc_nolock(pl, num, type);
+    wmark_reclaim(num);
+
+    int ok;
+    {
+        SPINLOCK_SCOPED(&g_page_spin);
+        ok = pagelist_alloc_nolock(this_node(), pl, num, type);
+    }
+
+    wmark_wakeup();
+    return ok;
 }
 
-void pagelist_free(pglist_t *pl) {
-    SPINLOCK_SCOPED(&g_page_spin);
+static void pagelist_free_nolock(pglist_t *pl) {
     for (uint32_t blk = pl->head; blk; ) {
         uint32_t next = g_pages[blk].next; // 必须先得到后继页块
         block_free_nolock(blk); // 这会修改 g_pages
@@ -276,13 +985,313 @@ void pagelist_free(pglist_t *pl) {
     pl->tail = 0;
 }
 
+// 按 num 的二进制位从高到低分配，每一位对应一个块，块数最少
+// 某个 rank 没有空闲块（包括更大的块），这一层的需求就拆成两倍数量的下一层
+// 块从大到小排列，每个块在范围内的偏移都是自身大小的倍数，映射时保持对齐
+static int pagelist_alloc_fewest_nolock(int node, pglist_t *pl, uint32_t num, page_type_t type) {
+    pl->head = 0;
+    pl->tail = 0;
+    if (g_free_cnt < num) {
+        return 0;
+    }
+
+    uint32_t need = 0; // 当前 rank 还需要的块数
+    for (int rank = PAGE_BLOCK_RANK_NUM - 1; rank >= 0; --rank) {
+        need = (need << 1) | ((num >> rank) & 1);
+        for (; need > 0; --need) {
+            uint32_t blk = block_alloc_nolock(node, rank, 1, 0, type);
+            if (0 == blk) {
+                break; // 剩余需求留给下一层
+            }
+            pglist_push_tail(pl, blk);
+        }
+    }
+
+    if (need) {
+        pagelist_free_nolock(pl);
+        return 0;
+    }
+    return 1;
+}
+
+static int pagelist_alloc_aligned_nolock(int node, pglist_t *pl, uint32_t num, uint32_t rank, page_type_t type) {
+    pl->head = 0;
+    pl->tail = 0;
+    if (g_free_cnt < num) {
+        return 0;
+    }
+
+    for (; num >= (1U << rank); num -= 1U << rank) {
+        uint32_t blk = block_alloc_nolock(node, rank, 1, 0, type);
+        if (0 == blk) {
+            break; // 没有足够大的块，剩余部分按普通方式分配
+        }
+        pglist_push_tail(pl, blk);
+    }
+
+    if (num) {
+        pglist_t rest;
+        if (!pagelist_alloc_fewest_nolock(node, &rest, num, type)) {
+            pagelist_free_nolock(pl);
+            return 0;
+        }
+        pglist_concat(pl, &rest);
+    }
+    return 1;
+}
+
+// 分配若干物理页，尽可能使用 2^rank 大小的块，这些块排在链表开头
+// 伙伴块总是按自身大小对齐，映射到对齐的虚拟地址就可以使用大页
+// 剩余不足 2^rank 的部分用尽量少的块补齐，排在链表末尾
+int pagelist_alloc_aligned(pglist_t *pl, uint32_t num, uint32_t rank, page_type_t type) {
+    ASSERT(rank < PAGE_BLOCK_RANK_NUM);
+
+    wmark_reclaim(num);
+
+    int ok;
+    {
+        SPINLOCK_SCOPED(&g_page_spin);
+        ok = pagelist_alloc_aligned_nolock(this_node(), pl, num, rank, type);
+    }
+
+    wmark_wakeup();
+    return ok;
+}
+
+// 分配若干物理页，使用尽可能少、尽可能大的块，块从大到小排列
+// pagelist_alloc 优先消耗小块，适合不关心连续性的场景
+// 这里优先使用大块，映射的时候 mmu_map 调用更少，还能用上大页
+int pagelist_alloc_fewest(pglist_t *pl, uint32_t num, page_type_t type) {
+    wmark_reclaim(num);
+
+    int ok;
+    {
+        SPINLOCK_SCOPED(&g_page_spin);
+        ok = pagelist_alloc_fewest_nolock(this_node(), pl, num, type);
+    }
+
+    wmark_wakeup();
+    return ok;
+}
 
-inline uint32_t page_free_count() {
+void pagelist_free(pglist_t *pl) {
+    SPINLOCK_SCOPED(&g_page_spin);
+    pagelist_free_nolock(pl);
+}
+
+// 从 *blk 开始遍历链表，把物理地址相邻的块合并为 extent，最多输出 max 个
+// 返回输出的数量，*blk 更新为下次遍历的起点，为 0 表示遍历结束
+// 链表归调用者所有，块不会被释放，因此无需加锁
+int pglist_extents(uint32_t *blk, page_extent_t *ext, int max) {
+    ASSERT(NULL != blk);
+    ASSERT(NULL != ext);
+    ASSERT(max > 0);
+
+    int n = 0;
+    uint32_t cur = *blk;
+    while (cur && (n < max)) {
+        ext[n].blk = cur;
+        ext[n].num = 0;
+        do {
+            ext[n].num += 1U << g_pages[cur].rank;
+            cur = g_pages[cur].next;
+        } while (cur && (cur == ext[n].blk + ext[n].num));
+        ++n;
+    }
+    *blk = cur;
+    return n;
+}
+
+
+inline // 是否存在不小于 2^rank 的空闲块
+int page_has_free_block(uint32_t rank) {
+    SPINLOCK_SCOPED(&g_page_spin);
+    for (int node = 0; node < g_node_num; ++node) {
+        for (uint32_t r = rank; r < PAGE_BLOCK_RANK_NUM; ++r) {
+            if (g_blocks[node][r].colors) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+uint32_t page_free_count() {
     return g_free_cnt;
 }
 
 
 
+//------------------------------------------------------------------------------
+// 写时复制的共享计数
+//------------------------------------------------------------------------------
+
+// fork 之后父子进程映射同一个块，shared 记录除自己之外还有几个使用者
+// 计数为零说明只剩一个地址空间，可以直接写入，也可以直接释放
+// 多个地址空间同时处理缺页、删除范围，需要一把锁保护所有块的计数
+static spinlock_t g_share_spin = SPINLOCK_INIT;
+
+void page_share(size_t pa) {
+    uint32_t blk = (uint32_t)(pa >> PAGE_SHIFT);
+    ASSERT(g_pages[blk].head);
+
+    SPINLOCK_SCOPED(&g_share_spin);
+    ASSERT(g_pages[blk].shared < 0x7fff);
+    ++g_pages[blk].shared;
+}
+
+// 放弃一份共享，返回 1 表示没有其他使用者，块仍归调用者所有
+int page_unshare(size_t pa) {
+    uint32_t blk = (uint32_t)(pa >> PAGE_SHIFT);
+    ASSERT(g_pages[blk].head);
+
+    SPINLOCK_SCOPED(&g_share_spin);
+    if (0 == g_pages[blk].shared) {
+        return 1;
+    }
+    --g_pages[blk].shared;
+    return 0;
+}
+
+int page_shared(size_t pa) {
+    uint32_t blk = (uint32_t)(pa >> PAGE_SHIFT);
+    SPINLOCK_SCOPED(&g_share_spin);
+    return 0 != g_pages[blk].shared;
+}
+
+
+//------------------------------------------------------------------------------
+// 预先清零的物理页
+//------------------------------------------------------------------------------
+
+static void block_zero(uint32_t blk) {
+    kmemset(idmap_at((size_t)blk << PAGE_SHIFT), 0, PAGE_SIZE << g_pages[blk].rank);
+}
+
+// 从本地节点的清零池取出一个单页，没有则返回 0
+static uint32_t zero_pool_take(page_type_t type) {
+    SPINLOCK_SCOPED(&g_zero_spin);
+    zero_pool_t *pool = &g_zero_pools[this_node()];
+    uint32_t blk = pool->pages.head;
+    if (blk) {
+        pglist_remove(&pool->pages, blk);
+        --pool->count;
+        --g_cached_cnt;
+        g_pages[blk].type = type;
+    }
+    return blk;
+}
+
+// 分配内容全为零的页块，单页优先使用后台清零的页
+size_t page_alloc_zeroed(uint32_t rank, page_type_t type) {
+    if (0 == rank) {
+        uint32_t blk = zero_pool_take(type);
+        if (blk) {
+            wmark_wakeup();
+            return (size_t)blk << PAGE_SHIFT;
+        }
+    }
+
+    size_t pa = page_alloc(rank, type);
+    if (pa) {
+        block_zero((uint32_t)(pa >> PAGE_SHIFT));
+    }
+    return pa;
+}
+
+// 分配内容全为零的若干物理页
+// 页数较少时逐页使用清零池，否则整体分配，再同步清零
+int pagelist_alloc_zeroed(pglist_t *pl, uint32_t num, page_type_t type) {
+    pl->head = 0;
+    pl->tail = 0;
+
+    if (num <= ZERO_POOL_DIRECT) {
+        for (; num > 0; --num) {
+            uint32_t blk = zero_pool_take(type);
+            if (0 == blk) {
+                break;
+            }
+            pglist_push_tail(pl, blk);
+        }
+        wmark_wakeup();
+    }
+    if (0 == num) {
+        return 1;
+    }
+
+    // 块越大，清零越快，映射也越少
+    pglist_t rest;
+    if (!pagelist_alloc_fewest(&rest, num, type)) {
+        pagelist_free(pl);
+        return 0;
+    }
+    for (uint32_t blk = rest.head; blk; blk = g_pages[blk].next) {
+        block_zero(blk);
+    }
+
+    pglist_concat(pl, &rest);
+    return 1;
+}
+
+// 空闲任务调用，清零一个页并放入清零池
+// 清零期间不持有锁，可以被随时抢占，返回 0 表示无需继续
+// 填充当前 CPU 所在节点的清零池，页来自本地节点
+// 填充不会让空闲页低于 high 水位线，避免和 shrinker 来回搬运
+int page_zero_fill() {
+    if (g_free_cnt <= g_wmarks[WMARK_HIGH]) {
+        return 0;
+    }
+
+    int node = this_node();
+    {
+        SPINLOCK_SCOPED(&g_zero_spin);
+        if (g_zero_pools[node].count >= ZERO_POOL_HIGH) {
+            return 0;
+        }
+    }
+
+    size_t pa = page_alloc(0, PT_ZERO);
+    if (0 == pa) {
+        return 0;
+    }
+    uint32_t blk = (uint32_t)(pa >> PAGE_SHIFT);
+    block_zero(blk);
+
+    // 本地节点耗尽时，可能分配到了其他节点的页，放入页所在节点的池
+    SPINLOCK_SCOPED(&g_zero_spin);
+    zero_pool_t *pool = &g_zero_pools[g_pages[blk].node];
+    pglist_push_head(&pool->pages, blk);
+    ++pool->count;
+    ++g_cached_cnt;
+    return 1;
+}
+
+// 清空所有节点的清零池，页交给 shrink_all 归还到伙伴系统
+static uint32_t zero_shrink(shrinker_t *self UNUSED, shrink_ctl_t *ctl) {
+    uint32_t num = 0;
+    SPINLOCK_SCOPED(&g_zero_spin);
+    for (int i = 0; i < g_node_num; ++i) {
+        zero_pool_t *pool = &g_zero_pools[i];
+        pglist_concat(&ctl->pages, &pool->pages);
+        pool->pages.head = 0;
+        pool->pages.tail = 0;
+        num += pool->count;
+        pool->count = 0;
+    }
+    g_cached_cnt -= num;
+    return num;
+}
+
+uint32_t page_zero_count() {
+    uint32_t sum = 0;
+    for (int i = 0; i < g_node_num; ++i) {
+        sum += g_zero_pools[i].count;
+    }
+    return sum;
+}
+
+
+
 // 分配页描述符数组
 INIT_TEXT void page_init(size_t pa_start, size_t pa_end) {
     pa_start >>= PAGE_SHIFT;
@@ -309,6 +1318,89 @@ INIT_TEXT void page_init(size_t pa_start, size_t pa_end) {
     g_pages -= g_page_start;
 
     kmemset(g_blocks, 0, sizeof(g_blocks));
+    kmemset(g_node_free, 0, sizeof(g_node_free));
+    g_free_cnt = 0;
+    g_cached_cnt = 0;
+    g_total_cnt = 0;
+    kmemset(g_wmarks, 0, sizeof(g_wmarks));
+    g_page_migrate = NULL;
+    g_page_wakeup = NULL;
+    g_page_reclaim = NULL;
+
+    kmemset(g_zero_pools, 0, sizeof(g_zero_pools));
+
+    // 默认只有一个节点，SRAT 解析之后再调用 page_node_init
+    g_node_num = 1;
+    g_numa_on = 0;
+    kmemset(g_node_distance, 0, sizeof(g_node_distance));
+    kmemset(g_node_order, 0, sizeof(g_node_order));
+}
+
+// 设置节点数量和节点距离，distance 为 num*num 矩阵，为 NULL 则本地 10、远端 20
+// 每个节点的回退顺序按距离排序，距离相同时编号小的优先
+INIT_TEXT void page_node_init(int num, const uint8_t *distance) {
+    ASSERT(num > 0);
+    if (num > PAGE_NODE_NUM) {
+        logk("warning: %d numa nodes, only %d supported\n", num, PAGE_NODE_NUM);
+        num = PAGE_NODE_NUM;
+    }
+    g_node_num = num;
+
+    for (int i = 0; i < num; ++i) {
+        for (int j = 0; j < num; ++j) {
+            if (distance) {
+                g_node_distance[i][j] = distance[i * num + j];
+            } else {
+                g_node_distance[i][j] = (i == j) ? 10 : 20;
+            }
+        }
+    }
+
+    // 插入排序，节点数量很少
+    for (int i = 0; i < num; ++i) {
+        uint8_t *order = g_node_order[i];
+        for (int j = 0; j < num; ++j) {
+            int k = j;
+            int dj = (j == i) ? -1 : g_node_distance[i][j]; // 自身总是排在最前
+            for (; k > 0; --k) {
+                int prev = order[k - 1];
+                int dp = (prev == i) ? -1 : g_node_distance[i][prev];
+                if (dp <= dj) {
+                    break;
+                }
+                order[k] = order[k - 1];
+            }
+            order[k] = (uint8_t)j;
+        }
+    }
+}
+
+// 标记一段物理内存所属的节点，需要在 pages_add 之前调用
+INIT_TEXT void page_set_node(size_t start, size_t end, int node) {
+    ASSERT(node < g_node_num);
+
+    start >>= PAGE_SHIFT;
+    end = (end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    if (start < g_page_start) {
+        start = g_page_start;
+    }
+    if (end > g_page_end) {
+        end = g_page_end;
+    }
+    for (size_t pfn = start; pfn < end; ++pfn) {
+        g_pages[pfn].node = node;
+    }
+}
+
+// 需要在 thiscpu_init 之后调用，cpu_nodes 记录每个 CPU 所在的节点
+INIT_TEXT void page_numa_enable(const uint8_t *cpu_nodes) {
+    if (g_node_num < 2) {
+        return;
+    }
+    for (int i = 0; i < cpu_count(); ++i) {
+        *PERCPU(i, &g_this_node) = cpu_nodes[i];
+    }
+    g_numa_on = 1;
 }
 
 INIT_TEXT void pages_add(size_t start, size_t end) {
@@ -325,18 +1417,31 @@ INIT_TEXT void pages_add(size_t start, size_t end) {
     if (start >= end) {
         return;
     }
+    g_total_cnt += (uint32_t)(end - start);
 
     {
         SPINLOCK_SCOPED(&g_page_spin);
         // 这一段内存不一定是按块对齐的，尽可能使用更大的块
+        // 块不能跨越节点边界，遇到节点变化就截断
         while (start < end) {
             int rank = __builtin_ctz(start);
             if (rank >= PAGE_BLOCK_RANK_NUM) {
                 rank = PAGE_BLOCK_RANK_NUM - 1;
             }
 
+            // 只需检查候选块的范围
+            uint32_t limit = end;
+            if (g_node_num > 1) {
+                uint32_t stop = (end - start > (1U << rank)) ? start + (1U << rank) : end;
+                for (limit = start + 1; limit < stop; ++limit) {
+                    if (g_pages[limit].node != g_pages[start].node) {
+                        break;
+                    }
+                }
+            }
+
             uint32_t size = 1U << rank;
-            while (start + size > end) {
+            while (start + size > limit) {
                 size >>= 1;
                 rank--;
             }
@@ -348,6 +1453,15 @@ INIT_TEXT void pages_add(size_t start, size_t end) {
             start += size;
         }
     }
+
+    // min 取物理页总数的 1/256，至少 32 页，low、high 分别再多 1/4、1/2
+    uint32_t min = g_total_cnt >> 8;
+    if (min < 32) {
+        min = 32;
+    }
+    g_wmarks[WMARK_MIN] = min;
+    g_wmarks[WMARK_LOW] = min + min / 4;
+    g_wmarks[WMARK_HIGH] = min + min / 2;
 }
 
 //------------------------------------------------------------------------------
@@ -361,7 +1475,15 @@ static void show_page(int argc, char *argv[]) {
     }
 
     size_t pfn = str2num(argv[1]);
+    if ((pfn < g_page_start) || (pfn >= g_page_end)) {
+        console_printf("pfn 0x%zx out of range\n", pfn);
+        return;
+    }
     uint32_t blk = page_block_head(pfn);
+    if (0 == blk) {
+        console_printf("pfn 0x%zx not managed by page allocator\n", pfn);
+        return;
+    }
     uint32_t rank = g_pages[blk].rank;
     uint32_t end = blk + (1U << rank);
     console_printf("blk=0x%x(%u), rank=%u, end=0x%x(%u) type=%u\n",
@@ -370,22 +1492,106 @@ static void show_page(int argc, char *argv[]) {
 
 static void show_buddy() {
     SPINLOCK_SCOPED(&g_page_spin);
-    for (int rank = 0; rank < PAGE_BLOCK_RANK_NUM; ++rank) {
-        console_printf("block-%02d:", rank);
-        uint32_t blk = g_blocks[rank].head;
-        for (; blk; blk = g_pages[blk].next) {
-            console_printf(" %x,", blk);
+    for (int node = 0; node < g_node_num; ++node) {
+        if (g_node_num > 1) {
+            console_printf("node-%d:\n", node);
+        }
+        for (int rank = 0; rank < PAGE_BLOCK_RANK_NUM; ++rank) {
+            console_printf("block-%02d:", rank);
+            for (uint32_t color = 0; color < PAGE_COLOR_NUM; ++color) {
+                uint32_t blk = g_blocks[node][rank].lists[color].head;
+                for (; blk; blk = g_pages[blk].next) {
+                    console_printf(" %x,", blk);
+                }
+            }
+            console_printf("\n");
         }
-        console_printf("\n");
+    }
+}
+
+// 统计空闲页的颜色直方图，页的颜色是 pfn % PAGE_COLOR_NUM
+static void show_color() {
+    size_t hist[PAGE_COLOR_NUM];
+    kmemset(hist, 0, sizeof(hist));
+
+    {
+        SPINLOCK_SCOPED(&g_page_spin);
+        for (int node = 0; node < g_node_num; ++node) {
+            for (uint32_t rank = 0; rank < PAGE_BLOCK_RANK_NUM; ++rank) {
+                for (uint32_t color = 0; color < PAGE_COLOR_NUM; ++color) {
+                    uint32_t blk = g_blocks[node][rank].lists[color].head;
+                    for (; blk; blk = g_pages[blk].next) {
+                        if (rank >= PAGE_COLOR_SHIFT) {
+                            // 大块覆盖所有颜色，每种颜色的页数相同
+                            for (uint32_t i = 0; i < PAGE_COLOR_NUM; ++i) {
+                                hist[i] += 1U << (rank - PAGE_COLOR_SHIFT);
+                            }
+                        } else {
+                            for (uint32_t i = 0; i < (1U << rank); ++i) {
+                                hist[(blk + i) & (PAGE_COLOR_NUM - 1)] += 1;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < PAGE_COLOR_NUM; ++i) {
+        console_printf("color-%02u: %zu%s", i, hist[i], (3 == (i & 3)) ? "\n" : "\t");
     }
 }
 
 static void show_free() {
-    console_printf("%u free pages\n", page_free_count());
+    console_printf("%u free pages, %u pre-zeroed pages, %u cached pages\n",
+        page_free_count(), page_zero_count(), g_cached_cnt);
+    console_printf("watermarks: min=%u low=%u high=%u\n",
+        g_wmarks[WMARK_MIN], g_wmarks[WMARK_LOW], g_wmarks[WMARK_HIGH]);
+}
+
+// 每个节点的空闲页、清零页数量，以及节点距离
+static void show_numa() {
+    for (int i = 0; i < g_node_num; ++i) {
+        console_printf("node-%d: free=%u zeroed=%u distance", i,
+            g_node_free[i], g_zero_pools[i].count);
+        for (int j = 0; j < g_node_num; ++j) {
+            console_printf(" %u", g_node_distance[i][j]);
+        }
+        console_printf("\n");
+    }
+    if (g_numa_on) {
+        for (int i = 0; i < cpu_count(); ++i) {
+            console_printf("cpu-%d: node-%d%s", i, *PERCPU(i, &g_this_node),
+                (3 == (i & 3)) ? "\n" : "\t");
+        }
+        console_printf("\n");
+    }
+}
+
+static void show_page_cache() {
+    if (!g_page_cache_on) {
+        console_printf("per-cpu page cache disabled\n");
+        return;
+    }
+
+    for (int i = 0; i < cpu_count(); ++i) {
+        page_cache_t *cache = PERCPU(i, &g_page_cache);
+        size_t total = cache->hits + cache->misses;
+        size_t rate = total ? (cache->hits * 100 / total) : 0;
+        console_printf("cpu-%d: hit=%zu miss=%zu (%zu%%), cached",
+            i, cache->hits, cache->misses, rate);
+        for (uint32_t rank = 0; rank < PAGE_CACHE_RANKS; ++rank) {
+            console_printf(" %u", cache->counts[rank]);
+        }
+        console_printf("\n");
+    }
 }
 
 KSHELL_CMD("page", show_page);
 KSHELL_CMD("buddy", show_buddy);
+KSHELL_CMD("color", show_color);
 KSHELL_CMD("mfree", show_free);
+KSHELL_CMD("pcp", show_page_cache);
+KSHELL_CMD("numa", show_numa);
 
 #endif // UNIT_TEST
@@ -14,19 +14,27 @@ typedef enum page_type {
     PT_MSGQ    = 6,
     PT_FS      = 7,
     PT_PROC    = 8,
+    PT_PCPU    = 9,     // 位于 per-CPU 缓存，对伙伴系统而言是已分配
+    PT_ZERO    = 10,    // 已清零，位于清零池等待分配
+    PT_ISOLATE = 11,    // 内存规整期间隔离的块，不参与分配与合并
 } page_type_t;
 
 // rank 合法取值 0~15
 #define PAGE_BLOCK_RANK_NUM 16
 
+// 最多支持 8 个 NUMA 节点
+#define PAGE_NODE_NUM 8
+
 // 使用 uint32 表示页号，最多支持 4G-1 个物理页
 typedef struct page {
     uint32_t prev;
     uint32_t next;
 
-    uint32_t head : 1;  // 是不是块中第一个页
+    uint32_t head : 1;  // 是不是块中第一个页，块内其他页必须为零
     uint32_t rank : 4;  // 所在块的大小，head==1 才有效
     uint32_t type : 4;  // 所在块的类型，head==1 才有效
+    uint32_t node : 3;  // 所属 NUMA 节点，每个页都有效，初始化之后不变
+    uint32_t tag  : 4;  // 对于 PT_POOL，表示 slab 所属内存池的标记
 
     // 对于 PT_PGTBL，表示页表中有效条目数量
     // 对于 PT_POOL，表示已使用的 object 数量（inuse）
@@ -34,6 +42,8 @@ typedef struct page {
 
     // 对于 PT_POOL，表示 freelist 头（slab 内对象偏移，0xFFFF 表示空）
     uint32_t objects : 16;
+    uint32_t frozen  : 1;   // 对于 PT_POOL，表示被某个 CPU 独占
+    uint32_t shared  : 15;  // 对于 PT_PROC，表示还有几个地址空间写时复制共享这个块
 } page_t;
 
 // 相同类型的块可以组成链表（双向不循环链表）
@@ -46,24 +56,72 @@ extern uint32_t g_page_start;
 extern uint32_t g_page_end;
 extern page_t *g_pages;
 
-// 找出所在块
+// 找出所在块，块按大小对齐，最多检查 PAGE_BLOCK_RANK_NUM 个候选页
 uint32_t page_block_head(uint32_t pfn);
 
 // 页链表操作
 void pglist_push_tail(pglist_t *pl, uint32_t blk);
 void pglist_push_head(pglist_t *pl, uint32_t blk);
 void pglist_remove(pglist_t *pl, uint32_t blk);
+void pglist_replace(pglist_t *pl, uint32_t old, uint32_t blk);
 
 size_t page_alloc_color(uint32_t rank, page_type_t type, uint32_t period, uint32_t phase);
 size_t page_alloc(uint32_t rank, page_type_t type);
 void page_free(size_t pa);
 
 int pagelist_alloc(pglist_t *pl, uint32_t num, page_type_t type);
+int pagelist_alloc_aligned(pglist_t *pl, uint32_t num, uint32_t rank, page_type_t type);
+int pagelist_alloc_fewest(pglist_t *pl, uint32_t num, page_type_t type);
 void pagelist_free(pglist_t *pl);
 
+// 一段物理地址连续的页，可能由多个相邻的块组成
+typedef struct page_extent {
+    uint32_t blk;   // 起始页号
+    uint32_t num;   // 页数
+} page_extent_t;
+
+int pglist_extents(uint32_t *blk, page_extent_t *ext, int max);
+
+// 分配内容全为零的物理页，优先使用空闲 CPU 预先清零的页
+size_t page_alloc_zeroed(uint32_t rank, page_type_t type);
+int pagelist_alloc_zeroed(pglist_t *pl, uint32_t num, page_type_t type);
+int page_zero_fill();
+uint32_t page_zero_count();
+
+// 写时复制，共享计数只在块头记录，unshare 返回 1 表示调用者是唯一的使用者
+void page_share(size_t pa);
+int page_unshare(size_t pa);
+int page_shared(size_t pa);
+
 uint32_t page_free_count();
+int page_has_free_block(uint32_t rank);
+
+// 空闲内存水位线
+typedef enum page_wmark {
+    WMARK_MIN  = 0, // 低于此值，分配者同步回收
+    WMARK_LOW  = 1, // 低于此值，唤醒后台回收任务
+    WMARK_HIGH = 2, // 后台回收的目标
+} page_wmark_t;
+
+uint32_t page_watermark(page_wmark_t mark);
+
+// 内存回收，wakeup 唤醒后台回收任务，reclaim 同步回收并返回释放的页数
+typedef void (*page_wakeup_t)();
+typedef uint32_t (*page_reclaim_t)();
+
+// 内存规整，迁移函数把块中的数据搬到别处，成功后旧块归规整者所有
+typedef int (*page_migrate_t)(uint32_t blk);
+int page_compact(uint32_t rank);
 
 INIT_TEXT void page_init(size_t pa_start, size_t pa_end);
 INIT_TEXT void pages_add(size_t start, size_t end);
 
+// NUMA，节点划分要在 pages_add 之前设置，distance 为 num*num 矩阵，可以为 NULL
+INIT_TEXT void page_node_init(int num, const uint8_t *distance);
+INIT_TEXT void page_set_node(size_t start, size_t end, int node);
+INIT_TEXT void page_numa_enable(const uint8_t *cpu_nodes);
+INIT_TEXT void page_cache_enable();
+INIT_TEXT void page_compact_enable(page_migrate_t migrate);
+INIT_TEXT void page_reclaim_enable(page_wakeup_t wakeup, page_reclaim_t reclaim);
+
 #endif // PAGE_H
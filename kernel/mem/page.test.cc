@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
+#include <vector>
 #include "early_alloc.mock.h"
+#include "page.mock.h"
 
 extern "C" {
     #include "page.h"
@@ -175,6 +177,55 @@ TEST_F(PageTest, AllocColor) {
     }
 }
 
+// period 超过颜色数量，需要在颜色链表中进一步筛选
+TEST_F(PageTest, AllocColorLargePeriod) {
+    init(1, 0x400);
+    add_free(1, 0x400);
+
+    for (int i = 0; i < 3; ++i) {
+        size_t pa = page_alloc_color(0, PT_FS, 0x100, 0x85);
+        EXPECT_NE(pa, 0);
+        EXPECT_EQ((pa >> PAGE_SHIFT) & 0xff, 0x85);
+    }
+    for (int i = 0; i < 2; ++i) {
+        size_t pa = page_alloc_color(2, PT_FS, 0x100, 0x44);
+        EXPECT_NE(pa, 0);
+        EXPECT_EQ((pa >> PAGE_SHIFT) & 0xff, 0x44);
+    }
+}
+
+// 内存严重碎片化时，着色分配仍能找到满足颜色的页，耗时见 kbench
+TEST_F(PageTest, AllocColorFragmented) {
+    const uint32_t start = 0x10000;
+    const uint32_t end = 0x30000;
+    init(start, end);
+    add_free(start, end);
+
+    // 每两个页释放一个，得到大量无法合并的 rank-0 空闲块
+    std::vector<size_t> pages;
+    while (size_t pa = page_alloc(0, PT_FS)) {
+        pages.push_back(pa);
+    }
+    for (size_t pa : pages) {
+        if ((pa >> PAGE_SHIFT) & 1) {
+            page_free(pa);
+        }
+    }
+    uint32_t nfree = page_free_count();
+    EXPECT_EQ(nfree, (end - start) / 2);
+
+    // 只有 1/64 的空闲页满足颜色要求
+    const uint32_t period = 0x80;
+    const int count = (int)(nfree * 2 / period);
+    for (int i = 0; i < count; ++i) {
+        uint32_t phase = (2 * (uint32_t)i + 1) & (period - 1);
+        size_t pa = page_alloc_color(0, PT_FS, period, phase);
+        ASSERT_NE(pa, 0);
+        ASSERT_EQ((pa >> PAGE_SHIFT) & (period - 1), phase);
+    }
+    EXPECT_EQ(page_free_count(), nfree - count);
+}
+
 TEST_F(PageTest, AllocList) {
     init(1, 100);
     add_free(1, 100);
@@ -220,3 +271,332 @@ TEST_F(PageTest, AllocListFragmented) {
     }
     EXPECT_EQ(page_num, 63);
 }
+
+// 优先返回对齐的大块，排在链表开头，剩余部分接在后面
+TEST_F(PageTest, AllocListAligned) {
+    init(1, 0x1000);
+    add_free(1, 0x1000);
+
+    pglist_t pl;
+    ASSERT_TRUE(pagelist_alloc_aligned(&pl, 0x205, 9, PT_FS));
+
+    uint32_t blk = pl.head;
+    EXPECT_EQ(g_pages[blk].rank, 9);
+    EXPECT_EQ(blk & 0x1ff, 0);
+
+    uint32_t page_num = 0;
+    for (; blk; blk = g_pages[blk].next) {
+        page_num += 1U << g_pages[blk].rank;
+    }
+    EXPECT_EQ(page_num, 0x205);
+    EXPECT_EQ(page_free_count(), 0xfff - 0x205);
+
+    pagelist_free(&pl);
+    EXPECT_EQ(page_free_count(), 0xfff);
+}
+
+// 没有足够大的块时，退化为普通分配
+TEST_F(PageTest, AllocListAlignedFallback) {
+    init(1, 0x400);
+    add_free(1, 0x1ff);
+    add_free(0x200, 0x3ff);
+
+    pglist_t pl;
+    ASSERT_TRUE(pagelist_alloc_aligned(&pl, 0x200, 9, PT_FS));
+
+    uint32_t page_num = 0;
+    for (uint32_t blk = pl.head; blk; blk = g_pages[blk].next) {
+        EXPECT_LT(g_pages[blk].rank, 9);
+        page_num += 1U << g_pages[blk].rank;
+    }
+    EXPECT_EQ(page_num, 0x200);
+    pagelist_free(&pl);
+}
+
+// 块数等于 num 二进制中 1 的个数，从大到小排列，每个块都按自身大小对齐
+TEST_F(PageTest, AllocListFewest) {
+    init(1, 0x1000);
+    add_free(1, 0x1000);
+
+    pglist_t pl;
+    ASSERT_TRUE(pagelist_alloc_fewest(&pl, 0x305, PT_FS));
+
+    uint32_t ranks[] = { 9, 8, 2, 0 };
+    int i = 0;
+    for (uint32_t blk = pl.head; blk; blk = g_pages[blk].next, ++i) {
+        ASSERT_LT(i, 4);
+        EXPECT_EQ(g_pages[blk].rank, ranks[i]);
+        EXPECT_EQ(blk & ((1U << ranks[i]) - 1), 0U);
+    }
+    EXPECT_EQ(i, 4);
+    EXPECT_EQ(page_free_count(), 0xfff - 0x305);
+
+    pagelist_free(&pl);
+    EXPECT_EQ(page_free_count(), 0xfff);
+}
+
+// 大块不足时，需求拆分到更小的 rank
+TEST_F(PageTest, AllocListFewestFragmented) {
+    init(1, 0x100);
+    add_free(1, 0x100);
+
+    std::vector<size_t> pages;
+    while (size_t pa = page_alloc(0, PT_FS)) {
+        pages.push_back(pa);
+    }
+    for (size_t pa : pages) {
+        if (0 == ((pa >> PAGE_SHIFT) & 3)) {
+            page_free(pa);
+        }
+    }
+
+    pglist_t pl;
+    ASSERT_TRUE(pagelist_alloc_fewest(&pl, 5, PT_FS));
+    int blocks = 0;
+    for (uint32_t blk = pl.head; blk; blk = g_pages[blk].next) {
+        EXPECT_EQ(g_pages[blk].rank, 0U);
+        ++blocks;
+    }
+    EXPECT_EQ(blocks, 5);
+    pagelist_free(&pl);
+
+    EXPECT_FALSE(pagelist_alloc_fewest(&pl, 0x100, PT_FS));
+    EXPECT_EQ(page_free_count(), 0x3fU);
+}
+
+// 物理地址相邻的块合并为一个 extent
+TEST_F(PageTest, Extents) {
+    init(1, 0x100);
+
+    pglist_t pl = { 0, 0 };
+    uint32_t blks[][2] = { {0x40, 6}, {0x80, 5}, {0xa0, 4}, {0x10, 3}, {0x18, 0}, {0x20, 0} };
+    for (auto &b : blks) {
+        g_pages[b[0]].head = 1;
+        g_pages[b[0]].rank = b[1];
+        pglist_push_tail(&pl, b[0]);
+    }
+
+    page_extent_t ext[2];
+    uint32_t blk = pl.head;
+    ASSERT_EQ(pglist_extents(&blk, ext, 2), 2);
+    EXPECT_EQ(ext[0].blk, 0x40U);
+    EXPECT_EQ(ext[0].num, 0x70U);
+    EXPECT_EQ(ext[1].blk, 0x10U);
+    EXPECT_EQ(ext[1].num, 9U);
+    EXPECT_EQ(blk, 0x20U);
+
+    ASSERT_EQ(pglist_extents(&blk, ext, 2), 1);
+    EXPECT_EQ(ext[0].blk, 0x20U);
+    EXPECT_EQ(ext[0].num, 1U);
+    EXPECT_EQ(blk, 0U);
+}
+
+// 模拟页迁移，只分配新块，旧块交给规整者
+static std::vector<uint32_t> g_migrated;
+static int fake_migrate(uint32_t blk) {
+    if (0 == page_alloc_color(g_pages[blk].rank, PT_PROC, 1, 0)) {
+        return 0;
+    }
+    g_migrated.push_back(blk);
+    return 1;
+}
+
+// 每隔一页释放一页，碎片化之后通过迁移腾出一个大块
+TEST_F(PageTest, Compact) {
+    init(1, 0x100);
+    add_free(0x40, 0x100);
+
+    std::vector<size_t> pages;
+    while (size_t pa = page_alloc_color(0, PT_PROC, 1, 0)) {
+        pages.push_back(pa);
+    }
+    ASSERT_EQ(pages.size(), 0xc0U);
+    for (size_t pa : pages) {
+        if ((pa >> PAGE_SHIFT) & 1) {
+            page_free(pa);
+        }
+    }
+    ASSERT_EQ(page_alloc_color(4, PT_KERNEL, 1, 0), 0U);
+    EXPECT_FALSE(page_compact(4)); // 没有注册迁移函数
+
+    g_migrated.clear();
+    page_compact_enable(fake_migrate);
+    uint32_t free_num = page_free_count();
+    EXPECT_TRUE(page_compact(4));
+    EXPECT_EQ(g_migrated.size(), 8U);
+    EXPECT_EQ(page_free_count(), free_num);
+
+    size_t pa = page_alloc_color(4, PT_KERNEL, 1, 0);
+    EXPECT_NE(pa, 0U);
+    EXPECT_EQ((pa >> PAGE_SHIFT) & 15, 0U);
+}
+
+// 不可迁移的块不能腾出，隔离的空闲块要放回伙伴系统
+TEST_F(PageTest, CompactUnmovable) {
+    init(1, 0x100);
+    add_free(0x40, 0x100);
+
+    std::vector<size_t> pages;
+    while (size_t pa = page_alloc_color(0, PT_KERNEL, 1, 0)) {
+        pages.push_back(pa);
+    }
+    for (size_t pa : pages) {
+        if ((pa >> PAGE_SHIFT) & 1) {
+            page_free(pa);
+        }
+    }
+
+    page_compact_enable(fake_migrate);
+    uint32_t free_num = page_free_count();
+    EXPECT_FALSE(page_compact(4));
+    EXPECT_EQ(page_free_count(), free_num);
+    EXPECT_NE(page_alloc_color(0, PT_KERNEL, 1, 0), 0U);
+}
+
+static int g_wakeups = 0;
+static void fake_wakeup() {
+    ++g_wakeups;
+}
+
+// 分配之后空闲页低于 low，唤醒后台回收
+TEST_F(PageTest, WatermarkWakeup) {
+    init(1, 0x1000);
+    add_free(1, 0x1000);
+    EXPECT_EQ(page_watermark(WMARK_MIN), 32U);
+    EXPECT_EQ(page_watermark(WMARK_LOW), 40U);
+    EXPECT_EQ(page_watermark(WMARK_HIGH), 48U);
+
+    g_wakeups = 0;
+    page_reclaim_enable(fake_wakeup, NULL);
+
+    pglist_t pl;
+    ASSERT_TRUE(pagelist_alloc(&pl, 0xfff - 40, PT_KERNEL));
+    EXPECT_EQ(page_free_count(), 40U);
+    EXPECT_EQ(g_wakeups, 0);
+
+    size_t pa = page_alloc_color(0, PT_KERNEL, 1, 0);
+    EXPECT_NE(pa, 0U);
+    EXPECT_EQ(g_wakeups, 1);
+
+    page_free(pa);
+    pagelist_free(&pl);
+}
+
+// 两个节点，伙伴块不跨越节点边界，本地节点不足时回退到远端节点
+TEST_F(PageTest, NumaNodes) {
+    init(1, 0x1000);
+    page_node_init(2, NULL);
+    page_set_node((size_t)0x600 << PAGE_SHIFT, (size_t)0x1000 << PAGE_SHIFT, 1);
+    add_free(1, 0x1000);
+
+    validate_block(0x400, 0x600, 9);
+    validate_block(0x600, 0x800, 9);
+    validate_block(0x800, 0x1000, 11);
+    EXPECT_EQ(g_pages[0x400].node, 0U);
+    EXPECT_EQ(g_pages[0x600].node, 1U);
+
+    // 优先使用本地节点（单元测试固定为节点 0）
+    size_t pa = page_alloc(9, PT_KERNEL);
+    ASSERT_NE(pa, 0U);
+    EXPECT_EQ(g_pages[pa >> PAGE_SHIFT].node, 0U);
+    page_free(pa);
+    validate_block(0x400, 0x600, 9); // 释放之后也不会合并
+
+    // 节点 0 没有 2^11 的块，回退到节点 1
+    pa = page_alloc(11, PT_KERNEL);
+    EXPECT_EQ(pa >> PAGE_SHIFT, 0x800U);
+    page_free(pa);
+
+    // 超过节点 0 的页数，剩余部分来自节点 1
+    pglist_t pl;
+    ASSERT_TRUE(pagelist_alloc(&pl, 0x700, PT_KERNEL));
+    uint32_t node0 = 0;
+    uint32_t node1 = 0;
+    for (uint32_t blk = pl.head; blk; blk = g_pages[blk].next) {
+        uint32_t size = 1U << g_pages[blk].rank;
+        (g_pages[blk].node ? node1 : node0) += size;
+    }
+    EXPECT_EQ(node0, 0x5ffU);
+    EXPECT_EQ(node1, 0x101U);
+    pagelist_free(&pl);
+    EXPECT_EQ(page_free_count(), 0xfffU);
+}
+
+// 从块内任意页都能找到块头，块外的页返回 0
+TEST_F(PageTest, BlockHead) {
+    init(1, 0x400);
+    add_free(1, 0x100); // 0x100~0x200 不属于任何块
+    add_free(0x200, 0x400);
+
+    for (uint32_t pfn = 0x200; pfn < 0x400; ++pfn) {
+        EXPECT_EQ(page_block_head(pfn), 0x200);
+    }
+    EXPECT_EQ(page_block_head(0xff), 0x80);
+    EXPECT_EQ(page_block_head(0x150), 0);
+
+    // 拆分之后，块头随之变化
+    size_t pa = page_alloc(0, PT_FS);
+    uint32_t blk = (uint32_t)(pa >> PAGE_SHIFT);
+    EXPECT_EQ(page_block_head(blk), blk);
+    page_free(pa);
+    EXPECT_EQ(page_block_head(0x3ff), 0x200);
+}
+
+// 与逐页回溯的结果一致，在最大的块（rank-15）上查找块头
+// 两种方法的耗时对比见 kbench
+TEST_F(PageTest, BlockHeadMatchesLinear) {
+    const uint32_t start = 0x10000;
+    const uint32_t end = 0x18000;
+    init(start, end);
+    add_free(start, end);
+    validate_block(start, end, 15);
+
+    const uint32_t step = 31; // 均匀抽样块内的页
+    for (uint32_t pfn = start; pfn < end; pfn += step) {
+        uint32_t head = pfn;
+        while (!g_pages[head].head) --head;
+        ASSERT_EQ(head, page_block_head(pfn));
+    }
+}
+
+// 空闲时预先清零的页，分配出去内容全为零
+TEST(PageZero, IdleFill) {
+    PageContext pc(64);
+
+    // 弄脏所有的页再释放
+    std::vector<size_t> pages;
+    while (size_t pa = page_alloc(0, PT_FS)) {
+        memset(idmap_at(pa), 0xcc, PAGE_SIZE);
+        pages.push_back(pa);
+    }
+    for (size_t pa : pages) {
+        page_free(pa);
+    }
+
+    // 空闲页降到 high 水位线就停止填充，剩下的页留给伙伴系统
+    while (page_zero_fill()) {}
+    uint32_t zeroed = page_zero_count();
+    EXPECT_EQ(page_free_count(), page_watermark(WMARK_HIGH));
+    EXPECT_EQ(zeroed, 64U - page_watermark(WMARK_HIGH));
+    ASSERT_GE(zeroed, 9U);
+
+    size_t pa = page_alloc_zeroed(0, PT_PGTBL);
+    ASSERT_NE(pa, 0U);
+    EXPECT_EQ(g_pages[pa >> PAGE_SHIFT].type, PT_PGTBL);
+    for (size_t i = 0; i < PAGE_SIZE; ++i) {
+        ASSERT_EQ(idmap_at(pa)[i], 0);
+    }
+    page_free(pa);
+
+    // 多个页，一部分来自清零池，一部分同步清零
+    pglist_t pl;
+    ASSERT_TRUE(pagelist_alloc_zeroed(&pl, 8, PT_PROC));
+    uint32_t num = 0;
+    for (uint32_t blk = pl.head; blk; blk = g_pages[blk].next) {
+        EXPECT_EQ(g_pages[blk].type, PT_PROC);
+        num += 1U << g_pages[blk].rank;
+    }
+    EXPECT_EQ(num, 8U);
+    EXPECT_EQ(page_zero_count(), zeroed - 1U - 8U);
+    pagelist_free(&pl);
+}
@@ -3,6 +3,9 @@
 #include <arch_api.h>
 #include <debug.h>
 
+#include <kshell.h>
+#include <console.h>
+
 
 
 // 基于 SLUB 实现的内存池，可以实现相同大小对象的高效分配回收
@@ -12,11 +15,14 @@
 // object 有已分配和未分配两种状态，未分配对象也称 free-object，组成一个链表（freelist）
 
 
-// 一个内存池包含多个 slab，一个 slab 就是一个页
+// 一个内存池包含多个 slab，一个 slab 就是 2^slab_order 个页
 // 每个 slab 划分为若干固定大小的 object，free-object 组成单链表
 // free-object 开头两字节就是 next-free，不是指针，而是相对 slab 的偏移量
-// slab 只有一个页，因此使用 uint16 表示偏移量就足够了
+// slab 不超过 POOL_ORDER_MAX，因此使用 uint16 表示偏移量就足够了
 // 页描述符里面，objects 指向第一个 free-object
+//
+// slab_order 选择末尾剩余空间比例最小的 rank，对象较大时可以装下更多对象
+// 高阶分配失败时退回单页 slab（对象不超过一页），每个 slab 的容量由页描述符的 rank 计算
 
 // slab 按占用情况分属三个链表：
 //  - empty   : 全部未分配，ent_num==0
@@ -26,40 +32,113 @@
 //
 // 分配时优先从 partial 头部（空闲最多）取，释放时按 ent_num 重排
 // 链表以维持这个顺序。empty 和 full 链表不分顺序。
+//
+// 快速路径：每个 CPU 独占一个 slab（frozen），把它的整个 freelist 取到本地
+// 本 CPU 分配、释放这个 slab 的对象，只需关闭中断操作本地 freelist，不用获取锁
+// 其他 slab 的对象（远程释放）在锁内放回所属 slab 的 freelist，frozen slab 不在任何链表中
+// 本地 freelist 耗尽，先取回远程释放的对象，仍然没有才换一个 slab
+// frozen slab 的 ent_num 包括已分配的对象和本地 freelist 中的对象
 
 
 
 
 #define NO_OBJ 0xFFFFU
 
+// 每个 CPU 独占的 slab 和本地 freelist
+typedef struct pool_cpu {
+    uint32_t slab;  // 0 表示没有
+    uint16_t head;  // 本地 freelist，格式与 slab 的 freelist 相同
+    uint16_t count;
+} pool_cpu_t;
+
+// slab 最大 32K，对象偏移量不会超出 uint16
+#define POOL_ORDER_MAX  3
+
+// 剩余空间不超过 slab 的 1/16 就足够好了，不再尝试更大的 rank
+#define POOL_WASTE_SHIFT 4
+
+// percpu 变量只能静态定义，每个 pool 占用一个编号，超出的 pool 只有慢速路径
+#define POOL_PERCPU_NUM 32
+
+// percpu 需要在 thiscpu_init 之后才能访问
+// 单元测试没有 percpu，快速路径始终关闭
+static CONST int g_pool_percpu_on = 0;
+static PERCPU_BSS pool_cpu_t g_pool_cpus[POOL_PERCPU_NUM];
+static _Atomic int g_pool_slot_num = 0;
+
 static inline size_t align_up(size_t x, size_t align) {
     return (x + align - 1) & ~(align - 1);
 }
 
+static inline size_t slab_base(uint32_t slab) {
+    return GUARDED_IDMAP_ADDR + ((size_t)slab << (PAGE_SHIFT + 1));
+}
+
+static inline size_t slab_size(uint32_t slab) {
+    return PAGE_SIZE << g_pages[slab].rank;
+}
+
+static inline uint32_t slab_capacity(pool_t *slub, uint32_t slab) {
+    return (uint32_t)(slab_size(slab) / slub->obj_size);
+}
+
+// 选择末尾浪费比例最小的 slab rank
+static uint8_t choose_order(size_t obj_size) {
+    uint8_t best = 0;
+    size_t best_waste = (size_t)-1; // 换算到最大 rank 的尺寸，比较的就是比例
+    for (uint8_t order = 0; order <= POOL_ORDER_MAX; ++order) {
+        size_t size = PAGE_SIZE << order;
+        if (size < obj_size) {
+            continue;
+        }
+        size_t waste = (size % obj_size) << (POOL_ORDER_MAX - order);
+        if (waste < best_waste) {
+            best = order;
+            best_waste = waste;
+        }
+        if ((size % obj_size) <= (size >> POOL_WASTE_SHIFT)) {
+            break;
+        }
+    }
+    return best;
+}
+
 //------------------------------------------------------------------------------
 // slab 级别：对象分配与释放
 //------------------------------------------------------------------------------
 
-// TODO 只分配一个页，可能造成严重的浪费
-//      可以为每个 pool 预留足够大的虚拟地址范围，申请新的页，自动追加到末尾
-//      这样 slub 末尾不会有剩余空间，而且 pool 整体只有一个 freelist
-static uint32_t slab_create(size_t obj_size) {
-    size_t pa = page_alloc(0, PT_POOL);
+// 映射到 GUARDED_IDMAP，块按自身大小对齐，映射之后仍然与相邻的块隔开
+// 对象所在页号除以二之后落在块的前半部分，page_block_head 仍能找到块首
+static uint32_t slab_create(pool_t *slub) {
+    size_t obj_size = slub->obj_size;
+    size_t pa = page_alloc(slub->slab_order, PT_POOL);
+    if ((0 == pa) && (0 != slub->slab_order) && (obj_size <= PAGE_SIZE)) {
+        pa = page_alloc(0, PT_POOL);
+    }
     if (0 == pa) {
         return 0;
     }
 
+    uint32_t pfn = (uint32_t)(pa >> PAGE_SHIFT);
+    size_t size = slab_size(pfn);
     size_t va = GUARDED_IDMAP_ADDR + pa * 2;
-    mmu_map(g_kernel_vm.table, va, va + PAGE_SIZE, pa, MMU_WRITE);
+    mmu_map(g_kernel_vm.table, va, va + size, pa, MMU_WRITE);
 
     // page_alloc 已正确设置 head / rank / type，
     // 但 ent_num / objects 可能残留旧值，显式初始化
-    uint32_t pfn = (uint32_t)(pa >> PAGE_SHIFT);
     g_pages[pfn].ent_num = 0;
     g_pages[pfn].objects = 0; // 指向第一个 object
+    g_pages[pfn].tag = slub->tag;
+    g_pages[pfn].frozen = 0;
 
     // 嵌入式 freelist：每个对象开头 2 字节存下一个对象偏移
-    uint32_t obj_count = (uint32_t)(PAGE_SIZE / obj_size);
+    // 先执行构造函数，再写入 freelist
+    uint32_t obj_count = (uint32_t)(size / obj_size);
+    if (slub->ctor) {
+        for (uint32_t i = 0; i < obj_count; ++i) {
+            slub->ctor(slub, (void*)(va + i * obj_size));
+        }
+    }
     for (uint32_t i = 1, off = obj_size; i < obj_count; ++i) {
         *(uint16_t*)va = off;
         va += obj_size;
@@ -70,20 +149,12 @@ static uint32_t slab_create(size_t obj_size) {
     return pfn;
 }
 
-static void slab_release(uint32_t slab) {
-    size_t va = GUARDED_IDMAP_ADDR + (slab << (PAGE_SHIFT + 1));
-    tlb_shootdown(va, va + PAGE_SIZE);
-    mmu_unmap(g_kernel_vm.table, va, va + PAGE_SIZE);
-    page_free((size_t)slab << PAGE_SHIFT);
-}
-
 static void *slab_obj_alloc(uint32_t slab, size_t obj_size UNUSED) {
     ASSERT(PT_POOL == g_pages[slab].type);
     ASSERT(g_pages[slab].head);
     ASSERT(NO_OBJ != g_pages[slab].objects);
 
-    // char *base = (char*)pfn_to_virt(slab);
-    size_t base = GUARDED_IDMAP_ADDR + ((size_t)slab << (PAGE_SHIFT + 1));
+    size_t base = slab_base(slab);
     uint16_t off = g_pages[slab].objects;
     g_pages[slab].objects = *(uint16_t*)(base + off);
     g_pages[slab].ent_num += 1;
@@ -96,59 +167,241 @@ static void slab_obj_free(uint32_t slab, void *obj) {
     ASSERT(g_pages[slab].head);
     ASSERT(0 != g_pages[slab].ent_num);
 
-    // char *base = (char*)pfn_to_virt(slab);
-    size_t base = GUARDED_IDMAP_ADDR + ((size_t)slab << (PAGE_SHIFT + 1));
+    size_t base = slab_base(slab);
     uint16_t head = g_pages[slab].objects;
     *(uint16_t*)obj = head;
     g_pages[slab].objects = (uint16_t)((size_t)obj - base);
     g_pages[slab].ent_num -= 1;
 }
 
+// 按 ent_num 把 slab 放入对应的链表
+static void slab_put_nolock(pool_t *slub, uint32_t pfn) {
+    if (0 == g_pages[pfn].ent_num) {
+        pglist_push_head(&slub->empty, pfn);
+        return;
+    }
+    if (NO_OBJ == g_pages[pfn].objects) {
+        pglist_push_head(&slub->full, pfn);
+        return;
+    }
+
+    // partial 按 ent_num 升序，从尾部向前找到插入位置
+    uint32_t inuse = g_pages[pfn].ent_num;
+    uint32_t prev = slub->partial.tail;
+    while ((0 != prev) && (inuse < g_pages[prev].ent_num)) {
+        prev = g_pages[prev].prev;
+    }
+    if (0 == prev) {
+        pglist_push_head(&slub->partial, pfn);
+    } else if (prev == slub->partial.tail) {
+        pglist_push_tail(&slub->partial, pfn);
+    } else {
+        uint32_t next = g_pages[prev].next;
+        g_pages[pfn].prev = prev;
+        g_pages[pfn].next = next;
+        g_pages[prev].next = pfn;
+        g_pages[next].prev = pfn;
+    }
+}
+
+//------------------------------------------------------------------------------
+// per-CPU slab
+//------------------------------------------------------------------------------
+
+// 把 slab 剩余的 freelist 全部取到本地
+// 本地 freelist 必须为空，取完之后 slab 的 freelist 为空，ent_num 为对象总数
+static void cpu_take_freelist(pool_t *slub, pool_cpu_t *c) {
+    ASSERT(0 == c->count);
+    uint32_t total = slab_capacity(slub, c->slab);
+    c->head = g_pages[c->slab].objects;
+    c->count = (uint16_t)(total - g_pages[c->slab].ent_num);
+    g_pages[c->slab].objects = NO_OBJ;
+    g_pages[c->slab].ent_num = total;
+}
+
+// 本地 freelist 归还给 slab，slab 不再 frozen，放回链表
+static void cpu_deactivate_nolock(pool_t *slub, pool_cpu_t *c) {
+    uint32_t pfn = c->slab;
+    size_t base = slab_base(pfn);
+    while (c->count) {
+        void *obj = (void*)(base + c->head);
+        c->head = *(uint16_t*)obj;
+        --c->count;
+        slab_obj_free(pfn, obj);
+    }
+    g_pages[pfn].frozen = 0;
+    c->slab = 0;
+    slab_put_nolock(slub, pfn);
+}
+
+// 本地 freelist 为空，先取回远程释放的对象，否则换一个 slab
+// 优先使用 partial 尾部的 slab（空闲最少），将空闲集中在头部
+static int cpu_refill_nolock(pool_t *slub, pool_cpu_t *c) {
+    if (c->slab) {
+        if (NO_OBJ != g_pages[c->slab].objects) {
+            cpu_take_freelist(slub, c);
+            return 1;
+        }
+        cpu_deactivate_nolock(slub, c);
+    }
+
+    uint32_t pfn = slub->partial.tail;
+    if (0 != pfn) {
+        pglist_remove(&slub->partial, pfn);
+    } else if (0 != (pfn = slub->empty.head)) {
+        pglist_remove(&slub->empty, pfn);
+    } else if (0 == (pfn = slab_create(slub))) {
+        return 0;
+    }
+
+    g_pages[pfn].frozen = 1;
+    c->slab = pfn;
+    cpu_take_freelist(slub, c);
+    return 1;
+}
+
+// 需要在 thiscpu_init 之后调用，其他 CPU 启动时会先执行 thiscpu_init
+INIT_TEXT void pool_percpu_enable() {
+    g_pool_percpu_on = 1;
+}
+
 //------------------------------------------------------------------------------
 // 缓存级别：slub 初始化与销毁
 //------------------------------------------------------------------------------
 
-void pool_init(pool_t *slub, size_t obj_size) {
+static uint32_t pool_shrinker(shrinker_t *self, shrink_ctl_t *ctl) {
+    return pool_shrink(containerof(self, pool_t, shrinker), &ctl->slabs);
+}
+
+void pool_init(pool_t *slub, const char *name, size_t obj_size) {
+    pool_init_align(slub, name, obj_size, arch_cacheline_size());
+}
+
+// 对象较小时，按缓存行对齐浪费太多，可以指定更小的对齐
+void pool_init_align(pool_t *slub, const char *name, size_t obj_size, size_t align) {
+    ASSERT(0 == (align & (align - 1)));
+    ASSERT(obj_size >= sizeof(uint16_t));
+    ASSERT(align_up(obj_size, align) <= (PAGE_SIZE << POOL_ORDER_MAX));
+    slub->lock      = SPINLOCK_INIT;
     slub->raw_size  = (uint16_t)obj_size;
-    slub->obj_size  = (uint16_t)align_up(obj_size, arch_cacheline_size());
+    slub->obj_size  = (uint16_t)align_up(obj_size, align);
+    slub->tag       = 0;
+    slub->slab_order = choose_order(slub->obj_size);
+    slub->ctor      = NULL;
     slub->empty     = (pglist_t){0, 0};
     slub->partial   = (pglist_t){0, 0};
     slub->full      = (pglist_t){0, 0};
+
+    slub->slot = atomic_fetch_add(&g_pool_slot_num, 1);
+    if (slub->slot >= POOL_PERCPU_NUM) {
+        slub->slot = -1;
+    }
+
+    shrinker_register(&slub->shrinker, name, pool_shrinker);
+}
+
+// 必须在第一次分配之前设置，已有 slab 中的对象不会补充构造
+void pool_set_ctor(pool_t *slub, pool_ctor_t ctor) {
+    SPINLOCK_SCOPED(&slub->lock);
+    ASSERT(0 == slub->empty.head);
+    ASSERT(0 == slub->partial.head);
+    ASSERT(0 == slub->full.head);
+    slub->ctor = ctor;
 }
 
-void pool_destroy_nolock(pool_t *slub) {
-    // SPINLOCK_SCOPED(&slub->lock);
+// 调用者保证没有其他 CPU 还在使用这个 pool
+void pool_destroy(pool_t *slub) {
+    shrinker_unregister(&slub->shrinker);
+
+    pglist_t slabs = {0, 0};
+    {
+        SPINLOCK_SCOPED(&slub->lock);
+        if (g_pool_percpu_on && (slub->slot >= 0)) {
+            for (int i = 0; i < cpu_count(); ++i) {
+                pool_cpu_t *c = PERCPU(i, &g_pool_cpus[slub->slot]);
+                if (c->slab) {
+                    g_pages[c->slab].frozen = 0;
+                    pglist_push_tail(&slabs, c->slab);
+                }
+                c->slab = 0;
+                c->count = 0;
+            }
+        }
+
+        uint32_t pfn;
+        while (0 != (pfn = slub->empty.head)) {
+            pglist_remove(&slub->empty, pfn);
+            pglist_push_tail(&slabs, pfn);
+        }
+        while (0 != (pfn = slub->partial.head)) {
+            pglist_remove(&slub->partial, pfn);
+            pglist_push_tail(&slabs, pfn);
+        }
+        while (0 != (pfn = slub->full.head)) {
+            pglist_remove(&slub->full, pfn);
+            pglist_push_tail(&slabs, pfn);
+        }
+    }
+    pool_release_slabs(&slabs);
+}
+
+// 取出所有空闲 slab，追加到 slabs 链表，稍后不持有锁再释放，返回页数
+// 各 CPU 独占的 slab 不在 empty 链表中，不会被取出
+uint32_t pool_shrink(pool_t *slub, pglist_t *slabs) {
+    SPINLOCK_SCOPED(&slub->lock);
+    uint32_t num = 0;
     uint32_t pfn;
     while (0 != (pfn = slub->empty.head)) {
         pglist_remove(&slub->empty, pfn);
-        slab_release(pfn);
+        pglist_push_tail(slabs, pfn);
+        num += 1U << g_pages[pfn].rank;
     }
-    while (0 != (pfn = slub->partial.head)) {
-        pglist_remove(&slub->partial, pfn);
-        slab_release(pfn);
-    }
-    while (0 != (pfn = slub->full.head)) {
-        pglist_remove(&slub->full, pfn);
-        slab_release(pfn);
+    return num;
+}
+
+// 解除 slab 的映射，把 [vstart, vend) 扩大到覆盖所有 slab
+void pool_unmap_slabs(pglist_t *slabs, size_t *vstart, size_t *vend) {
+    for (uint32_t pfn = slabs->head; pfn; pfn = g_pages[pfn].next) {
+        size_t va = slab_base(pfn);
+        size_t end = va + slab_size(pfn);
+        mmu_unmap(g_kernel_vm.table, va, end);
+        *vstart = (va < *vstart) ? va : *vstart;
+        *vend = (end > *vend) ? end : *vend;
     }
 }
 
-void pool_shrink_nolock(pool_t *slub) {
-    // SPINLOCK_SCOPED(&slub->lock);
+// 归还已经解除映射、完成 tlb-shootdown 的 slab，返回页数
+uint32_t pool_free_slabs(pglist_t *slabs) {
+    uint32_t num = 0;
     uint32_t pfn;
-    while (0 != (pfn = slub->full.head)) {
-        pglist_remove(&slub->full, pfn);
-        slab_release(pfn);
+    while (0 != (pfn = slabs->head)) {
+        pglist_remove(slabs, pfn);
+        num += 1U << g_pages[pfn].rank;
+        page_free((size_t)pfn << PAGE_SHIFT);
     }
+    return num;
+}
+
+// 释放 pool_shrink 取出的 slab，返回释放的页数
+// 先全部解除映射，再对覆盖所有 slab 的范围执行一次 tlb-shootdown，最后归还物理页
+// 需要执行 tlb-shootdown，不能持有自旋锁
+uint32_t pool_release_slabs(pglist_t *slabs) {
+    if (0 == slabs->head) {
+        return 0;
+    }
+
+    size_t vstart = (size_t)-1;
+    size_t vend = 0;
+    pool_unmap_slabs(slabs, &vstart, &vend);
+    tlb_shootdown(vstart, vend);
+    return pool_free_slabs(slabs);
 }
 
 //------------------------------------------------------------------------------
 // 缓存级别：对象分配与释放
 //------------------------------------------------------------------------------
 
-void *pool_alloc_nolock(pool_t *slub) {
-    // SPINLOCK_SCOPED(&slub->lock);
-
+static void *pool_alloc_nolock(pool_t *slub) {
     // partial 为空时，从 empty 取 slab 或创建新的
     if (0 == slub->partial.head) {
         uint32_t pfn;
@@ -156,7 +409,7 @@ void *pool_alloc_nolock(pool_t *slub) {
             pfn = slub->empty.head;
             pglist_remove(&slub->empty, pfn);
         } else {
-            pfn = slab_create(slub->obj_size);
+            pfn = slab_create(slub);
             if (0 == pfn) {
                 return NULL;
             }
@@ -178,19 +431,20 @@ void *pool_alloc_nolock(pool_t *slub) {
     return obj;
 }
 
-void pool_free_nolock(pool_t *slub, void *obj) {
-    // SPINLOCK_SCOPED(&slub->lock);
-
-    // uint32_t pfn = page_block_head(virt_to_pfn(obj));
-    uint32_t objpg = ((size_t)obj - GUARDED_IDMAP_ADDR) >> (PAGE_SHIFT + 1);
-    uint32_t pfn = page_block_head(objpg);
+static void pool_free_nolock(pool_t *slub, uint32_t pfn, void *obj) {
     uint32_t was_full = (NO_OBJ == g_pages[pfn].objects);
     slab_obj_free(pfn, obj);
+
+    // 其他 CPU 独占的 slab，只放回 freelist，由那个 CPU 取回
+    if (g_pages[pfn].frozen) {
+        return;
+    }
+
     uint32_t inuse = g_pages[pfn].ent_num;
 
     // 完全空闲 → empty
     if (0 == inuse) {
-        pglist_remove(&slub->partial, pfn);
+        pglist_remove(was_full ? &slub->full : &slub->partial, pfn);
         pglist_push_head(&slub->empty, pfn);
         return;
     }
@@ -230,3 +484,153 @@ void pool_free_nolock(pool_t *slub, void *obj) {
         }
     }
 }
+
+// 对象所在 slab 的页号
+uint32_t pool_obj_slab(const void *obj) {
+    uint32_t objpg = ((size_t)obj - GUARDED_IDMAP_ADDR) >> (PAGE_SHIFT + 1);
+    return page_block_head(objpg);
+}
+
+void *pool_alloc(pool_t *slub) {
+    if (!g_pool_percpu_on || (slub->slot < 0)) {
+        SPINLOCK_SCOPED(&slub->lock);
+        return pool_alloc_nolock(slub);
+    }
+
+    void *obj = NULL;
+    int key = cpu_int_disable();
+    pool_cpu_t *c = THISCPU(&g_pool_cpus[slub->slot]);
+    if (0 == c->count) {
+        SPINLOCK_SCOPED(&slub->lock);
+        if (!cpu_refill_nolock(slub, c)) {
+            cpu_int_restore(key);
+            return NULL;
+        }
+    }
+
+    obj = (void*)(slab_base(c->slab) + c->head);
+    c->head = *(uint16_t*)obj;
+    --c->count;
+    cpu_int_restore(key);
+    return obj;
+}
+
+void pool_free(pool_t *slub, void *obj) {
+    uint32_t pfn = pool_obj_slab(obj);
+    ASSERT(slub->tag == g_pages[pfn].tag);
+
+    if (g_pool_percpu_on && (slub->slot >= 0)) {
+        int key = cpu_int_disable();
+        pool_cpu_t *c = THISCPU(&g_pool_cpus[slub->slot]);
+        if (c->slab == pfn) {
+            *(uint16_t*)obj = c->head;
+            c->head = (uint16_t)((size_t)obj - slab_base(pfn));
+            ++c->count;
+            cpu_int_restore(key);
+            return;
+        }
+        cpu_int_restore(key);
+    }
+
+    SPINLOCK_SCOPED(&slub->lock);
+    pool_free_nolock(slub, pfn, obj);
+}
+
+// 批量分配 n 个对象，只获取一次锁，每次取走一整个 slab 的 freelist
+// 要么全部成功返回 n，要么全部失败返回 0
+int pool_alloc_bulk(pool_t *slub, int n, void *objs[]) {
+    int got = 0;
+
+    if (!g_pool_percpu_on || (slub->slot < 0)) {
+        SPINLOCK_SCOPED(&slub->lock);
+        for (; got < n; ++got) {
+            objs[got] = pool_alloc_nolock(slub);
+            if (NULL == objs[got]) {
+                break;
+            }
+        }
+    } else {
+        int key = cpu_int_disable();
+        pool_cpu_t *c = THISCPU(&g_pool_cpus[slub->slot]);
+        {
+            SPINLOCK_SCOPED(&slub->lock);
+            while (got < n) {
+                if ((0 == c->count) && !cpu_refill_nolock(slub, c)) {
+                    break;
+                }
+                size_t base = slab_base(c->slab);
+                for (; (got < n) && c->count; ++got) {
+                    objs[got] = (void*)(base + c->head);
+                    c->head = *(uint16_t*)objs[got];
+                    --c->count;
+                }
+            }
+        }
+        cpu_int_restore(key);
+    }
+
+    if (got < n) {
+        pool_free_bulk(slub, got, objs);
+        return 0;
+    }
+    return n;
+}
+
+// 批量释放，本 CPU 独占 slab 的对象放回本地 freelist，其余对象只获取一次锁
+void pool_free_bulk(pool_t *slub, int n, void *objs[]) {
+    int key = 0;
+    pool_cpu_t *c = NULL;
+    if (g_pool_percpu_on && (slub->slot >= 0)) {
+        key = cpu_int_disable();
+        c = THISCPU(&g_pool_cpus[slub->slot]);
+    }
+
+    {
+        SPINLOCK_SCOPED(&slub->lock);
+        for (int i = 0; i < n; ++i) {
+            uint32_t pfn = pool_obj_slab(objs[i]);
+            ASSERT(slub->tag == g_pages[pfn].tag);
+            if (c && (c->slab == pfn)) {
+                *(uint16_t*)objs[i] = c->head;
+                c->head = (uint16_t)((size_t)objs[i] - slab_base(pfn));
+                ++c->count;
+            } else {
+                pool_free_nolock(slub, pfn, objs[i]);
+            }
+        }
+    }
+
+    if (c) {
+        cpu_int_restore(key);
+    }
+}
+
+// 统计 slab 数量、已分配对象数量、slab 占用的总字节数
+// 各 CPU 本地 freelist 中的对象不算已分配
+void pool_usage(pool_t *slub, uint32_t *slabs, size_t *inuse, size_t *bytes) {
+    *slabs = 0;
+    *inuse = 0;
+    *bytes = 0;
+
+    SPINLOCK_SCOPED(&slub->lock);
+    pglist_t *lists[3] = { &slub->empty, &slub->partial, &slub->full };
+    for (int i = 0; i < 3; ++i) {
+        for (uint32_t pfn = lists[i]->head; pfn; pfn = g_pages[pfn].next) {
+            *inuse += g_pages[pfn].ent_num;
+            *bytes += slab_size(pfn);
+            ++*slabs;
+        }
+    }
+
+    // 其他 CPU 可能正在修改，结果仅供参考
+    if (g_pool_percpu_on && (slub->slot >= 0)) {
+        for (int i = 0; i < cpu_count(); ++i) {
+            pool_cpu_t *c = PERCPU(i, &g_pool_cpus[slub->slot]);
+            if (c->slab) {
+                *inuse += g_pages[c->slab].ent_num - c->count;
+                *bytes += slab_size(c->slab);
+                ++*slabs;
+            }
+        }
+    }
+}
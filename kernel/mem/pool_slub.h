@@ -4,21 +4,45 @@
 #include <wheel.h>
 #include <spinlock.h>
 #include <page.h>
+#include <shrinker.h>
 
-typedef struct pool {
-    // spinlock_t   lock;
+typedef struct pool pool_t;
+
+// 对象构造函数，只在创建 slab 时对每个对象调用一次
+// 释放对象时必须恢复构造后的状态，再次分配就不用重新初始化
+// 空闲对象开头两字节用作 freelist，构造的状态不能放在这里
+// 可能在持有 pool 锁、关中断时调用，不能阻塞，也不能分配内存
+typedef void (*pool_ctor_t)(pool_t *slub, void *obj);
+
+struct pool {
+    spinlock_t lock;
+    int      slot;              // per-CPU slab 的编号，-1 表示没有快速路径
     uint16_t raw_size;
     uint16_t obj_size;
-    // uint8_t  slab_order;        // slab 的页分配 rank
+    uint8_t  tag;               // 写入每个 slab 的页描述符，可以由对象找到所属的 pool
+    uint8_t  slab_order;        // slab 的页分配 rank
+    pool_ctor_t ctor;           // 可以为 NULL
     pglist_t empty;             // 全部空闲
     pglist_t partial;           // 部分占用，按 ent_num 升序（空闲多的靠前）
     pglist_t full;              // 全部占用
-} pool_t;
+    shrinker_t shrinker;        // 内存不足时释放 empty 中的 slab
+};
+
+void  pool_init(pool_t *slub, const char *name, size_t obj_size);
+void  pool_init_align(pool_t *slub, const char *name, size_t obj_size, size_t align);
+void  pool_set_ctor(pool_t *slub, pool_ctor_t ctor);
+void  pool_destroy(pool_t *slub);
+uint32_t pool_shrink(pool_t *slub, pglist_t *slabs);
+void  pool_unmap_slabs(pglist_t *slabs, size_t *vstart, size_t *vend);
+uint32_t pool_free_slabs(pglist_t *slabs);
+uint32_t pool_release_slabs(pglist_t *slabs);
+void *pool_alloc(pool_t *slub);
+void  pool_free(pool_t *slub, void *obj);
+int   pool_alloc_bulk(pool_t *slub, int n, void *objs[]);
+void  pool_free_bulk(pool_t *slub, int n, void *objs[]);
+uint32_t pool_obj_slab(const void *obj);
+void  pool_usage(pool_t *slub, uint32_t *slabs, size_t *inuse, size_t *bytes);
 
-void  pool_init(pool_t *slub, size_t obj_size);
-void  pool_destroy_nolock(pool_t *slub);
-void  pool_shrink_nolock(pool_t *slub);
-void *pool_alloc_nolock(pool_t *slub);
-void  pool_free_nolock(pool_t *slub, void *obj);
+INIT_TEXT void pool_percpu_enable();
 
 #endif // POOL_SLUB_H
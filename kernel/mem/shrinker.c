@@ -0,0 +1,87 @@
+#include "shrinker.h"
+#include "pool_slub.h"
+#include <arch_api.h>
+#include <spinlock.h>
+#include <debug.h>
+
+#include <kshell.h>
+#include <console.h>
+
+
+// 内存回收的注册表，空闲内存不足时依次调用每个 shrinker
+// 每个内存池在初始化时注册，文件系统缓存等也可以注册
+// pool 把空闲 slab、kstack 缓存把解除映射的栈交给这里，最后只执行一次 tlb-shootdown
+
+static spinlock_t g_shrinker_lock = SPINLOCK_INIT;
+static DEFINE_DL_HEAD(g_shrinkers);
+
+
+void shrinker_register(shrinker_t *s, const char *name, shrink_func_t shrink) {
+    ASSERT(NULL != s);
+    ASSERT(NULL != shrink);
+
+    s->name = name;
+    s->shrink = shrink;
+    s->calls = 0;
+    s->pages = 0;
+
+    SPINLOCK_SCOPED(&g_shrinker_lock);
+    dl_insert_before(&s->dl, &g_shrinkers);
+}
+
+void shrinker_unregister(shrinker_t *s) {
+    SPINLOCK_SCOPED(&g_shrinker_lock);
+    ASSERT(dl_contains(&g_shrinkers, &s->dl));
+    dl_remove(&s->dl);
+}
+
+// 调用所有 shrinker，返回回收的页数
+// 释放 slab 需要执行 tlb-shootdown，不能持有自旋锁
+uint32_t shrink_all() {
+    shrink_ctl_t ctl = { {0, 0}, {0, 0}, (size_t)-1, 0, NULL };
+    uint32_t num = 0;
+    {
+        SPINLOCK_SCOPED(&g_shrinker_lock);
+        for (dlnode_t *i = g_shrinkers.next; i != &g_shrinkers; i = i->next) {
+            shrinker_t *s = containerof(i, shrinker_t, dl);
+            uint32_t got = s->shrink(s, &ctl);
+            ++s->calls;
+            s->pages += got;
+            num += got;
+        }
+    }
+
+    pool_unmap_slabs(&ctl.slabs, &ctl.vstart, &ctl.vend);
+    if (ctl.vstart < ctl.vend) {
+        tlb_shootdown(ctl.vstart, ctl.vend);
+    }
+    pool_free_slabs(&ctl.slabs);
+    pagelist_free(&ctl.pages);
+
+    // 其他 CPU 不再有这些地址的 TLB 条目，可以重新分配了
+    while (ctl.defers) {
+        shrink_defer_t *defer = ctl.defers;
+        ctl.defers = defer->next;
+        defer->release(defer);
+    }
+    return num;
+}
+
+//------------------------------------------------------------------------------
+// 调试命令，显示每个 shrinker 回收的页数
+//------------------------------------------------------------------------------
+
+#ifndef UNIT_TEST
+
+static void show_shrinkers() {
+    SPINLOCK_SCOPED(&g_shrinker_lock);
+    for (dlnode_t *i = g_shrinkers.next; i != &g_shrinkers; i = i->next) {
+        shrinker_t *s = containerof(i, shrinker_t, dl);
+        console_printf("%-16s calls %zu, reclaimed %zu pages\n",
+            s->name, s->calls, s->pages);
+    }
+}
+
+KSHELL_CMD("shrink", show_shrinkers);
+
+#endif // UNIT_TEST
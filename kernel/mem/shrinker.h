@@ -0,0 +1,43 @@
+#ifndef SHRINKER_H
+#define SHRINKER_H
+
+#include <wheel.h>
+#include <dllist.h>
+#include "page.h"
+
+typedef struct shrinker shrinker_t;
+
+// 解除映射之后仍然保留的虚拟地址，shootdown 之前不能被重新分配
+// shrink_all 执行 tlb-shootdown 之后调用 release 删除，节点由 shrinker 提供
+typedef struct shrink_defer {
+    struct shrink_defer *next;
+    void (*release)(struct shrink_defer *self);
+} shrink_defer_t;
+
+// 一轮回收收集到的内存，shrink_all 统一执行一次 tlb-shootdown 再释放
+typedef struct shrink_ctl {
+    pglist_t slabs;     // pool 的空闲 slab，尚未解除映射
+    pglist_t pages;     // 已经解除映射的物理页
+    size_t   vstart;    // pages 原先映射的虚拟地址范围
+    size_t   vend;
+    shrink_defer_t *defers;
+} shrink_ctl_t;
+
+// 释放缓存，返回回收的页数
+// 在持有注册表锁时调用，不能阻塞，也不能执行 tlb-shootdown
+// 需要 tlb-shootdown 的内存放进 ctl，由 shrink_all 统一释放
+typedef uint32_t (*shrink_func_t)(shrinker_t *self, shrink_ctl_t *ctl);
+
+struct shrinker {
+    dlnode_t      dl;
+    const char   *name;
+    shrink_func_t shrink;
+    size_t        calls;
+    size_t        pages;    // 累计回收的页数
+};
+
+void shrinker_register(shrinker_t *s, const char *name, shrink_func_t shrink);
+void shrinker_unregister(shrinker_t *s);
+uint32_t shrink_all();
+
+#endif // SHRINKER_H
@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+    #include "shrinker.h"
+}
+
+// 假的缓存，每次回收固定页数，不产生需要解除映射的 slab
+struct FakeCache {
+    shrinker_t shrinker;
+    uint32_t   pages;
+};
+
+static uint32_t fake_shrink(shrinker_t *self, shrink_ctl_t *ctl) {
+    (void)ctl;
+    FakeCache *cache = containerof(self, FakeCache, shrinker);
+    uint32_t got = cache->pages;
+    cache->pages = 0;
+    return got;
+}
+
+TEST(Shrinker, SumAndCount) {
+    FakeCache a = { {}, 3 };
+    FakeCache b = { {}, 5 };
+    shrinker_register(&a.shrinker, "fake-a", fake_shrink);
+    shrinker_register(&b.shrinker, "fake-b", fake_shrink);
+
+    EXPECT_EQ(8U, shrink_all());
+    EXPECT_EQ(1U, a.shrinker.calls);
+    EXPECT_EQ(3U, a.shrinker.pages);
+    EXPECT_EQ(5U, b.shrinker.pages);
+
+    // 已经回收完，再调用不会重复计数
+    EXPECT_EQ(0U, shrink_all());
+    EXPECT_EQ(2U, b.shrinker.calls);
+    EXPECT_EQ(5U, b.shrinker.pages);
+
+    shrinker_unregister(&a.shrinker);
+    b.pages = 2;
+    EXPECT_EQ(2U, shrink_all());
+    EXPECT_EQ(2U, a.shrinker.calls);    // 已注销，不再调用
+    shrinker_unregister(&b.shrinker);
+}
+
+// 保留的地址在所有 shrinker 返回之后才释放
+struct FakeDefer {
+    shrinker_t     shrinker;
+    shrink_defer_t defer;
+    int            released;
+};
+
+static void fake_release(shrink_defer_t *defer) {
+    FakeDefer *f = containerof(defer, FakeDefer, defer);
+    ++f->released;
+}
+
+static uint32_t fake_defer_shrink(shrinker_t *self, shrink_ctl_t *ctl) {
+    FakeDefer *f = containerof(self, FakeDefer, shrinker);
+    EXPECT_EQ(0, f->released);
+    f->defer.release = fake_release;
+    f->defer.next = ctl->defers;
+    ctl->defers = &f->defer;
+    return 1;
+}
+
+TEST(Shrinker, DeferRelease) {
+    FakeDefer f = { {}, {}, 0 };
+    shrinker_register(&f.shrinker, "fake-defer", fake_defer_shrink);
+    EXPECT_EQ(1U, shrink_all());
+    EXPECT_EQ(1, f.released);
+    shrinker_unregister(&f.shrinker);
+}
@@ -0,0 +1,55 @@
+// 地址空间性能测试，一万个范围，随机删除一半，统计查找和分配的延迟
+
+#include <random>
+#include <vector>
+
+#include "kbench.h"
+
+extern "C" {
+    #include "vmspace.h"
+}
+
+KBENCH(vmspace) {
+    (void)opt;
+    const int count = 10000;
+    vmspace_t vm;
+    vmspace_init(&vm, 0x10000000UL, 0x800000000UL);
+    vm.table = 0;
+
+    std::mt19937 gen(1);
+    std::vector<vmrange_t> rngs(count * 2);
+    for (int i = 0; i < count; ++i) {
+        size_t size = (1 + gen() % 4) * PAGE_SIZE;
+        if (NULL == vmspace_alloc_nomap(&vm, &rngs[i], size)) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < count; i += 2) {
+        vmspace_remove(&vm, &rngs[i]);
+    }
+
+    size_t errors = 0;
+    std::vector<uint32_t> lookup_ns;
+    for (int i = 0; i < count; ++i) {
+        vmrange_t *expect = &rngs[(gen() % (count / 2)) * 2 + 1];
+        size_t addr = expect->vaddr + gen() % (expect->vend - expect->vaddr);
+        BenchClock::time_point t0 = BenchClock::now();
+        vmrange_t *got = vmspace_lookup(&vm, addr);
+        lookup_ns.push_back(bench_elapsed(t0));
+        errors += (expect != got);
+    }
+
+    // 分配的大小超过大部分空隙，需要跳过很多范围
+    std::vector<uint32_t> alloc_ns;
+    for (int i = 0; i < count; ++i) {
+        size_t size = (1 + gen() % 6) * PAGE_SIZE;
+        BenchClock::time_point t0 = BenchClock::now();
+        void *va = vmspace_alloc_nomap(&vm, &rngs[count + i], size);
+        alloc_ns.push_back(bench_elapsed(t0));
+        errors += (NULL == va);
+    }
+
+    bench_report("vmspace", "ranges_10k", "vmspace_lookup", lookup_ns);
+    bench_report("vmspace", "ranges_10k", "vmspace_alloc_nomap", alloc_ns);
+    return errors;
+}
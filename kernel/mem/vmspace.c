@@ -6,93 +6,314 @@
 #include <debug.h>
 #include <kshell.h>
 #include <console.h>
+#include <kstring.h>
 
 
 // 内核地址空间布局
 vmspace_t g_kernel_vm;
 
+// 进程地址空间登记在这里，规整时查找物理块属于哪个 vmrange
+static spinlock_t g_space_lock = SPINLOCK_INIT;
+static DEFINE_DL_HEAD(g_space_list);
+
+// 正在迁移的地址空间和虚拟地址范围
+// 迁移期间这段映射是只读的，写操作触发 #PF，返回之后重试
+// 迁移期间范围被删除或重新映射，迁移作废（受 space->lock 保护）
+static vmspace_t *_Atomic g_migrate_space = NULL;
+static _Atomic size_t g_migrate_va = 0;
+static _Atomic size_t g_migrate_vend = 0;
+static int g_migrate_abort = 0;
+
+
+//------------------------------------------------------------------------------
+// 范围索引，增强红黑树
+//------------------------------------------------------------------------------
+
+// 每个 vmrange 记录它与前一个 vmrange 之间可以分配的空间大小（gap）
+// 两侧都要留出 guard page，而且只算动态分配范围 [dyn_start, dyn_end) 之内的部分
+// 红黑树节点再记录子树中最大的 gap，分配时可以跳过整棵没有足够空间的子树
+// 最后一个 vmrange 之后的空间不属于任何节点，单独计算
+
+// 前一个范围之后，可以分配的起始地址，prev 可以是链表头
+static size_t vm_gap_start(vmspace_t *space, dlnode_t *prev) {
+    size_t lo = space->dyn_start;
+    if (&space->head != prev) {
+        vmrange_t *ref = containerof(prev, vmrange_t, dl);
+        size_t end = ((ref->vend + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
+        if (end > lo) {
+            lo = end;
+        }
+    }
+    return lo;
+}
+
+static size_t vm_gap_before(vmspace_t *space, vmrange_t *rng) {
+    size_t lo = vm_gap_start(space, rng->dl.prev);
+    size_t start = rng->vaddr & ~(PAGE_SIZE - 1);
+    if (start < lo + PAGE_SIZE) {
+        return 0;
+    }
+    size_t hi = start - PAGE_SIZE;
+    if (hi > space->dyn_end) {
+        hi = space->dyn_end;
+    }
+    return (hi > lo) ? (hi - lo) : 0;
+}
+
+static void vm_gap_update(rbnode_t *node) {
+    vmrange_t *rng = containerof(node, vmrange_t, rb);
+    size_t max = rng->gap;
+    if (node->left) {
+        vmrange_t *sub = containerof(node->left, vmrange_t, rb);
+        max = (sub->max_gap > max) ? sub->max_gap : max;
+    }
+    if (node->right) {
+        vmrange_t *sub = containerof(node->right, vmrange_t, rb);
+        max = (sub->max_gap > max) ? sub->max_gap : max;
+    }
+    rng->max_gap = max;
+}
+
+// 前一个范围变了，重新计算 gap
+static void vm_gap_fix(vmspace_t *space, dlnode_t *node) {
+    if (&space->head != node) {
+        vmrange_t *rng = containerof(node, vmrange_t, dl);
+        rng->gap = vm_gap_before(space, rng);
+        rb_propagate(&rng->rb, vm_gap_update);
+    }
+}
+
+// 查找 addr 在红黑树中的插入位置，返回起始地址大于 addr 的第一个范围（后继）
+static vmrange_t *vm_find_link(vmspace_t *space, size_t addr,
+        rbnode_t **parent, rbnode_t ***link) {
+    vmrange_t *next = NULL;
+    *parent = NULL;
+    *link = &space->tree.root;
+    while (NULL != **link) {
+        *parent = **link;
+        vmrange_t *cur = containerof(*parent, vmrange_t, rb);
+        if (addr < cur->vaddr) {
+            next = cur;
+            *link = &(*parent)->left;
+        } else {
+            *link = &(*parent)->right;
+        }
+    }
+    return next;
+}
+
+// 加入有序链表和红黑树，后继的 gap 也要更新
+static void vm_link(vmspace_t *space, vmrange_t *rng, vmrange_t *next,
+        rbnode_t *parent, rbnode_t **link) {
+    dl_insert_before(&rng->dl, next ? &next->dl : &space->head);
+    rng->gap = vm_gap_before(space, rng);
+    rng->max_gap = rng->gap;
+    rb_insert_augmented(&space->tree, &rng->rb, parent, link, vm_gap_update);
+    vm_gap_fix(space, rng->dl.next);
+}
+
+static void vm_unlink(vmspace_t *space, vmrange_t *rng) {
+    dlnode_t *next = rng->dl.next;
+    if (space->mru == rng) {
+        space->mru = NULL;
+    }
+    rb_remove_augmented(&space->tree, &rng->rb, vm_gap_update);
+    dl_remove(&rng->dl);
+    vm_gap_fix(space, next);
+}
+
+// 检查 rng 是否位于地址空间中，调试断言使用，不遍历链表
+static inline int vm_contains(vmspace_t *space, vmrange_t *rng) {
+    rbnode_t *node = space->tree.root;
+    while (node) {
+        vmrange_t *cur = containerof(node, vmrange_t, rb);
+        if (cur == rng) {
+            return 1;
+        }
+        node = (rng->vaddr < cur->vaddr) ? node->left : node->right;
+    }
+    return 0;
+}
+
+// 最靠前的、gap 不小于 need 的范围，没有则返回 NULL
+static vmrange_t *vm_find_gap(vmspace_t *space, size_t need) {
+    rbnode_t *node = space->tree.root;
+    if ((NULL == node) || (containerof(node, vmrange_t, rb)->max_gap < need)) {
+        return NULL;
+    }
+
+    while (1) {
+        vmrange_t *rng = containerof(node, vmrange_t, rb);
+        if (node->left && (containerof(node->left, vmrange_t, rb)->max_gap >= need)) {
+            node = node->left;
+        } else if (rng->gap >= need) {
+            return rng;
+        } else {
+            node = node->right;
+            ASSERT(NULL != node);
+        }
+    }
+}
 
 // 在地址空间中添加一个范围，不操作物理地址
 // 不要求前后保留 guard-page
 // 没有冲突则返回 1，有冲突返回 0
 static int vm_alloc_at(vmspace_t *space, vmrange_t *rng) {
-    ASSERT(!dl_contains(&space->head, &rng->dl));
+    ASSERT(!vm_contains(space, rng));
 
-    dlnode_t *node = space->head.next;
-    for (; &space->head != node; node = node->next) {
-        vmrange_t *cur = containerof(node, vmrange_t, dl);
-        if (rng->vaddr < cur->vaddr) {
-            ASSERT(rng->vend <= cur->vaddr);
-            break;
-        }
-        if (rng->vaddr < cur->vend) {
-            return 0; // 有冲突
-        }
+    rbnode_t *parent;
+    rbnode_t **link;
+    vmrange_t *next = vm_find_link(space, rng->vaddr, &parent, &link);
+    dlnode_t *prev = next ? next->dl.prev : space->head.prev;
+    if ((&space->head != prev) && (rng->vaddr < containerof(prev, vmrange_t, dl)->vend)) {
+        return 0; // 与前一个范围冲突
+    }
+    if (next && (next->vaddr < rng->vend)) {
+        return 0; // 与后一个范围冲突
     }
 
-    dl_insert_before(&rng->dl, node);
+    vm_link(space, rng, next, parent, link);
     return 1;
 }
 
-// 寻找一段虚拟内存范围，记录在 rng 里面
+// 指定地址的范围必须完整位于动态分配范围之内，而且不能回绕
+// dyn_end 按页对齐，结束地址向上取整到页边界之后仍然不会越界
+// 进程地址空间的 dyn 范围不包含内核部分，用户不能借此映射内核地址
+static int vm_fixed_ok(vmspace_t *space, size_t addr, size_t size) {
+    if ((0 == size) || (addr < space->dyn_start) || (addr >= space->dyn_end)) {
+        return 0;
+    }
+    return size <= space->dyn_end - addr;
+}
+
+// 寻找一段虚拟内存范围，记录在 rng 里面，起始地址按 align 对齐
 // 找到了返回 1，否则返回 0
-static int vm_alloc(vmspace_t *space, vmrange_t *rng, size_t size) {
-    rng->vaddr = space->dyn_start;
+//
+// 选择地址最低的、对齐之后一定能放下的空隙
+// align 大于一页时，要求 gap 多出 align-PAGE_SIZE，可能跳过碰巧对齐的较小空隙
+static int vm_alloc(vmspace_t *space, vmrange_t *rng, size_t size, size_t align) {
+    ASSERT(0 == (align & (align - 1)));
+
+    vmrange_t *found = vm_find_gap(space, size + align - PAGE_SIZE);
+    size_t lo = vm_gap_start(space, found ? found->dl.prev : space->head.prev);
+
+    rng->vaddr = (lo + align - 1) & ~(align - 1);
     rng->vend = rng->vaddr + size;
     rng->attrs = MMU_NONE;
+    rng->flags = 0;
+    if ((rng->vaddr < lo) || (rng->vend > space->dyn_end)) {
+        return 0;
+    }
+
+    rbnode_t *parent;
+    rbnode_t **link;
+    vmrange_t *next = vm_find_link(space, rng->vaddr, &parent, &link);
+    ASSERT(next == found);
+    vm_link(space, rng, next, parent, link);
+    return 1;
+}
+
+
 
-    // 从前到后顺序遍历，遇到第一个满足大小要求的空间就跳出
-    for (dlnode_t *i = space->head.next; &space->head != i; i = i->next) {
-        vmrange_t *ref = containerof(i, vmrange_t, dl);
-        size_t rng_start = ref->vaddr & ~(PAGE_SIZE - 1);
-        size_t rng_end = (ref->vend + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-        rng_start -= PAGE_SIZE; // 开头留出 guard page
-        rng_end += PAGE_SIZE;   // 结尾留出 guard page
-
-        if (rng->vend <= rng_start) {
-            dl_insert_before(&rng->dl, i);
-            return 1;
-        }
 
-        rng->vaddr = rng_end;
-        rng->vend = rng_end + size;
+
+// 范围即将删除或重新映射，正在进行的迁移作废
+static void vm_migrate_abort(vmspace_t *space, vmrange_t *rng) {
+    if ((space == g_migrate_space)
+    &&  (rng->vaddr < g_migrate_vend)
+    &&  (g_migrate_va < rng->vend)) {
+        g_migrate_abort = 1;
     }
+}
 
-    // rng 添加到最后
-    if (rng->vend <= space->dyn_end) {
-        dl_insert_before(&rng->dl, &space->head);
-        return 1;
+// 为 range 分配物理页
+// 进程内存必须清零，防止泄露其他进程或内核的数据，栈也一并清零
+static int vm_alloc_pages(vmrange_t *rng, uint32_t num, page_type_t type) {
+    if ((PT_PROC == type) || (PT_STACK == type)) {
+        return pagelist_alloc_zeroed(&rng->pages, num, type);
     }
+    return pagelist_alloc_fewest(&rng->pages, num, type);
+}
 
-    return 0;
+// 优先分配大页大小的物理块，排在链表开头，映射到对齐的虚拟地址上
+// 物理块不足时退化为普通分配，仍然能正确映射，只是用不上大页
+static int vm_alloc_large_pages(vmrange_t *rng, uint32_t num, page_type_t type) {
+    if (!pagelist_alloc_aligned(&rng->pages, num, LARGE_PAGE_SHIFT - PAGE_SHIFT, type)) {
+        return 0;
+    }
+    if ((PT_PROC == type) || (PT_STACK == type)) {
+        for (uint32_t blk = rng->pages.head; blk; blk = g_pages[blk].next) {
+            kmemset(idmap_at((size_t)blk << PAGE_SHIFT), 0, PAGE_SIZE << g_pages[blk].rank);
+        }
+    }
+    return 1;
 }
 
 
 
+// 按链表顺序映射 range 的物理页，物理地址连续的块合并为一次 mmu_map
+static void vm_map_pages(size_t tbl, vmrange_t *rng, mmu_attr_t attrs) {
+    page_extent_t ext[8];
+    size_t va = rng->vaddr;
+    uint32_t blk = rng->pages.head;
+    while (blk) {
+        int n = pglist_extents(&blk, ext, 8);
+        for (int i = 0; i < n; ++i) {
+            size_t size = (size_t)ext[i].num << PAGE_SHIFT;
+            mmu_map(tbl, va, va + size, (size_t)ext[i].blk << PAGE_SHIFT, attrs);
+            va += size;
+        }
+    }
+}
+
 
 
 // 创建新的地址空间，包括内核部分的映射
 void vmspace_init(vmspace_t *space, size_t start, size_t end) {
     ASSERT(NULL != space);
     dl_init_circular(&space->head);
+    space->tree.root = NULL;
+    space->mru = NULL;
+    space->lookups = 0;
+    space->hits = 0;
+    space->faults = 0;
+    space->copies = 0;
     space->lock = SPINLOCK_INIT;
     space->dyn_start = start + PAGE_SIZE - 1;
     space->dyn_start &= ~(PAGE_SIZE - 1);
     space->dyn_end = end & ~(PAGE_SIZE - 1);
 }
 
-vmrange_t *vmspace_lookup(vmspace_t *space, size_t addr) {
-    ASSERT(NULL != space);
-    SPINLOCK_SCOPED(&space->lock);
-    for (dlnode_t *i = space->head.next; &space->head != i; i = i->next) {
-        vmrange_t *rng = containerof(i, vmrange_t, dl);
-        if ((rng->vaddr <= addr) && (addr < rng->vend)) {
+// 缺页处理往往连续访问同一个范围，先检查上次查找的结果
+static vmrange_t *vm_lookup(vmspace_t *space, size_t addr) {
+    ++space->lookups;
+    vmrange_t *mru = space->mru;
+    if (mru && (mru->vaddr <= addr) && (addr < mru->vend)) {
+        ++space->hits;
+        return mru;
+    }
+
+    rbnode_t *node = space->tree.root;
+    while (node) {
+        vmrange_t *rng = containerof(node, vmrange_t, rb);
+        if (addr < rng->vaddr) {
+            node = node->left;
+        } else if (addr >= rng->vend) {
+            node = node->right;
+        } else {
+            space->mru = rng;
             return rng;
         }
     }
     return NULL;
 }
 
+vmrange_t *vmspace_lookup(vmspace_t *space, size_t addr) {
+    ASSERT(NULL != space);
+    SPINLOCK_SCOPED(&space->lock);
+    return vm_lookup(space, addr);
+}
+
 // 在地址空间中添加一个范围，不操作物理地址
 // 不检测地址冲突，需要使用者保证
 INIT_TEXT void vmspace_insert(vmspace_t *space, vmrange_t *rng) {
@@ -111,9 +332,9 @@ void *vmspace_alloc_nomap(vmspace_t *space, vmrange_t *rng, size_t size) {
     ASSERT(NULL != rng);
 
     SPINLOCK_SCOPED(&space->lock);
-    ASSERT(!dl_contains(&space->head, &rng->dl));
+    ASSERT(!vm_contains(space, rng));
 
-    if (0 == vm_alloc(space, rng, size)) {
+    if (0 == vm_alloc(space, rng, size, PAGE_SIZE)) {
         // 找不到合适的虚拟地址范围，直接退出
         return NULL;
     }
@@ -132,26 +353,33 @@ void *vmspace_alloc(vmspace_t *space, vmrange_t *rng, size_t size,
     size &= ~(PAGE_SIZE - 1);
 
     SPINLOCK_SCOPED(&space->lock);
-    ASSERT(!dl_contains(&space->head, &rng->dl));
+    ASSERT(!vm_contains(space, rng));
 
-    if (0 == vm_alloc(space, rng, size)) {
+    // 大范围按大页对齐，物理页也尽量使用大页大小的块
+    size_t align = PAGE_SIZE;
+    if (size >= LARGE_PAGE_SIZE) {
+        align = LARGE_PAGE_SIZE;
+    }
+
+    if (0 == vm_alloc(space, rng, size, align)) {
         logk("cannot reserve vmrange of size-0x%zx\n", size);
         return NULL;
     }
 
     rng->pages.head = 0;
     rng->pages.tail = 0;
-    if (!pagelist_alloc(&rng->pages, size >> PAGE_SHIFT, type)) {
-        dl_remove(&rng->dl);
+    int got;
+    if (LARGE_PAGE_SIZE == align) {
+        got = vm_alloc_large_pages(rng, size >> PAGE_SHIFT, type);
+    } else {
+        got = vm_alloc_pages(rng, size >> PAGE_SHIFT, type);
+    }
+    if (!got) {
+        vm_unlink(space, rng);
         return NULL;
     }
 
-    size_t va = rng->vaddr;
-    for (uint32_t blk = rng->pages.head; blk; blk = g_pages[blk].next) {
-        size_t blksize = PAGE_SIZE << g_pages[blk].rank;
-        mmu_map(space->table, va, va + blksize, (size_t)blk << PAGE_SHIFT, attrs);
-        va += blksize;
-    }
+    vm_map_pages(space->table, rng, attrs);
 
     rng->attrs = attrs;
     return (void*)rng->vaddr;
@@ -159,9 +387,15 @@ void *vmspace_alloc(vmspace_t *space, vmrange_t *rng, size_t size,
 
 void *vmspace_alloc_at(vmspace_t *space, vmrange_t *rng,
         size_t addr, size_t size, page_type_t type, mmu_attr_t attrs) {
+    if (!vm_fixed_ok(space, addr, size)) {
+        logk("range %zx:%zx out of bound\n", addr, size);
+        return NULL;
+    }
+
     rng->vaddr = addr;
     rng->vend = addr + size;
     rng->attrs = attrs;
+    rng->flags = 0;
 
     SPINLOCK_SCOPED(&space->lock);
     if (0 == vm_alloc_at(space, rng)) {
@@ -172,44 +406,302 @@ void *vmspace_alloc_at(vmspace_t *space, vmrange_t *rng,
     rng->pages.head = 0U;
     rng->pages.tail = 0U;
     size += PAGE_SIZE - 1;
-    if (!pagelist_alloc(&rng->pages, size >> PAGE_SHIFT, type)) {
-        dl_remove(&rng->dl);
+    if (!vm_alloc_pages(rng, size >> PAGE_SHIFT, type)) {
+        vm_unlink(space, rng);
         return NULL;
     }
 
-    size_t va = rng->vaddr;
-    for (uint32_t blk = rng->pages.head; blk; blk = g_pages[blk].next) {
-        size_t blksize = PAGE_SIZE << g_pages[blk].rank;
-        mmu_map(space->table, va, va + blksize, (size_t)blk << PAGE_SHIFT, attrs);
-        va += blksize;
+    vm_map_pages(space->table, rng, attrs);
+
+    return (void*)rng->vaddr;
+}
+
+//------------------------------------------------------------------------------
+// 按需分配
+//------------------------------------------------------------------------------
+
+// 只保留虚拟地址，不分配物理页，也不建立映射
+// 第一次访问某个页触发 #PF，由 vmspace_fault 分配清零的页
+// 用户栈、堆、大缓冲区只占用实际访问过的内存
+void *vmspace_alloc_lazy(vmspace_t *space, vmrange_t *rng, size_t size,
+        page_type_t type, mmu_attr_t attrs) {
+    ASSERT(NULL != space);
+    ASSERT(NULL != rng);
+
+    size += PAGE_SIZE - 1;
+    size &= ~(PAGE_SIZE - 1);
+
+    SPINLOCK_SCOPED(&space->lock);
+    ASSERT(!vm_contains(space, rng));
+
+    if (0 == vm_alloc(space, rng, size, PAGE_SIZE)) {
+        logk("cannot reserve vmrange of size-0x%zx\n", size);
+        return NULL;
     }
 
+    rng->pages.head = 0;
+    rng->pages.tail = 0;
+    rng->attrs = attrs;
+    rng->flags = VM_LAZY;
+    rng->type = type;
     return (void*)rng->vaddr;
 }
 
+void *vmspace_alloc_lazy_at(vmspace_t *space, vmrange_t *rng,
+        size_t addr, size_t size, page_type_t type, mmu_attr_t attrs) {
+    ASSERT(0 == (addr & (PAGE_SIZE - 1)));
+
+    if (!vm_fixed_ok(space, addr, size)) {
+        logk("range %zx:%zx out of bound\n", addr, size);
+        return NULL;
+    }
+
+    size += PAGE_SIZE - 1;
+    size &= ~(PAGE_SIZE - 1);
+    rng->vaddr = addr;
+    rng->vend = addr + size;
+    rng->attrs = attrs;
+    rng->flags = VM_LAZY;
+    rng->type = type;
+
+    SPINLOCK_SCOPED(&space->lock);
+    if (0 == vm_alloc_at(space, rng)) {
+        logk("range %zx:%zx conflict with existing\n", addr, size);
+        return NULL;
+    }
+
+    rng->pages.head = 0U;
+    rng->pages.tail = 0U;
+    return (void*)rng->vaddr;
+}
+
+static int vm_cow_fault(vmspace_t *space, vmrange_t *rng, size_t va, size_t pa, vm_cow_t *cow);
+
+// 缺页处理，在 #PF 中调用，返回 1 表示已经处理，返回之后重新执行出错的指令
+// 访问按需分配范围内尚未映射的页，分配一个清零的页并映射
+// 写入写时复制范围内只读映射的页，复制出私有的块
+// 返回 0 表示不属于这两种情况、权限不符或者内存不足，由调用者报错
+// 复制之后 cow->old 非零，调用者需要开中断调用 vmspace_cow_finish
+int vmspace_fault(vmspace_t *space, size_t va, int write, vm_cow_t *cow) {
+    ASSERT(NULL != space);
+    ASSERT(NULL != cow);
+
+    cow->old = 0;
+
+    SPINLOCK_SCOPED(&space->lock);
+    vmrange_t *rng = vm_lookup(space, va);
+    if ((NULL == rng) || !(rng->flags & (VM_LAZY | VM_COW))) {
+        return 0;
+    }
+    if (write && !(rng->attrs & MMU_WRITE)) {
+        return 0;
+    }
+
+    // 其他 CPU 可能已经处理了同一个页，不存在的页表项不会进入 TLB，直接重试
+    size_t page = va & ~(PAGE_SIZE - 1);
+    mmu_attr_t attrs;
+    size_t pa = mmu_translate(space->table, page, &attrs);
+    if (pa) {
+        if (!write || (attrs & MMU_WRITE)) {
+            return 1;
+        }
+        if (rng->flags & VM_COW) {
+            return vm_cow_fault(space, rng, page, pa, cow);
+        }
+        return 0;
+    }
+    if (!(rng->flags & VM_LAZY)) {
+        return 0;
+    }
+
+    // 写时复制的范围由页表记录物理页，不加入 pages
+    pa = page_alloc_zeroed(0, rng->type);
+    if (0 == pa) {
+        return 0;
+    }
+    if (!(rng->flags & VM_COW)) {
+        pglist_push_tail(&rng->pages, (uint32_t)(pa >> PAGE_SHIFT));
+    }
+    mmu_map(space->table, page, page + PAGE_SIZE, pa, rng->attrs);
+    ++space->faults;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+// 写时复制
+//------------------------------------------------------------------------------
+
+// fork 之后父子进程的页表指向相同的物理块，全部只读映射
+// 同一个块不能同时位于两个范围的 pages 中，所以共享之后由页表记录物理块，pages 保持为空
+// 块总是整体映射，从映射块头的虚拟地址开始遍历，就能找到范围内的每个块
+// 块描述符的 shared 记录共享者数量，写入时复制一份，删除范围时减少计数，没有共享者才释放
+
+// 写入共享的块，复制一份私有的块，映射到原来的位置
+// 如果已经没有其他共享者，不必复制，直接恢复写权限
+// mmu_map 只清除了本 CPU 的旧映射，同一进程的其他线程可能还缓存着指向旧块的只读映射
+// 因此复制之后先不放弃旧块，其他共享者仍会复制而不是写入，旧块也不会释放
+// 由调用者在锁外 shootdown，然后才放弃旧块
+static int vm_cow_fault(vmspace_t *space, vmrange_t *rng, size_t va, size_t pa, vm_cow_t *cow) {
+    uint32_t pfn = (uint32_t)(pa >> PAGE_SHIFT);
+    uint32_t blk = page_block_head(pfn);
+    uint32_t rank = g_pages[blk].rank;
+    size_t size = PAGE_SIZE << rank;
+    size_t bpa = (size_t)blk << PAGE_SHIFT;
+    size_t bva = va - ((size_t)(pfn - blk) << PAGE_SHIFT);
+
+    if (page_shared(bpa)) {
+        // 持有共享期间，其他共享者都不能写入这个块，拷贝的内容是稳定的
+        size_t copy = page_alloc(rank, g_pages[blk].type);
+        if (0 == copy) {
+            return 0;
+        }
+        kmemcpy(idmap_at(copy), idmap_at(bpa), size);
+
+        // 拷贝期间其他共享者可能已经退出，那就继续使用原来的块
+        // 持有 space->lock 就不会出现新的共享者，计数为零的结论是稳定的
+        if (!page_shared(bpa)) {
+            page_free(copy);
+        } else {
+            cow->va = bva;
+            cow->vend = bva + size;
+            cow->old = bpa;
+            bpa = copy;
+            ++space->copies;
+        }
+    }
+
+    mmu_map(space->table, bva, bva + size, bpa, rng->attrs);
+    return 1;
+}
+
+// 写时复制换了物理块，让其他 CPU 清除旧块的映射，再放弃旧块
+// 必须开中断、在锁外调用，shootdown 需要其他 CPU 响应 IPI
+void vmspace_cow_finish(vm_cow_t *cow) {
+    ASSERT(0 != cow->old);
+
+    tlb_shootdown(cow->va, cow->vend);
+    if (page_unshare(cow->old)) {
+        page_free(cow->old);
+    }
+    cow->old = 0;
+}
+
+// 把 from 共享给 to，两边都只读映射，to 加入 dst
+static void vm_share(vmspace_t *dst, vmrange_t *to, vmspace_t *src, vmrange_t *from) {
+    vm_migrate_abort(src, from);
+
+    // 块不再属于 pages，链表直接作废
+    from->flags |= VM_COW;
+    from->pages.head = 0;
+    from->pages.tail = 0;
+
+    to->vaddr = from->vaddr;
+    to->vend  = from->vend;
+    to->pages = from->pages;
+    to->attrs = from->attrs;
+    to->flags = from->flags;
+    to->type  = from->type;
+    to->desc  = from->desc;
+    int ok = vm_alloc_at(dst, to);
+    ASSERT(ok);
+    (void)ok;
+
+    mmu_attr_t ro = from->attrs & ~MMU_WRITE;
+    for (size_t va = from->vaddr; va < from->vend;) {
+        mmu_attr_t attrs;
+        size_t pa = mmu_translate(src->table, va, &attrs);
+        if (0 == pa) {
+            va += PAGE_SIZE; // 按需分配的范围，尚未访问的页
+            continue;
+        }
+
+        uint32_t blk = (uint32_t)(pa >> PAGE_SHIFT);
+        ASSERT(g_pages[blk].head);
+        size_t end = va + (PAGE_SIZE << g_pages[blk].rank);
+        page_share(pa);
+        if (attrs & MMU_WRITE) {
+            mmu_map(src->table, va, end, pa, ro);
+        }
+        mmu_map(dst->table, va, end, pa, ro);
+        va = end;
+    }
+}
+
+// 复制整个地址空间，物理页不复制，而是只读共享，写入时才复制
+// dst 必须是刚创建的空地址空间，页表已经创建
+// 描述符分配失败返回 0，已经共享的范围仍然有效，由调用者删除 dst
+int vmspace_fork(vmspace_t *dst, vmspace_t *src, vmrange_alloc_t alloc) {
+    ASSERT(NULL != dst);
+    ASSERT(NULL != src);
+    ASSERT(dst != src);
+    ASSERT(dl_is_lastone(&dst->head));
+
+    SPINLOCK_SCOPED(&src->lock);
+    SPINLOCK_SCOPED(&dst->lock);
+    for (dlnode_t *i = src->head.next; &src->head != i; i = i->next) {
+        vmrange_t *to = alloc();
+        if (NULL == to) {
+            return 0;
+        }
+        vm_share(dst, to, src, containerof(i, vmrange_t, dl));
+    }
+    return 1;
+}
+
+// 删除写时复制的范围，找出页表中的块，没有其他共享者的块追加到 pages 等待释放
+static void vm_unshare_all(vmspace_t *space, vmrange_t *rng) {
+    for (size_t va = rng->vaddr; va < rng->vend;) {
+        mmu_attr_t attrs;
+        size_t pa = mmu_translate(space->table, va, &attrs);
+        if (0 == pa) {
+            va += PAGE_SIZE;
+            continue;
+        }
+
+        uint32_t blk = (uint32_t)(pa >> PAGE_SHIFT);
+        ASSERT(g_pages[blk].head);
+        va += PAGE_SIZE << g_pages[blk].rank;
+        if (page_unshare(pa)) {
+            pglist_push_tail(&rng->pages, blk);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
 void *vmspace_alloc_kstack(vmspace_t *space, vmrange_t *rng) {
     return vmspace_alloc(space, rng, KSTACK_SIZE, PT_STACK, MMU_WRITE);
 }
-void *vmspace_alloc_ustack(vmspace_t *space, vmrange_t *rng) {
-    return vmspace_alloc(space, rng, USTACK_SIZE, PT_STACK, MMU_WRITE|MMU_USER);
-}
 
 // 映射地址不变，仅改变属性
 // 加载用户态代码段、数据段之后，调用此函数，去掉读权限
 // 此时只有一个线程使用此页表，不用执行 tlb-shootdown
 void vmspace_remap(vmspace_t *space, vmrange_t *rng, mmu_attr_t attrs) {
     SPINLOCK_SCOPED(&space->lock);
-    ASSERT(dl_contains(&space->head, &rng->dl));
+    ASSERT(vm_contains(space, rng));
+    vm_migrate_abort(space, rng);
 
     rng->attrs = attrs;
 
-    // 物理地址可能是不连续的，需要遍历 page-list
-    size_t va = rng->vaddr;
-    for (uint32_t blk = rng->pages.head; blk; blk = g_pages[blk].next) {
-        size_t blksize = PAGE_SIZE << g_pages[blk].rank;
-        mmu_map(space->table, va, va + blksize, (size_t)blk << PAGE_SHIFT, attrs);
-        va += blksize;
+    // 按需分配的 pages 不按地址排序，写时复制的 pages 为空，查页表逐块修改
+    // 写时复制的块可能仍在共享，一律只读映射，写入时由缺页处理恢复
+    if (rng->flags & (VM_LAZY | VM_COW)) {
+        mmu_attr_t mapped = (rng->flags & VM_COW) ? (attrs & ~MMU_WRITE) : attrs;
+        for (size_t va = rng->vaddr; va < rng->vend;) {
+            mmu_attr_t old;
+            size_t pa = mmu_translate(space->table, va, &old);
+            size_t size = PAGE_SIZE;
+            if (pa) {
+                size <<= g_pages[pa >> PAGE_SHIFT].rank;
+                mmu_map(space->table, va, va + size, pa, mapped);
+            }
+            va += size;
+        }
+        return;
     }
+
+    // 物理地址可能是不连续的，需要遍历 page-list
+    vm_map_pages(space->table, rng, attrs);
 }
 
 void vmspace_remove(vmspace_t *space, vmrange_t *rng) {
@@ -217,14 +709,273 @@ void vmspace_remove(vmspace_t *space, vmrange_t *rng) {
     ASSERT(NULL != rng);
 
     SPINLOCK_SCOPED(&space->lock);
-    ASSERT(dl_contains(&space->head, &rng->dl));
+    ASSERT(vm_contains(space, rng));
+    vm_migrate_abort(space, rng);
 
+    if (space->table && (rng->flags & VM_COW)) {
+        vm_unshare_all(space, rng);
+    }
     if (space->table) {
         mmu_unmap(space->table, rng->vaddr, rng->vend);
     }
 
     pagelist_free(&rng->pages);
-    dl_remove(&rng->dl);
+    vm_unlink(space, rng);
+}
+
+// 用 dst 顶替 src 在地址空间中的位置，映射不变，不需要 tlb-shootdown
+// 用于缓存内核栈，描述符换成另一个结构体，范围本身保留
+void vmspace_move(vmspace_t *space, vmrange_t *dst, vmrange_t *src) {
+    ASSERT(NULL != space);
+    ASSERT(dst != src);
+
+    SPINLOCK_SCOPED(&space->lock);
+    ASSERT(vm_contains(space, src));
+    vm_migrate_abort(space, src);
+
+    dst->vaddr = src->vaddr;
+    dst->vend  = src->vend;
+    dst->pages = src->pages;
+    dst->attrs = src->attrs;
+    dst->flags = src->flags;
+    dst->type  = src->type;
+    dst->desc  = src->desc;
+    dst->gap   = src->gap;
+    dst->max_gap = src->max_gap;
+    dl_insert_before(&dst->dl, &src->dl);
+    dl_remove(&src->dl);
+    rb_replace(&space->tree, &src->rb, &dst->rb);
+    if (space->mru == src) {
+        space->mru = dst;
+    }
+}
+
+// 删除范围并解除映射，但不释放物理页，而是追加到 pages，返回页数
+// 写时复制的范围只收集没有其他共享者的块
+static uint32_t vm_detach(vmspace_t *space, vmrange_t *rng, pglist_t *pages) {
+    vm_migrate_abort(space, rng);
+    if (space->table && (rng->flags & VM_COW)) {
+        vm_unshare_all(space, rng);
+    }
+
+    size_t va = rng->vaddr;
+    size_t vend = rng->vend;
+    pglist_t pl = rng->pages;
+    vm_unlink(space, rng);
+    if (space->table) {
+        mmu_unmap(space->table, va, vend);
+    }
+
+    uint32_t num = 0;
+    uint32_t blk;
+    while (0 != (blk = pl.head)) {
+        pglist_remove(&pl, blk);
+        pglist_push_tail(pages, blk);
+        num += 1U << g_pages[blk].rank;
+    }
+    return num;
+}
+
+// 调用者执行 tlb-shootdown 之后才能释放这些页
+// rng 可以位于这段范围之内，解除映射之后不再访问
+uint32_t vmspace_detach(vmspace_t *space, vmrange_t *rng, pglist_t *pages) {
+    ASSERT(NULL != space);
+    ASSERT(NULL != rng);
+
+    SPINLOCK_SCOPED(&space->lock);
+    ASSERT(vm_contains(space, rng));
+    return vm_detach(space, rng, pages);
+}
+
+// 查找并删除从 addr 开始、按页取整之后大小为 size、描述为 desc 的范围
+// 查找和删除在同一个临界区，多个线程删除同一个范围，只有一个能成功
+// 找到则返回描述符，范围的物理页追加到 pages，调用者 shootdown 之后释放
+vmrange_t *vmspace_detach_at(vmspace_t *space, size_t addr, size_t size,
+        const char *desc, pglist_t *pages) {
+    ASSERT(NULL != space);
+
+    SPINLOCK_SCOPED(&space->lock);
+    vmrange_t *rng = vm_lookup(space, addr);
+    if ((NULL == rng) || (rng->vaddr != addr) || (rng->desc != desc)) {
+        return NULL;
+    }
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (size != ((rng->vend - rng->vaddr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))) {
+        return NULL;
+    }
+
+    vm_detach(space, rng, pages);
+    return rng;
+}
+
+// 解除映射，物理页追加到 pages，范围仍然占据这段地址，返回页数
+// 调用者执行 tlb-shootdown 之后再用 vmspace_release 删除，期间地址不会被重新分配
+// rng 不能位于这段范围之内
+uint32_t vmspace_unmap(vmspace_t *space, vmrange_t *rng, pglist_t *pages) {
+    ASSERT(NULL != space);
+    ASSERT(NULL != rng);
+
+    SPINLOCK_SCOPED(&space->lock);
+    ASSERT(vm_contains(space, rng));
+    vm_migrate_abort(space, rng);
+    if (space->table && (rng->flags & VM_COW)) {
+        vm_unshare_all(space, rng);
+    }
+    if (space->table) {
+        mmu_unmap(space->table, rng->vaddr, rng->vend);
+    }
+
+    uint32_t num = 0;
+    uint32_t blk;
+    while (0 != (blk = rng->pages.head)) {
+        pglist_remove(&rng->pages, blk);
+        pglist_push_tail(pages, blk);
+        num += 1U << g_pages[blk].rank;
+    }
+    return num;
+}
+
+// 删除 vmspace_unmap 保留的范围，页表已经清空，不再解除映射
+void vmspace_release(vmspace_t *space, vmrange_t *rng) {
+    ASSERT(NULL != space);
+    ASSERT(NULL != rng);
+    ASSERT(0 == rng->pages.head);
+
+    SPINLOCK_SCOPED(&space->lock);
+    ASSERT(vm_contains(space, rng));
+    vm_unlink(space, rng);
+}
+
+//------------------------------------------------------------------------------
+// 页迁移，用于内存规整
+//------------------------------------------------------------------------------
+
+void vmspace_register(vmspace_t *space) {
+    SPINLOCK_SCOPED(&g_space_lock);
+    dl_insert_before(&space->dl, &g_space_list);
+}
+
+// 等待正在进行的迁移结束，之后地址空间才能销毁
+void vmspace_unregister(vmspace_t *space) {
+    {
+        SPINLOCK_SCOPED(&g_space_lock);
+        dl_remove(&space->dl);
+    }
+    while (atomic_load(&g_migrate_space) == space) {
+        cpu_pause();
+    }
+}
+
+// 按需分配的范围，pages 按缺页顺序排列，查页表才能知道映射的地址
+static int vm_find_lazy_block(vmspace_t *space, vmrange_t *rng, uint32_t blk, size_t *va) {
+    size_t pa = (size_t)blk << PAGE_SHIFT;
+    for (size_t addr = rng->vaddr; addr < rng->vend; addr += PAGE_SIZE) {
+        mmu_attr_t attrs;
+        if (pa == mmu_translate(space->table, addr, &attrs)) {
+            *va = addr;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 查找物理块所在的范围，以及映射的虚拟地址
+static vmrange_t *vm_find_block(vmspace_t *space, uint32_t blk, size_t *va) {
+    for (dlnode_t *i = space->head.next; &space->head != i; i = i->next) {
+        vmrange_t *rng = containerof(i, vmrange_t, dl);
+        if (rng->flags & VM_LAZY) {
+            int found = 0;
+            for (uint32_t b = rng->pages.head; b && !found; b = g_pages[b].next) {
+                found = (b == blk);
+            }
+            if (found && vm_find_lazy_block(space, rng, blk, va)) {
+                return rng;
+            }
+            continue;
+        }
+        size_t addr = rng->vaddr;
+        for (uint32_t b = rng->pages.head; b; b = g_pages[b].next) {
+            if (b == blk) {
+                *va = addr;
+                return rng;
+            }
+            addr += PAGE_SIZE << g_pages[b].rank;
+        }
+    }
+    return NULL;
+}
+
+// 把进程页 blk 的内容搬到新的物理块，重新映射
+// 先改为只读并 shootdown，保证拷贝期间没有写入，拷贝完成再映射到新块
+// 必须在任务上下文调用，成功返回 1，此后旧块不再被任何人使用
+int vmspace_migrate(uint32_t blk) {
+    uint32_t rank = g_pages[blk].rank;
+    size_t size = PAGE_SIZE << rank;
+    size_t pa = page_alloc(rank, PT_PROC);
+    if (0 == pa) {
+        return 0;
+    }
+
+    vmspace_t *space = NULL;
+    vmrange_t *rng = NULL;
+    size_t va = 0;
+    {
+        SPINLOCK_SCOPED(&g_space_lock);
+        for (dlnode_t *i = g_space_list.next; &g_space_list != i; i = i->next) {
+            vmspace_t *sp = containerof(i, vmspace_t, dl);
+            SPINLOCK_SCOPED(&sp->lock);
+            rng = vm_find_block(sp, blk, &va);
+            if (NULL == rng) {
+                continue;
+            }
+
+            // 固定地址空间，迁移结束之前不能销毁
+            space = sp;
+            g_migrate_abort = 0;
+            g_migrate_va = va;
+            g_migrate_vend = va + size;
+            g_migrate_space = sp;
+            mmu_map(sp->table, va, va + size, (size_t)blk << PAGE_SHIFT,
+                    rng->attrs & ~MMU_WRITE);
+            break;
+        }
+    }
+    if (NULL == space) {
+        page_free(pa);
+        return 0;
+    }
+
+    tlb_shootdown(va, va + size);
+    kmemcpy(idmap_at(pa), idmap_at((size_t)blk << PAGE_SHIFT), size);
+
+    int ok;
+    {
+        SPINLOCK_SCOPED(&space->lock);
+        ok = !g_migrate_abort;
+        if (ok) {
+            pglist_replace(&rng->pages, blk, (uint32_t)(pa >> PAGE_SHIFT));
+            mmu_map(space->table, va, va + size, pa, rng->attrs);
+        }
+        g_migrate_va = 0;
+        g_migrate_vend = 0;
+    }
+
+    // 其他 CPU 可能还缓存着指向旧块的只读映射
+    if (ok) {
+        tlb_shootdown(va, va + size);
+    } else {
+        page_free(pa);
+    }
+    atomic_store(&g_migrate_space, NULL);
+    return ok;
+}
+
+// 写入正在迁移的页，#PF 处理函数直接返回，让出错的指令重试
+// 不能在 #PF 里自旋等待，迁移过程需要本 CPU 响应 shootdown IPI
+int vmspace_migrating(size_t va) {
+    return (NULL != g_migrate_space)
+        && (g_migrate_va <= va)
+        && (va < g_migrate_vend);
 }
 
 //------------------------------------------------------------------------------
@@ -241,10 +992,18 @@ void vmspace_show() {
     }
 
     SPINLOCK_SCOPED(&vm->lock);
-    console_printf("vmspace for %s:\n", name);
+    size_t rate = vm->lookups ? (vm->hits * 100 / vm->lookups) : 0;
+    console_printf("vmspace for %s: lookup %zu, mru hit %zu (%zu%%), %zu demand faults, %zu cow copies\n",
+        name, vm->lookups, vm->hits, rate, vm->faults, vm->copies);
     for (dlnode_t *i = vm->head.next; &vm->head != i; i = i->next) {
         vmrange_t *rng = containerof(i, vmrange_t, dl);
         console_printf("vm %-16s %016zx~%016zx -> ", rng->desc, rng->vaddr, rng->vend);
+        if (rng->flags & VM_LAZY) {
+            console_printf("lazy,");
+        }
+        if (rng->flags & VM_COW) {
+            console_printf("cow,");
+        }
         if (0 == rng->pages.head) {
             console_printf("none\n");
         } else if (0 == rng->pages.tail) {
@@ -261,4 +1020,24 @@ void vmspace_show() {
 
 KSHELL_CMD("vm", vmspace_show);
 
+// 手动触发内存规整，默认腾出一个 2M 的块
+static void compact_cmd(int argc, char *argv[]) {
+    uint32_t rank = LARGE_PAGE_SHIFT - PAGE_SHIFT;
+    if (argc > 1) {
+        rank = (uint32_t)str2num(argv[1]);
+    }
+    if (rank >= PAGE_BLOCK_RANK_NUM) {
+        console_printf("usage: %s [RANK], rank must be less than %d\n",
+            argv[0], PAGE_BLOCK_RANK_NUM);
+        return;
+    }
+
+    uint32_t before = page_free_count();
+    int ok = page_compact(rank);
+    console_printf("compact rank-%u %s, free pages %u -> %u\n",
+        rank, ok ? "succeeded" : "failed", before, page_free_count());
+}
+
+KSHELL_CMD("compact", compact_cmd);
+
 #endif // UNIT_TEST
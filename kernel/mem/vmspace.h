@@ -4,25 +4,45 @@
 #include <spinlock.h>
 #include "page.h"
 #include <dllist.h>
+#include <rbtree.h>
 #include <arch_api.h>
 
+// vmrange 标志位
+enum {
+    VM_LAZY = 1,    // 按需分配，缺页时才分配物理页，pages 不按地址排序
+    VM_COW  = 2,    // 写时复制，物理块可能与其他地址空间共享，由页表记录，pages 为空
+};
+
 // 代表一段虚拟地址范围
+// 同时位于有序链表和红黑树中，链表用于顺序遍历，红黑树用于查找
 typedef struct vmrange {
     dlnode_t    dl;
+    rbnode_t    rb;         // 按地址排序
+    size_t      gap;        // 与前一个范围之间可分配的空间（扣除 guard page）
+    size_t      max_gap;    // 子树中最大的 gap
     size_t      vaddr;
     size_t      vend;
 //     size_t      paddr;  // 非零表示映射到连续的物理内存
     pglist_t    pages;  // 映射到不连续的物理内存
     mmu_attr_t  attrs;
+    uint32_t    flags;
+    page_type_t type;       // 按需分配的物理页类型
     const char *desc;
 } vmrange_t;
 
 // 代表一个虚拟地址空间
 typedef struct vmspace {
+    dlnode_t     dl;    // 可迁移地址空间链表
     spinlock_t   lock;
     size_t   dyn_start; // 动态分配范围开始
     size_t   dyn_end;   // 动态分配范围结束
     dlnode_t head;  // vmrange 链表头节点
+    rbtree_t tree;  // 相同的 vmrange，按地址索引
+    vmrange_t *mru; // 最近一次查找到的范围，删除时清空
+    size_t   lookups;
+    size_t   hits;  // 命中 mru 的次数
+    size_t   faults;    // 按需分配处理的缺页次数
+    size_t   copies;    // 写时复制的次数
     size_t   table; // 页表
 } vmspace_t;
 
@@ -43,12 +63,44 @@ void *vmspace_alloc(vmspace_t *space, vmrange_t *rng, size_t size,
 void *vmspace_alloc_at(vmspace_t *space, vmrange_t *rng,
         size_t addr, size_t size, page_type_t type, mmu_attr_t attrs);
 
+// 只划分虚拟地址，访问时由缺页处理分配物理页
+void *vmspace_alloc_lazy(vmspace_t *space, vmrange_t *rng, size_t size,
+        page_type_t type, mmu_attr_t attrs);
+void *vmspace_alloc_lazy_at(vmspace_t *space, vmrange_t *rng,
+        size_t addr, size_t size, page_type_t type, mmu_attr_t attrs);
+// 写时复制换了物理块，旧块的映射可能还在其他 CPU 的 TLB 里
+// shootdown 之后才能放弃旧块，old 为零表示没有换块
+typedef struct vm_cow {
+    size_t va;
+    size_t vend;
+    size_t old;
+} vm_cow_t;
+
+int vmspace_fault(vmspace_t *space, size_t va, int write, vm_cow_t *cow);
+void vmspace_cow_finish(vm_cow_t *cow);
+
+// 写时复制，把 src 的所有范围只读共享给 dst，范围描述符由 alloc 分配
+// src 可写的页改为只读，调用者需要执行 tlb-shootdown
+typedef vmrange_t *(*vmrange_alloc_t)();
+int vmspace_fork(vmspace_t *dst, vmspace_t *src, vmrange_alloc_t alloc);
+
 void *vmspace_alloc_kstack(vmspace_t *space, vmrange_t *rng);
-void *vmspace_alloc_ustack(vmspace_t *space, vmrange_t *rng);
 
 // 仅改变映射的属性
 void vmspace_remap(vmspace_t *space, vmrange_t *rng, mmu_attr_t attrs);
 
 void vmspace_remove(vmspace_t *space, vmrange_t *rng);
+void vmspace_move(vmspace_t *space, vmrange_t *dst, vmrange_t *src);
+uint32_t vmspace_detach(vmspace_t *space, vmrange_t *rng, pglist_t *pages);
+vmrange_t *vmspace_detach_at(vmspace_t *space, size_t addr, size_t size,
+        const char *desc, pglist_t *pages);
+uint32_t vmspace_unmap(vmspace_t *space, vmrange_t *rng, pglist_t *pages);
+void vmspace_release(vmspace_t *space, vmrange_t *rng);
+
+// 页迁移，用于内存规整
+void vmspace_register(vmspace_t *space);
+void vmspace_unregister(vmspace_t *space);
+int vmspace_migrate(uint32_t blk);
+int vmspace_migrating(size_t va);
 
 #endif // VMSPACE_H
@@ -1,7 +1,11 @@
 #include <gtest/gtest.h>
+#include <random>
+#include <vector>
+#include "page.mock.h"
 
 extern "C" {
     #include "vmspace.h"
+    #include <arch_api.h>
 }
 
 TEST(VmSpace, Add) {
@@ -17,3 +21,332 @@ TEST(VmSpace, Add) {
     EXPECT_TRUE(NULL != vmspace_alloc_nomap(&vm, &rng2, PAGE_SIZE));
     EXPECT_TRUE(NULL == vmspace_alloc_nomap(&vm, &rng3, PAGE_SIZE)); // 不足
 }
+
+// 大范围按大页对齐，物理块也是大页，页表只需要很少几个
+TEST(VmSpace, LargePage) {
+    PageContext pc(0x4000);
+
+    vmspace_t vm;
+    vmrange_t rng;
+    vmspace_init(&vm, 0x40001000UL, 0x80000000UL);
+    vm.table = mmu_create();
+
+    uint32_t free_num = page_free_count();
+    size_t size = 2 * LARGE_PAGE_SIZE + 2 * PAGE_SIZE;
+    char *va = (char *)vmspace_alloc(&vm, &rng, size, PT_FS, MMU_WRITE);
+    ASSERT_TRUE(NULL != va);
+    EXPECT_EQ((size_t)va & (LARGE_PAGE_SIZE - 1), 0);
+
+    uint32_t blk = rng.pages.head;
+    EXPECT_EQ(PAGE_SIZE << g_pages[blk].rank, LARGE_PAGE_SIZE);
+    uint32_t next = g_pages[blk].next;
+    EXPECT_EQ(PAGE_SIZE << g_pages[next].rank, LARGE_PAGE_SIZE);
+
+    mmu_attr_t attrs;
+    size_t pa = (size_t)next << PAGE_SHIFT;
+    EXPECT_EQ(mmu_translate(vm.table, (size_t)va + LARGE_PAGE_SIZE + PAGE_SIZE, &attrs), pa + PAGE_SIZE);
+
+    // PDP、PD，以及末尾两个普通页所在的 PT
+    EXPECT_EQ(free_num - page_free_count(), (size >> PAGE_SHIFT) + 3);
+
+    vmspace_remove(&vm, &rng);
+}
+
+static int range_block_count(vmrange_t *rng) {
+    int n = 0;
+    for (uint32_t blk = rng->pages.head; blk; blk = g_pages[blk].next) {
+        ++n;
+    }
+    return n;
+}
+
+// 按需分配的范围，缺页时才分配物理页
+TEST(VmSpace, DemandPaging) {
+    PageContext pc(0x4000);
+
+    vmspace_t vm;
+    vmrange_t rng;
+    vmrange_t ro;
+    vm_cow_t cow;
+    vmspace_init(&vm, 0x40001000UL, 0x80000000UL);
+    vm.table = mmu_create();
+
+    uint32_t free_num = page_free_count();
+    size_t va = (size_t)vmspace_alloc_lazy(&vm, &rng, 64 * PAGE_SIZE, PT_PROC, MMU_WRITE);
+    ASSERT_NE(0U, va);
+    EXPECT_EQ(free_num, page_free_count());
+    EXPECT_EQ(0U, rng.pages.head);
+
+    mmu_attr_t attrs;
+    EXPECT_EQ(0U, mmu_translate(vm.table, va + 5 * PAGE_SIZE, &attrs));
+    EXPECT_TRUE(vmspace_fault(&vm, va + 5 * PAGE_SIZE + 8, 1, &cow));
+    size_t pa = mmu_translate(vm.table, va + 5 * PAGE_SIZE, &attrs);
+    EXPECT_NE(0U, pa);
+    EXPECT_EQ(0, *(uint64_t*)idmap_at(pa + 8)); // 清零的页
+
+    // 已经映射，再次调用直接返回，不重复分配
+    EXPECT_TRUE(vmspace_fault(&vm, va + 5 * PAGE_SIZE, 1, &cow));
+    EXPECT_TRUE(vmspace_fault(&vm, va, 0, &cow));
+    EXPECT_EQ(2U, vm.faults);
+
+    // 范围之外，或者写只读范围，不处理
+    EXPECT_FALSE(vmspace_fault(&vm, va + 64 * PAGE_SIZE, 0, &cow));
+    size_t rva = (size_t)vmspace_alloc_lazy(&vm, &ro, PAGE_SIZE, PT_PROC, MMU_NONE);
+    EXPECT_FALSE(vmspace_fault(&vm, rva, 1, &cow));
+    EXPECT_TRUE(vmspace_fault(&vm, rva, 0, &cow));
+
+    // 删除范围，按需分配的页全部释放（空的页表也会释放）
+    EXPECT_EQ(2, range_block_count(&rng));
+    uint32_t before = page_free_count();
+    vmspace_remove(&vm, &rng);
+    vmspace_remove(&vm, &ro);
+    EXPECT_LE(before + 3, page_free_count());
+}
+
+static vmrange_t g_fork_rngs[4];
+static int g_fork_num = 0;
+
+static vmrange_t *fork_rng_alloc() {
+    return (g_fork_num < 4) ? &g_fork_rngs[g_fork_num++] : NULL;
+}
+
+// fork 之后共享物理页，写入时才复制，删除时最后一个共享者释放
+TEST(VmSpace, CopyOnWrite) {
+    PageContext pc(0x4000);
+
+    vmspace_t parent;
+    vmspace_t child;
+    vmrange_t data;
+    vmrange_t heap;
+    vm_cow_t cow;
+    vmspace_init(&parent, 0x40001000UL, 0x80000000UL);
+    vmspace_init(&child, 0x40001000UL, 0x80000000UL);
+    parent.table = mmu_create();
+    child.table = mmu_create();
+    uint32_t free_num = page_free_count();
+
+    size_t va = (size_t)vmspace_alloc(&parent, &data, 2 * PAGE_SIZE, PT_PROC, MMU_WRITE);
+    size_t hva = (size_t)vmspace_alloc_lazy(&parent, &heap, 8 * PAGE_SIZE, PT_PROC, MMU_WRITE);
+    ASSERT_NE(0U, va);
+    ASSERT_NE(0U, hva);
+    ASSERT_TRUE(vmspace_fault(&parent, hva, 1, &cow));
+
+    mmu_attr_t attrs;
+    size_t pa = mmu_translate(parent.table, va, &attrs);
+    *(uint64_t*)idmap_at(pa) = 0x1234;
+
+    g_fork_num = 0;
+    ASSERT_TRUE(vmspace_fork(&child, &parent, fork_rng_alloc));
+    EXPECT_EQ(2, g_fork_num);
+    EXPECT_TRUE(data.flags & VM_COW);
+    EXPECT_EQ(0U, data.pages.head);
+
+    // 两边映射同一个物理页，都是只读
+    uint32_t used = page_free_count();
+    EXPECT_EQ(pa, mmu_translate(child.table, va, &attrs));
+    EXPECT_FALSE(attrs & MMU_WRITE);
+    EXPECT_EQ(pa, mmu_translate(parent.table, va, &attrs));
+    EXPECT_FALSE(attrs & MMU_WRITE);
+    EXPECT_TRUE(page_shared(pa));
+
+    // 子进程写入，得到内容相同的私有副本
+    EXPECT_TRUE(vmspace_fault(&child, va + 8, 1, &cow));
+    size_t copy = mmu_translate(child.table, va, &attrs);
+    EXPECT_NE(pa, copy);
+    EXPECT_TRUE(attrs & MMU_WRITE);
+    EXPECT_EQ(0x1234U, *(uint64_t*)idmap_at(copy));
+    EXPECT_EQ(1U, child.copies);
+    EXPECT_EQ(used - (1U << g_pages[pa >> PAGE_SHIFT].rank), page_free_count()); // 复制整个块
+
+    // shootdown 之前旧块仍然共享，由调用者放弃（单元测试不能 shootdown）
+    EXPECT_EQ(pa, cow.old);
+    EXPECT_EQ(va, cow.va);
+    EXPECT_TRUE(page_shared(pa));
+    EXPECT_FALSE(page_unshare(cow.old));
+
+    // 父进程已经独占，直接恢复写权限，不再复制
+    EXPECT_FALSE(page_shared(pa));
+    EXPECT_TRUE(vmspace_fault(&parent, va, 1, &cow));
+    EXPECT_EQ(0U, cow.old);
+    EXPECT_EQ(pa, mmu_translate(parent.table, va, &attrs));
+    EXPECT_TRUE(attrs & MMU_WRITE);
+    EXPECT_EQ(0U, parent.copies);
+
+    // 按需分配的范围保持按需分配，尚未访问的页各自分配
+    EXPECT_TRUE(vmspace_fault(&child, hva + PAGE_SIZE, 0, &cow));
+    EXPECT_EQ(0U, mmu_translate(parent.table, hva + PAGE_SIZE, &attrs));
+
+    // 子进程先退出，共享的页仍然属于父进程，可以直接写入
+    size_t hpa = mmu_translate(parent.table, hva, &attrs);
+    vmspace_remove(&child, &g_fork_rngs[0]);
+    vmspace_remove(&child, &g_fork_rngs[1]);
+    EXPECT_FALSE(page_shared(hpa));
+    EXPECT_TRUE(vmspace_fault(&parent, hva, 1, &cow));
+    EXPECT_EQ(hpa, mmu_translate(parent.table, hva, &attrs));
+    EXPECT_EQ(0U, parent.copies);
+
+    vmspace_remove(&parent, &data);
+    vmspace_remove(&parent, &heap);
+    EXPECT_EQ(free_num, page_free_count());
+}
+
+// 指定地址的范围必须位于动态分配范围之内，不能回绕
+TEST(VmSpace, FixedBounds) {
+    vmspace_t vm;
+    vmrange_t rng;
+    vmspace_init(&vm, 0x100000, 0x200000);
+    vm.table = 0;
+
+    EXPECT_TRUE(NULL == vmspace_alloc_lazy_at(&vm, &rng, 0xff000, PAGE_SIZE, PT_PROC, MMU_USER));
+    EXPECT_TRUE(NULL == vmspace_alloc_lazy_at(&vm, &rng, 0x1ff000, 2 * PAGE_SIZE, PT_PROC, MMU_USER));
+    EXPECT_TRUE(NULL == vmspace_alloc_lazy_at(&vm, &rng, 0x200000, PAGE_SIZE, PT_PROC, MMU_USER));
+    EXPECT_TRUE(NULL == vmspace_alloc_lazy_at(&vm, &rng, 0x1ff000, (size_t)-PAGE_SIZE, PT_PROC, MMU_USER));
+    EXPECT_TRUE(NULL == vmspace_alloc_at(&vm, &rng, 0x1ff000, (size_t)-1, PT_PROC, MMU_USER));
+
+    EXPECT_EQ(0x1ff000U, (size_t)vmspace_alloc_lazy_at(&vm, &rng, 0x1ff000, PAGE_SIZE - 8, PT_PROC, MMU_USER));
+    EXPECT_EQ(0x200000U, rng.vend);
+}
+
+// 按地址删除范围，起始地址、大小、描述都要匹配，物理页交给调用者释放
+TEST(VmSpace, DetachAt) {
+    PageContext pc(0x4000);
+
+    static const char desc[] = "mmap";
+    vmspace_t vm;
+    vmrange_t rng;
+    vm_cow_t cow;
+    vmspace_init(&vm, 0x40001000UL, 0x80000000UL);
+    vm.table = mmu_create();
+
+    size_t va = (size_t)vmspace_alloc_lazy(&vm, &rng, 4 * PAGE_SIZE, PT_PROC, MMU_WRITE);
+    ASSERT_NE(0U, va);
+    rng.desc = desc;
+    EXPECT_TRUE(vmspace_fault(&vm, va + PAGE_SIZE, 1, &cow));
+
+    pglist_t pages = { 0, 0 };
+    EXPECT_TRUE(NULL == vmspace_detach_at(&vm, va + PAGE_SIZE, 3 * PAGE_SIZE, desc, &pages));
+    EXPECT_TRUE(NULL == vmspace_detach_at(&vm, va, 2 * PAGE_SIZE, desc, &pages));
+    EXPECT_TRUE(NULL == vmspace_detach_at(&vm, va, 4 * PAGE_SIZE, "mmap", &pages));
+    EXPECT_EQ(&rng, vmspace_detach_at(&vm, va, 4 * PAGE_SIZE - 8, desc, &pages));
+    EXPECT_TRUE(NULL == vmspace_lookup(&vm, va));
+    EXPECT_TRUE(NULL == vmspace_detach_at(&vm, va, 4 * PAGE_SIZE, desc, &pages));
+
+    mmu_attr_t attrs;
+    EXPECT_EQ(0U, mmu_translate(vm.table, va + PAGE_SIZE, &attrs));
+    EXPECT_NE(0U, pages.head);
+    EXPECT_EQ(pages.head, pages.tail);
+    pagelist_free(&pages);
+}
+
+// 解除映射之后地址仍然保留，release 之后才能重新分配
+TEST(VmSpace, UnmapRelease) {
+    PageContext pc(0x4000);
+
+    vmspace_t vm;
+    vmrange_t rng;
+    vmrange_t other;
+    vmspace_init(&vm, 0x40001000UL, 0x80000000UL);
+    vm.table = mmu_create();
+
+    size_t va = (size_t)vmspace_alloc(&vm, &rng, 2 * PAGE_SIZE, PT_KERNEL, MMU_WRITE);
+    ASSERT_NE(0U, va);
+
+    pglist_t pages = { 0, 0 };
+    EXPECT_EQ(2U, vmspace_unmap(&vm, &rng, &pages));
+    EXPECT_EQ(&rng, vmspace_lookup(&vm, va));
+    mmu_attr_t attrs;
+    EXPECT_EQ(0U, mmu_translate(vm.table, va, &attrs));
+
+    size_t next = (size_t)vmspace_alloc(&vm, &other, PAGE_SIZE, PT_KERNEL, MMU_WRITE);
+    EXPECT_TRUE((next >= rng.vend) || (next + PAGE_SIZE <= va));
+    vmspace_remove(&vm, &other);
+
+    vmspace_release(&vm, &rng);
+    EXPECT_TRUE(NULL == vmspace_lookup(&vm, va));
+    pagelist_free(&pages);
+}
+
+// 删除中间的范围，空出来的位置可以重新分配，两侧保留 guard page
+TEST(VmSpace, GapReuse) {
+    vmspace_t vm;
+    vmrange_t rng[4];
+    vmspace_init(&vm, 0x10000, 0x100000);
+    vm.table = 0; // 不映射
+
+    size_t a = (size_t)vmspace_alloc_nomap(&vm, &rng[0], PAGE_SIZE);
+    size_t b = (size_t)vmspace_alloc_nomap(&vm, &rng[1], 2 * PAGE_SIZE);
+    size_t c = (size_t)vmspace_alloc_nomap(&vm, &rng[2], PAGE_SIZE);
+    EXPECT_EQ(a + 2 * PAGE_SIZE, b);
+    EXPECT_EQ(b + 3 * PAGE_SIZE, c);
+
+    vmspace_remove(&vm, &rng[1]);
+    EXPECT_EQ(&rng[0], vmspace_lookup(&vm, a));
+    EXPECT_TRUE(NULL == vmspace_lookup(&vm, b));
+    EXPECT_EQ(&rng[2], vmspace_lookup(&vm, c + PAGE_SIZE - 1));
+
+    // 空隙只有两页，三页放不下，只能放到最后
+    EXPECT_EQ(c + 2 * PAGE_SIZE, (size_t)vmspace_alloc_nomap(&vm, &rng[3], 3 * PAGE_SIZE));
+    EXPECT_EQ(b, (size_t)vmspace_alloc_nomap(&vm, &rng[1], 2 * PAGE_SIZE));
+}
+
+// 重复查找同一个范围命中缓存，删除范围之后缓存失效
+TEST(VmSpace, LookupCache) {
+    vmspace_t vm;
+    vmrange_t rng1;
+    vmrange_t rng2;
+    vmspace_init(&vm, 0x10000, 0x100000);
+    vm.table = 0;
+
+    size_t a = (size_t)vmspace_alloc_nomap(&vm, &rng1, 2 * PAGE_SIZE);
+    size_t b = (size_t)vmspace_alloc_nomap(&vm, &rng2, PAGE_SIZE);
+
+    EXPECT_EQ(&rng1, vmspace_lookup(&vm, a));
+    EXPECT_EQ(&rng1, vmspace_lookup(&vm, a + PAGE_SIZE));
+    EXPECT_EQ(&rng2, vmspace_lookup(&vm, b));
+    EXPECT_EQ(&rng2, vmspace_lookup(&vm, b + 8));
+    EXPECT_EQ(4U, vm.lookups);
+    EXPECT_EQ(2U, vm.hits);
+
+    vmspace_remove(&vm, &rng2);
+    EXPECT_TRUE(NULL == vm.mru);
+    EXPECT_TRUE(NULL == vmspace_lookup(&vm, b));
+    EXPECT_EQ(2U, vm.hits);
+}
+
+// 一万个范围，随机删除一半，查找和分配都正确，耗时见 kbench
+TEST(VmSpace, TenThousandRanges) {
+    const int count = 10000;
+    vmspace_t vm;
+    vmspace_init(&vm, 0x10000000UL, 0x800000000UL);
+    vm.table = 0;
+
+    std::mt19937 gen(1);
+    std::vector<vmrange_t> rngs(count * 2);
+    for (int i = 0; i < count; ++i) {
+        size_t size = (1 + gen() % 4) * PAGE_SIZE;
+        ASSERT_TRUE(NULL != vmspace_alloc_nomap(&vm, &rngs[i], size));
+    }
+    for (int i = 0; i < count; i += 2) {
+        vmspace_remove(&vm, &rngs[i]);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        vmrange_t *expect = &rngs[(gen() % (count / 2)) * 2 + 1];
+        size_t addr = expect->vaddr + gen() % (expect->vend - expect->vaddr);
+        ASSERT_EQ(expect, vmspace_lookup(&vm, addr));
+    }
+
+    // 分配的大小超过大部分空隙，需要跳过很多范围
+    for (int i = 0; i < count; ++i) {
+        size_t size = (1 + gen() % 6) * PAGE_SIZE;
+        ASSERT_TRUE(NULL != vmspace_alloc_nomap(&vm, &rngs[count + i], size));
+    }
+
+    // 所有范围有序、互不重叠，且两侧留有 guard page
+    size_t prev_end = 0;
+    for (dlnode_t *i = vm.head.next; &vm.head != i; i = i->next) {
+        vmrange_t *rng = containerof(i, vmrange_t, dl);
+        EXPECT_LE(prev_end + PAGE_SIZE, rng->vaddr);
+        prev_end = rng->vend;
+    }
+}
@@ -1,6 +1,6 @@
 #include "block.h"
 #include <vmspace.h>
-#include <heap.h>
+#include <kmalloc.h>
 
 #include <kstring.h>
 #include <format.h>
@@ -205,7 +205,7 @@ fat32_volumn_t *fat32_mount(block_dev_t *blk, const uint8_t *sec0) {
         logk("correct, this is FAT32\n");
     }
 
-    fat32_volumn_t *vol = (fat32_volumn_t*)kernel_heap_alloc(sizeof(fat32_volumn_t));
+    fat32_volumn_t *vol = kmalloc(sizeof(fat32_volumn_t));
     if (NULL == vol) {
         logk("cannot allocate volumn object!\n");
         return NULL;
@@ -216,7 +216,7 @@ fat32_volumn_t *fat32_mount(block_dev_t *blk, const uint8_t *sec0) {
         fat_secs * sec_size, PT_FS, MMU_WRITE);
     if (NULL == vol->fat) {
         logk("cannot allocate space for FAT table!\n");
-        kernel_heap_free(vol);
+        kfree(vol);
         return NULL;
     }
     vol->fat_cache.desc = "FAT32-fat-cache";
@@ -238,7 +238,7 @@ fat32_volumn_t *fat32_mount(block_dev_t *blk, const uint8_t *sec0) {
 
 // 打开文件，动态创建一个 handle
 fat32_handle_t *fat32_open(fat32_volumn_t *vol, const fs_entry_t *ent) {
-    fat32_handle_t *h = kernel_heap_alloc(sizeof(fat32_handle_t));
+    fat32_handle_t *h = kmalloc(sizeof(fat32_handle_t));
     if (NULL == h) {
         logk("warning: cannot create handle object\n");
         return NULL;
@@ -250,7 +250,7 @@ fat32_handle_t *fat32_open(fat32_volumn_t *vol, const fs_entry_t *ent) {
         cluster_size, PT_FS, MMU_WRITE);
     if (0 == h->cache) {
         logk("warning: cannot allocate cache space for open file\n");
-        kernel_heap_free(h);
+        kfree(h);
         return NULL;
     }
     h->cluster_cache.desc = "open file cluster cache";
@@ -269,7 +269,7 @@ void fat32_close(fat32_volumn_t *vol, fat32_handle_t *h) {
     (void)vol;
     tlb_shootdown(h->cluster_cache.vaddr, h->cluster_cache.vend);
     vmspace_remove(&g_kernel_vm, &h->cluster_cache);
-    kernel_heap_free(h);
+    kfree(h);
 }
 
 // 读取接下来的 N 字节，实际读取的字节数也通过 len 返回
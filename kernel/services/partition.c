@@ -3,6 +3,7 @@
 #include <page.h>
 #include <arch_config.h>
 #include <heap.h>
+#include <kmalloc.h>
 #include <kstring.h>
 #include <debug.h>
 
@@ -146,7 +147,7 @@ void partition_init(block_dev_t *raw) {
             continue;
         }
 
-        partition_t *part = kernel_heap_alloc(sizeof(partition_t));
+        partition_t *part = kmalloc(sizeof(partition_t));
         part->raw = raw;
         part->start = entries[i].start_lba;
         part->blk.ops = &part_ops;
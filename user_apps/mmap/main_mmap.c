@@ -0,0 +1,55 @@
+#include <libc.h>
+
+// 匿名映射一大块内存，只有写入的页才分配物理内存
+static int test_anon() {
+    size_t size = 1024 * 1024;
+    char *buf = sys_mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == buf) {
+        sys_print("anonymous mmap failed\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < size; i += 4096 * 16) {
+        buf[i] = (char)i;
+    }
+    if ((0 != buf[4096]) || ((char)(4096 * 16) != buf[4096 * 16])) {
+        sys_print("anonymous mapping content mismatch\n");
+        return 1;
+    }
+
+    if (sys_munmap(buf, size)) {
+        sys_print("munmap failed\n");
+        return 1;
+    }
+    sys_print("anonymous mapping ok\n");
+    return 0;
+}
+
+// 映射自身的 ELF 文件，检查文件头
+static int test_file() {
+    int fd = sys_open("mmap.elf");
+    if (fd < 0) {
+        sys_print("cannot open mmap.elf\n");
+        return 1;
+    }
+
+    const char *elf = sys_mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, 0);
+    sys_close(fd);
+    if (MAP_FAILED == elf) {
+        sys_print("file mmap failed\n");
+        return 1;
+    }
+
+    if ((0x7f != elf[0]) || ('E' != elf[1]) || ('L' != elf[2]) || ('F' != elf[3])) {
+        sys_print("mapped file is not ELF\n");
+        return 1;
+    }
+
+    sys_munmap((void*)elf, 4096);
+    sys_print("file mapping ok\n");
+    return 0;
+}
+
+int main() {
+    return test_anon() + test_file();
+}
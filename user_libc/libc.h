@@ -10,5 +10,12 @@ size_t strlen(const char *s);
 static inline void sys_exit(int ret) { __syscall1(SYS_exit, ret); }
 static inline void sys_print(const char *s) { __syscall3(SYS_write, 1, (size_t)s, strlen(s)); }
 static inline void sys_read(char *s, size_t len) { __syscall3(SYS_read, 0, (size_t)s, len); }
+static inline int sys_open(const char *path) { return (int)__syscall2(SYS_open, (size_t)path, 0); }
+static inline int sys_close(int fd) { return (int)__syscall1(SYS_close, fd); }
+
+static inline void *sys_mmap(void *addr, size_t len, int prot, int flags, int fd, size_t off) {
+    return (void*)__syscall6(SYS_mmap, (size_t)addr, len, prot, flags, fd, off);
+}
+static inline int sys_munmap(void *addr, size_t len) { return (int)__syscall2(SYS_munmap, (size_t)addr, len); }
 
 #endif // LIBC_H